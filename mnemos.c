@@ -4,14 +4,36 @@
  * ---------------------------------------------------
  */
 
+#define _GNU_SOURCE
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/stat.h>
+#include <fcntl.h>
 #include <time.h>
 #include <unistd.h>
 #include <dirent.h>
 #include <stdint.h>
+#include <stdarg.h>
+#include <errno.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <pthread.h>
+#include <ctype.h>
+#include <sys/mman.h>
+#include <fnmatch.h>
+#include <sys/file.h>
+
+#ifdef __linux__
+#include <sys/ioctl.h>
+#include <linux/fs.h>
+#endif
+#ifdef __APPLE__
+#include <sys/clonefile.h>
+#endif
 
 #define MNEMOS_DIR ".mnemos"
 #define INDEX_FILE ".mnemos/index"
@@ -20,8 +42,15 @@
 #define HEAD_FILE ".mnemos/HEAD"
 #define HASH_SIZE 64
 #define REMOTE_FILE ".mnemos/remote"
+#define REMOTE_COMMITS_FILE ".mnemos/remote-commits"
 #define COMMITS_DIR ".mnemos/commits"
 
+#ifdef __APPLE__
+#define ST_MTIME_NSEC(st) ((st).st_mtimespec.tv_nsec)
+#else
+#define ST_MTIME_NSEC(st) ((st).st_mtim.tv_nsec)
+#endif
+
 /**
  * MurmurHash3 simplified implementation
  */
@@ -35,11 +64,12 @@ uint32_t murmur3_32(const char *key, size_t len, uint32_t seed) {
 
     uint32_t hash = seed;
 
-    const int nblocks = len / 4;
-    const uint32_t *blocks = (const uint32_t *) key;
-    int i;
+    // size_t all the way, lengths past 4 GiB must not wrap
+    const size_t nblocks = len / 4;
+    size_t i;
     for (i = 0; i < nblocks; i++) {
-        uint32_t k = blocks[i];
+        uint32_t k;
+        memcpy(&k, key + i * 4, sizeof(k));  // no unaligned loads
         k *= c1;
         k = (k << r1) | (k >> (32 - r1));
         k *= c2;
@@ -54,7 +84,9 @@ uint32_t murmur3_32(const char *key, size_t len, uint32_t seed) {
 
     switch (len & 3) {
         case 3: k1 ^= tail[2] << 16;
+                // fall through
         case 2: k1 ^= tail[1] << 8;
+                // fall through
         case 1: k1 ^= tail[0];
                 k1 *= c1;
                 k1 = (k1 << r1) | (k1 >> (32 - r1));
@@ -62,7 +94,7 @@ uint32_t murmur3_32(const char *key, size_t len, uint32_t seed) {
                 hash ^= k1;
     }
 
-    hash ^= len;
+    hash ^= (uint32_t) len;
     hash ^= (hash >> 16);
     hash *= 0x85ebca6b;
     hash ^= (hash >> 13);
@@ -72,1220 +104,9530 @@ uint32_t murmur3_32(const char *key, size_t len, uint32_t seed) {
     return hash;
 }
 
-
-void init();
-void track(const char *filename);
-void track_all();
-void restore_recursive(const char *src_base, const char *dest_base);
-void commit(const char *message);
-void revert(const char *commit_hash);
-void diff_file(const char *filename, const char *commit1, const char *commit2, int latest_flag);
-void copy_file(const char *src, const char *dest);
-void set_remote(const char *remote_path);
-void send();
-void fetch();
-void create_remote(const char *remote_path);
-void status();
-void create_memory(const char *memory_name);
-void list_memories();
-void recall_memory(const char *memory_name);
-void blend_memory(const char *source_memory);
-
-void hash_file(const char *filename, char *hash_out) {
-    FILE *file = fopen(filename, "rb");
-    if (!file) {
-        perror("Failed to open file for hashing");
-        exit(1);
+/*
+ * arena: bump-pointer allocator. A command allocates its paths and lists
+ * here and drops all of it in one shot when it ends, no free() per entry.
+ */
+struct arena_block {
+    struct arena_block *next;
+    size_t used;
+    size_t size;
+    char data[];
+};
+
+struct arena {
+    struct arena_block *head;
+};
+
+// saved position, restoring it frees everything allocated after the save
+struct arena_mark {
+    struct arena_block *block;
+    size_t used;
+};
+
+#define ARENA_BLOCK_SIZE (64 * 1024)
+
+void *arena_alloc(struct arena *a, size_t size) {
+    size = (size + 7) & ~(size_t) 7;
+    struct arena_block *block = a->head;
+    if (!block || block->used + size > block->size) {
+        size_t block_size = size > ARENA_BLOCK_SIZE ? size : ARENA_BLOCK_SIZE;
+        block = malloc(sizeof(struct arena_block) + block_size);
+        if (!block) {
+            perror("Out of memory");
+            exit(1);
+        }
+        block->next = a->head;
+        block->used = 0;
+        block->size = block_size;
+        a->head = block;
     }
+    void *p = block->data + block->used;
+    block->used += size;
+    return p;
+}
 
-    char buffer[1024];
-    size_t bytes_read;
-    uint32_t hash = 0;
+char *arena_strdup(struct arena *a, const char *s) {
+    size_t len = strlen(s) + 1;
+    char *p = arena_alloc(a, len);
+    memcpy(p, s, len);
+    return p;
+}
 
-    // seed for MurmurHash
-    uint32_t seed = 42;
+// snprintf into the arena, no length limit
+char *arena_printf(struct arena *a, const char *fmt, ...) {
+    va_list args;
+    va_start(args, fmt);
+    int len = vsnprintf(NULL, 0, fmt, args);
+    va_end(args);
+
+    char *p = arena_alloc(a, len + 1);
+    va_start(args, fmt);
+    vsnprintf(p, len + 1, fmt, args);
+    va_end(args);
+    return p;
+}
 
-    while ((bytes_read = fread(buffer, 1, sizeof(buffer), file)) > 0) {
-        hash = murmur3_32(buffer, bytes_read, hash ^ seed);
+struct arena_mark arena_save(struct arena *a) {
+    struct arena_mark mark = { a->head, a->head ? a->head->used : 0 };
+    return mark;
+}
+
+void arena_restore(struct arena *a, struct arena_mark mark) {
+    while (a->head && a->head != mark.block) {
+        struct arena_block *next = a->head->next;
+        free(a->head);
+        a->head = next;
     }
-    fclose(file);
+    if (a->head) a->head->used = mark.used;
+}
 
-    // hash to string
-    snprintf(hash_out, HASH_SIZE, "%08x", hash);
+void arena_free(struct arena *a) {
+    struct arena_mark empty = { NULL, 0 };
+    arena_restore(a, empty);
 }
 
-void remove_recursive(const char *path) {
-    struct stat st;
-    if (stat(path, &st) != 0) return;
+// per-command arena, released when the command returns
+static struct arena cmd_arena;
 
-    if (S_ISDIR(st.st_mode)) {
-        DIR *dir = opendir(path);
-        if (!dir) return;
+/*
+ * path table: interned, prefix-compressed paths. Each node is one path
+ * component plus its parent, so "src/a.c" and "src/b.c" share "src" and
+ * every path is stored once. "./" and repeated slashes are normalized
+ * away, so "./src/a.c" and "src/a.c" are the same entry.
+ */
+#define PATH_ROOT 0
+#define PATH_NONE UINT32_MAX
+#define PATH_MEMBER 1   // path itself was added, not only a prefix of one
+
+struct path_node {
+    uint32_t parent;
+    uint32_t next;      // hash chain
+    uint32_t flags;
+    const char *name;
+};
+
+struct path_table {
+    struct arena *arena;
+    struct path_node *nodes;
+    uint32_t count;
+    uint32_t capacity;
+    uint32_t *buckets;
+    uint32_t bucket_count;
+};
+
+uint32_t path_bucket(const struct path_table *t, uint32_t parent, const char *name, size_t len) {
+    return (murmur3_32(name, len, parent * 0x9e3779b1u)) & (t->bucket_count - 1);
+}
 
-        struct dirent *entry;
-        while ((entry = readdir(dir)) != NULL) {
-            if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) continue;
+void path_table_init(struct path_table *t, struct arena *a) {
+    memset(t, 0, sizeof(*t));
+    t->arena = a;
+    t->capacity = 1024;
+    t->nodes = malloc(t->capacity * sizeof(struct path_node));
+    t->bucket_count = 1024;
+    t->buckets = malloc(t->bucket_count * sizeof(uint32_t));
+    if (!t->nodes || !t->buckets) {
+        perror("Out of memory");
+        exit(1);
+    }
+    memset(t->buckets, 0xff, t->bucket_count * sizeof(uint32_t));
+    // node 0 is the root, the empty path
+    t->nodes[0].parent = PATH_NONE;
+    t->nodes[0].next = PATH_NONE;
+    t->nodes[0].flags = 0;
+    t->nodes[0].name = "";
+    t->count = 1;
+}
 
-            char subpath[512];
-            snprintf(subpath, sizeof(subpath), "%s/%s", path, entry->d_name);
-            remove_recursive(subpath);
+void path_table_free(struct path_table *t) {
+    free(t->nodes);
+    free(t->buckets);
+    t->nodes = NULL;
+    t->buckets = NULL;
+    t->count = 0;
+}
+
+void path_table_grow(struct path_table *t) {
+    uint32_t bucket_count = t->bucket_count * 2;
+    uint32_t *buckets = malloc(bucket_count * sizeof(uint32_t));
+    if (!buckets) {
+        perror("Out of memory");
+        exit(1);
+    }
+    memset(buckets, 0xff, bucket_count * sizeof(uint32_t));
+    free(t->buckets);
+    t->buckets = buckets;
+    t->bucket_count = bucket_count;
+    for (uint32_t id = 1; id < t->count; id++) {
+        struct path_node *n = &t->nodes[id];
+        uint32_t b = path_bucket(t, n->parent, n->name, strlen(n->name));
+        n->next = t->buckets[b];
+        t->buckets[b] = id;
+    }
+}
+
+// find child component of parent, optionally creating it
+uint32_t path_child(struct path_table *t, uint32_t parent, const char *name, size_t len, int create) {
+    uint32_t b = path_bucket(t, parent, name, len);
+    for (uint32_t id = t->buckets[b]; id != PATH_NONE; id = t->nodes[id].next) {
+        struct path_node *n = &t->nodes[id];
+        if (n->parent == parent && strncmp(n->name, name, len) == 0 && n->name[len] == '\0') {
+            return id;
         }
-        closedir(dir);
-        rmdir(path);
-    } else {
-        unlink(path);
     }
+    if (!create) return PATH_NONE;
+
+    if (t->count == t->capacity) {
+        t->capacity *= 2;
+        t->nodes = realloc(t->nodes, t->capacity * sizeof(struct path_node));
+        if (!t->nodes) {
+            perror("Out of memory");
+            exit(1);
+        }
+    }
+    char *copy = arena_alloc(t->arena, len + 1);
+    memcpy(copy, name, len);
+    copy[len] = '\0';
+
+    uint32_t id = t->count++;
+    t->nodes[id].parent = parent;
+    t->nodes[id].flags = 0;
+    t->nodes[id].name = copy;
+    t->nodes[id].next = t->buckets[b];
+    t->buckets[b] = id;
+    if (t->count > t->bucket_count) {
+        path_table_grow(t);
+    }
+    return id;
 }
 
-// memories are like bookmarks to moments in time
-void revert_clean(const char *commit_hash) {
-    char commit_dir[256];
-    snprintf(commit_dir, sizeof(commit_dir), "%s/%s", COMMITS_DIR, commit_hash);
-    
-    // Check if commit exists
-    struct stat st;
-    if (stat(commit_dir, &st) != 0) {
-        printf("Error: Commit %s not found.\n", commit_hash);
-        return;
+uint32_t path_walk(struct path_table *t, const char *path, int create) {
+    uint32_t id = PATH_ROOT;
+    const char *p = path;
+    while (*p) {
+        while (*p == '/') p++;
+        size_t len = strcspn(p, "/");
+        if (len == 0) break;
+        if (!(len == 1 && p[0] == '.')) {
+            id = path_child(t, id, p, len, create);
+            if (id == PATH_NONE) return PATH_NONE;
+        }
+        p += len;
     }
+    return id;
+}
 
-    printf("Reverting to commit: %s\n", commit_hash);
+uint32_t path_intern(struct path_table *t, const char *path) {
+    return path_walk(t, path, 1);
+}
 
-    // build a list of files that should exist
-    char **expected_files = NULL;
-    int file_count = 0;
-    DIR *commit_dir_handle = opendir(commit_dir);
-    if (commit_dir_handle) {
-        struct dirent *commit_entry;
-        while ((commit_entry = readdir(commit_dir_handle)) != NULL) {
-            if (strcmp(commit_entry->d_name, ".") == 0 || 
-                strcmp(commit_entry->d_name, "..") == 0 ||
-                strcmp(commit_entry->d_name, "message") == 0 ||
-                strcmp(commit_entry->d_name, "timestamp") == 0) {
-                continue;
-            }
-            // add to expected files list
-            expected_files = realloc(expected_files, (file_count + 1) * sizeof(char *));
-            expected_files[file_count] = strdup(commit_entry->d_name);
-            file_count++;
+uint32_t path_lookup(struct path_table *t, const char *path) {
+    return path_walk(t, path, 0);
+}
+
+// add path as a member of the set, returns 0 if it was already there
+int path_add(struct path_table *t, const char *path) {
+    uint32_t id = path_intern(t, path);
+    if (t->nodes[id].flags & PATH_MEMBER) return 0;
+    t->nodes[id].flags |= PATH_MEMBER;
+    return 1;
+}
+
+int path_has(struct path_table *t, const char *path) {
+    uint32_t id = path_lookup(t, path);
+    return id != PATH_NONE && (t->nodes[id].flags & PATH_MEMBER);
+}
+
+// rebuild the full path of an interned id
+char *path_string(struct path_table *t, uint32_t id, struct arena *a) {
+    size_t len = 0;
+    for (uint32_t n = id; n != PATH_ROOT; n = t->nodes[n].parent) {
+        len += strlen(t->nodes[n].name) + 1;
+    }
+    char *out = arena_alloc(a, len + 1);
+    char *end = out + (len ? len - 1 : 0);
+    *end = '\0';
+    for (uint32_t n = id; n != PATH_ROOT; n = t->nodes[n].parent) {
+        size_t name_len = strlen(t->nodes[n].name);
+        end -= name_len;
+        memcpy(end, t->nodes[n].name, name_len);
+        if (end > out) *--end = '/';
+    }
+    return out;
+}
+
+/*
+ * cones: the part of the tree a command may touch. A cone is a path
+ * table of directory or file prefixes, and the table's component trie is
+ * the matcher: walking a path down it either hits a member (inside),
+ * falls off (outside), or runs out while still above a member (parent,
+ * walk it only to reach what's inside). .mnemos/sparse holds the cone
+ * for checkouts, one prefix per line; paths given to revert and recall
+ * make a cone of their own. A NULL cone is the whole tree.
+ */
+#define SPARSE_FILE ".mnemos/sparse"
+#define CONE_OUT 0
+#define CONE_IN 1
+#define CONE_PARENT 2
+
+int cone_match(struct path_table *cone, const char *path) {
+    if (!cone) return CONE_IN;
+    uint32_t id = PATH_ROOT;
+    const char *p = path;
+    while (*p) {
+        while (*p == '/') p++;
+        size_t len = strcspn(p, "/");
+        if (len == 0) break;
+        if (!(len == 1 && p[0] == '.')) {
+            id = path_child(cone, id, p, len, 0);
+            if (id == PATH_NONE) return CONE_OUT;
+            if (cone->nodes[id].flags & PATH_MEMBER) return CONE_IN;
         }
-        closedir(commit_dir_handle);
+        p += len;
     }
+    return CONE_PARENT;
+}
 
-    // check current directory and remove files that shouldnt exist
-    DIR *current_dir = opendir(".");
-    if (current_dir) {
-        struct dirent *entry;
-        while ((entry = readdir(current_dir)) != NULL) {
-            if (strcmp(entry->d_name, ".") == 0 || 
-                strcmp(entry->d_name, "..") == 0 || 
-                strncmp(entry->d_name, ".mnemos", 7) == 0) {
-                continue;
-            }
+// a file is either in the cone or not, it has nothing below it
+int cone_has_file(struct path_table *cone, const char *path) {
+    return cone_match(cone, path) == CONE_IN;
+}
 
-            // check if file should exist
-            int should_exist = 0;
-            for (int i = 0; i < file_count; i++) {
-                if (strcmp(entry->d_name, expected_files[i]) == 0) {
-                    should_exist = 1;
-                    break;
-                }
-            }
+// read .mnemos/sparse into cone, 0 when there is no sparse checkout
+int load_sparse(struct path_table *cone) {
+    FILE *f = fopen(SPARSE_FILE, "r");
+    if (!f) return 0;
 
-            if (!should_exist) {
-                printf("Removing: %s (not in target commit)\n", entry->d_name);
-                remove_recursive(entry->d_name);
-            }
+    path_table_init(cone, &cmd_arena);
+    int count = 0;
+    char *line = NULL;
+    size_t capacity = 0;
+    while (getline(&line, &capacity, f) != -1) {
+        line[strcspn(line, "\r\n")] = 0;
+        if (line[0] == '\0' || line[0] == '#') continue;
+        if (path_walk(cone, line, 1) == PATH_ROOT) {
+            // "." or "/" selects everything
+            fclose(f);
+            free(line);
+            path_table_free(cone);
+            return 0;
         }
-        closedir(current_dir);
+        path_add(cone, line);
+        count++;
     }
+    free(line);
+    fclose(f);
+    if (count == 0) path_table_free(cone);
+    return count > 0;
+}
+
+// cone from command line paths, NULL (everything) when there are none
+struct path_table *cone_from_paths(struct path_table *cone, int count, char **paths) {
+    if (count == 0) return NULL;
+    path_table_init(cone, &cmd_arena);
+    for (int i = 0; i < count; i++) path_add(cone, paths[i]);
+    return cone;
+}
 
-    // free expected files list
-    for (int i = 0; i < file_count; i++) {
-        free(expected_files[i]);
+// load tracked paths from index into a path table
+void load_index(struct path_table *t) {
+    FILE *index = fopen(INDEX_FILE, "r");
+    if (!index) return;
+
+    char *line = NULL;
+    size_t capacity = 0;
+    while (getline(&line, &capacity, index) != -1) {
+        line[strcspn(line, "\n")] = 0;
+        if (line[0] != '\0') path_add(t, line);
     }
-    free(expected_files);
+    free(line);
+    fclose(index);
+}
 
-    // restore files from commit
-    restore_recursive(commit_dir, ".");
+// stat stamp of a file, compared to tell whether it changed under us
+struct file_stamp {
+    int exists;
+    time_t mtime;
+    long mtime_nsec;
+    off_t size;
+    ino_t ino;
+};
+
+// one tracked file as seen by a long-lived `mnemos serve`
+struct cache_entry {
+    char *path;
+    char head_hash[HASH_SIZE];  // hash recorded in HEAD commit, empty if new
+    char work_hash[HASH_SIZE];  // last hash of the work tree file
+    int missing;
+    struct file_stamp stamp;    // stat of the work tree file at work_hash time
+};
+
+// in-memory repository state, reloaded when index or HEAD generation moves
+struct repo_cache {
+    int loaded;
+    struct arena arena;         // paths of the current generation
+    struct path_table tracked;  // same paths, for untracked lookups
+    struct file_stamp index_stamp;
+    struct file_stamp head_stamp;
+    char head_commit[HASH_SIZE];
+    struct cache_entry *entries;
+    int count;
+};
+
+// only set inside `mnemos serve`, every other invocation reads from disk
+static struct repo_cache *repo_cache = NULL;
+
+// history index, described where it is read and written
+#define HISTORY_INDEX_FILE ".mnemos/history-index"
+#define BLOOM_BITS_PER_PATH 10
+#define BLOOM_HASHES 7
+
+struct history_entry {
+    char commit[HASH_SIZE];
+    char parent[HASH_SIZE];     // "" for the first commit
+    long timestamp;
+    uint64_t *bloom;
+    int words;
+    int line;                   // position in the file, later lines win
+};
+
+struct history {
+    struct history_entry *entries;  // sorted by commit id
+    int count;
+    int capacity;
+    struct arena arena;
+};
+
+// commit stats, described where they are read and written
+#define COMMIT_STATS_FILE ".mnemos/commit-stats"
+
+struct commit_stat {
+    char commit[HASH_SIZE];
+    char parent[HASH_SIZE];     // "" for the first commit
+    long files;                 // in the whole tree
+    long long bytes;
+    long added, removed, modified;
+    long long bytes_in;         // new contents of added and modified files
+    long long bytes_out;        // old contents of removed and modified files
+    int line;                   // position in the file, later lines win
+};
+
+struct commit_stats {
+    struct commit_stat *entries;    // sorted by commit id
+    int count;
+    int capacity;
+    int lines;                      // in the file, duplicates included
+};
 
-    // update HEAD
-    FILE *head = fopen(HEAD_FILE, "w");
-    if (!head) {
-        perror("Failed to update HEAD");
-        return;
+void init();
+void track(const char *filename);
+void track_all();
+void restore_recursive(const char *src_base, const char *dest_base, struct path_table *cone);
+void commit(const char *message);
+void revert(const char *commit_hash, struct path_table *scope);
+void diff_file(const char *filename, const char *commit1, const char *commit2, int latest_flag);
+void copy_file(const char *src, const char *dest);
+int read_hash_file(const char *path, char *hash_out);
+int read_commit_list(const char *path, char ***ids_out, struct arena *a);
+int enter_repository(const char *repo_dir);
+int compare_names(const void *a, const void *b);
+void for_each_tree_entry(const char *commit_dir,
+                         void (*fn)(void *ctx, const char *path, const char *hash),
+                         void *ctx, struct arena *a);
+void set_remote(const char *remote_path);
+void send_remote();
+void fetch();
+void create_remote(const char *remote_path);
+void status();
+void create_memory(const char *memory_name);
+void list_memories(const char *pattern);
+void recall_memory(const char *memory_name, struct path_table *scope);
+void blend_memory(const char *source_memory);
+void bitmap_index_commit(const char *commit, int replaced);
+void history_index_commit(const char *commit, const char *parent);
+void message_index_commit(const char *commit, const char *message);
+void commit_stats_commit(struct commit_stat *e, long matched, long long matched_bytes);
+void commit_stats_read(struct commit_stats *s);
+struct commit_stat *commit_stats_find(struct commit_stats *s, const char *commit);
+void commit_stats_free(struct commit_stats *s);
+long long object_size(const char *hash);
+void history_load(struct history *h);
+void history_free(struct history *h);
+char *normalize_history_path(const char *path, struct arena *a);
+int history_unchanged_between(struct history *h, const char *path, const char *older, const char *newer);
+const char *history_last_change(struct history *h, const char *path, const char *from);
+int diff_trees(const char *old_commit, const char *new_commit, const char *prefix,
+               void (*fn)(void *ctx, const char *path, const char *old_hash, const char *new_hash),
+               void *ctx, struct arena *a);
+int bitmaps_send_lists(const char *known_file, FILE *commits_out, FILE *objects_out,
+                       int *commit_count_out, int *object_count_out);
+void record_remote_commits(const char *known_file);
+char *link_target(const char *path, struct arena *a);
+int write_full(int fd, const char *buffer, size_t size);
+void create_directories(const char *path);
+int object_fanout();
+long long large_file_threshold();
+int detect_renames(const char *old_commit, const char *new_commit, char ***pairs_out, struct arena *a);
+
+/*
+ * atomic files: state is written to a temp file beside its target and
+ * renamed over it, so a reader sees the old or the new version, never
+ * half of one. Temp names start with a dot, which every listing of
+ * memories, objects and commits skips. Symlinked state (work trees) is
+ * replaced at its target.
+ */
+struct atomic_file {
+    FILE *f;
+    char *temp;
+    char *path;
+};
+
+FILE *atomic_begin(struct atomic_file *af, const char *path) {
+    af->path = link_target(path, &cmd_arena);
+    const char *slash = strrchr(af->path, '/');
+    af->temp = slash ? arena_printf(&cmd_arena, "%.*s/.%s-XXXXXX", (int) (slash - af->path), af->path, slash + 1)
+                     : arena_printf(&cmd_arena, ".%s-XXXXXX", af->path);
+    int fd = mkstemp(af->temp);
+    af->f = fd >= 0 ? fdopen(fd, "w") : NULL;
+    if (fd >= 0 && !af->f) {
+        close(fd);
+        unlink(af->temp);
     }
-    fprintf(head, "%s\n", commit_hash);
-    fclose(head);
+    if (af->f) fchmod(fd, 0644);
+    return af->f;
+}
 
-    printf("Revert complete.\n");
+// publish, -1 (and nothing changed) if anything failed
+int atomic_end(struct atomic_file *af) {
+    int failed = ferror(af->f);
+    if (fflush(af->f) != 0 || fsync(fileno(af->f)) != 0) failed = 1;
+    if (fclose(af->f) != 0) failed = 1;
+    if (failed || rename(af->temp, af->path) != 0) {
+        int saved = errno;
+        unlink(af->temp);
+        errno = saved;
+        return -1;
+    }
+    return 0;
 }
 
-// initialize with init
-void init() {
-    mkdir(MNEMOS_DIR, 0755);
-    mkdir(OBJECTS_DIR, 0755);
-    mkdir(COMMITS_DIR, 0755);
+void atomic_abort(struct atomic_file *af) {
+    fclose(af->f);
+    unlink(af->temp);
+}
 
-    // if file doesnt exist, create it, otherwise reset to zero bytes
-    FILE *index = fopen(INDEX_FILE, "w");
-    // close
-    fclose(index);
-    
-    // if file doesnt exist, create it, otherwise reset to zero bytes
-    FILE *head = fopen(HEAD_FILE, "w");
-    // close
-    fclose(head);
+// append-only logs get each record in a single write, concurrent
+// appenders (files opened with "a") can then never interleave inside one
+int append_record(FILE *f, const char *data, size_t len) {
+    if (fflush(f) != 0) return -1;
+    return write_full(fileno(f), data, len);
+}
 
-    printf("Initialized empty mnemos repository in %s\n", MNEMOS_DIR);
+int write_file_atomic(const char *path, const char *content) {
+    struct atomic_file af;
+    if (!atomic_begin(&af, path)) return -1;
+    fputs(content, af.f);
+    return atomic_end(&af);
 }
 
-// track file, because we care about it now
-void track(const char *filename) {
-    struct stat st;
-    if (stat(filename, &st) != 0) {
-        printf("Error: File '%s' does not exist. Skipping.\n", filename);
-        return;
+/*
+ * config: .mnemos/config, one "key value" per line.
+ */
+#define CONFIG_FILE ".mnemos/config"
+
+// value for key, NULL when unset
+char *config_get(const char *key) {
+    FILE *f = fopen(CONFIG_FILE, "r");
+    if (!f) return NULL;
+
+    char *value = NULL;
+    char *line = NULL;
+    size_t capacity = 0;
+    size_t key_len = strlen(key);
+    while (getline(&line, &capacity, f) != -1) {
+        line[strcspn(line, "\n")] = 0;
+        if (strncmp(line, key, key_len) == 0 && (line[key_len] == ' ' || line[key_len] == '\t')) {
+            char *v = line + key_len;
+            while (*v == ' ' || *v == '\t') v++;
+            value = arena_strdup(&cmd_arena, v);
+        }
     }
+    free(line);
+    fclose(f);
+    return value;
+}
 
-    // check if already tracked, we don't need duplicates
-    FILE *index = fopen(INDEX_FILE, "r");
-    if (!index) {
-        perror("Failed to open index file for reading");
+// sizes take k, m or g suffixes
+long long config_get_size(const char *key, long long fallback) {
+    char *value = config_get(key);
+    if (!value) return fallback;
+
+    char *end;
+    long long size = strtoll(value, &end, 10);
+    switch (*end) {
+        case 'k': case 'K': size <<= 10; break;
+        case 'm': case 'M': size <<= 20; break;
+        case 'g': case 'G': size <<= 30; break;
+    }
+    return size;
+}
+
+int config_get_flag(const char *key) {
+    char *value = config_get(key);
+    return value && (strcmp(value, "1") == 0 || strcmp(value, "true") == 0 || strcmp(value, "yes") == 0);
+}
+
+// set key to value (NULL removes it), rewriting the file through a temp file
+void config_set(const char *key, const char *value) {
+    // a work tree's config links to the main one, the rename goes there
+    struct atomic_file af;
+    FILE *out = atomic_begin(&af, CONFIG_FILE);
+    if (!out) {
+        perror("Failed to write config");
         exit(1);
     }
 
-    char line[256];
-    while (fgets(line, sizeof(line), index)) {
-        line[strcspn(line, "\n")] = 0; // strip newline
-        if (strcmp(line, filename) == 0) {
-            fclose(index);
-            printf("File '%s' is already tracked. Skipping.\n", filename);
-            return;
+    FILE *in = fopen(CONFIG_FILE, "r");
+    if (in) {
+        char *line = NULL;
+        size_t capacity = 0;
+        size_t key_len = strlen(key);
+        while (getline(&line, &capacity, in) != -1) {
+            if (strncmp(line, key, key_len) == 0 && (line[key_len] == ' ' || line[key_len] == '\t')) {
+                continue;
+            }
+            fputs(line, out);
         }
+        free(line);
+        fclose(in);
     }
-    fclose(index);
-
-    // add file to index, because we decided it's important
-    index = fopen(INDEX_FILE, "a");
-    if (!index) {
-        perror("Failed to open index file for appending");
+    if (value) fprintf(out, "%s %s\n", key, value);
+    if (atomic_end(&af) != 0) {
+        perror("Failed to write config");
         exit(1);
     }
-    fprintf(index, "%s\n", filename);
-    fclose(index);
+}
 
-    printf("Tracking file: %s\n", filename);
+void config(const char *key, const char *value) {
+    if (value) {
+        config_set(key, value);
+        printf("%s = %s\n", key, value);
+    } else {
+        char *current = config_get(key);
+        printf("%s\n", current ? current : "");
+    }
 }
 
-// track everything here in current dir like you're a hoarder
-void track_all_recursive(const char *dir_path) {
-    DIR *dir = opendir(dir_path);
-    if (!dir) {
-        perror("Failed to open directory");
-        exit(1);
+/*
+ * lock: one writer at a time. Commands that change the repository hold
+ * .mnemos/lock, created exclusively, for as long as they run; others
+ * wait for it up to lock-timeout seconds (default 10). Readers never
+ * take it. The lock names its pid and host, so a lock left by a process
+ * that died on this machine is taken over, under a flock on
+ * .mnemos/lock-takeover so that two waiters finding the same dead holder
+ * don't both replace it. In a work tree the paths go through the commits
+ * symlink, so all trees of a repository share them.
+ */
+#define LOCK_FILE ".mnemos/commits/../lock"
+#define LOCK_TAKEOVER_FILE ".mnemos/commits/../lock-takeover"
+#define LOCK_DEFAULT_TIMEOUT 10
+
+static int lock_depth = 0;
+static pid_t lock_owner = 0;
+
+void repo_unlock_at_exit() {
+    // forked children inherit this, only the holder removes the lock
+    if (lock_depth > 0 && lock_owner == getpid()) {
+        unlink(LOCK_FILE);
+        lock_depth = 0;
     }
+}
 
-    struct dirent *entry;
-    while ((entry = readdir(dir)) != NULL) {
-        // skip special files and .mnemos internals
-        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0 ||
-            strncmp(entry->d_name, ".mnemos", 7) == 0) {
-            continue;
-        }
+// is the lock held by a process of this host that no longer exists?
+int lock_is_stale() {
+    FILE *f = fopen(LOCK_FILE, "r");
+    if (!f) return 0;
+    long pid = 0;
+    char host[256] = {0}, our_host[256] = {0};
+    int fields = fscanf(f, "%ld %255s", &pid, host);
+    fclose(f);
+    gethostname(our_host, sizeof(our_host) - 1);
+    return fields == 2 && pid > 0 && strcmp(host, our_host) == 0 &&
+           kill((pid_t) pid, 0) != 0 && errno == ESRCH;
+}
 
-        char full_path[512];
-        snprintf(full_path, sizeof(full_path), "%s/%s", dir_path, entry->d_name);
+// create the lock file; 0 when created, -1 when it exists, 1 outside a repository
+int lock_create() {
+    int fd = open(LOCK_FILE, O_WRONLY | O_CREAT | O_EXCL, 0644);
+    if (fd < 0) return errno == EEXIST ? -1 : 1;
+    char host[256] = {0};
+    gethostname(host, sizeof(host) - 1);
+    dprintf(fd, "%ld %s\n", (long) getpid(), host[0] ? host : "localhost");
+    close(fd);
+    if (lock_owner == 0) atexit(repo_unlock_at_exit);
+    lock_owner = getpid();
+    lock_depth = 1;
+    return 0;
+}
 
-        struct stat st;
-        if (stat(full_path, &st) == 0) {
-            if (S_ISDIR(st.st_mode)) {
-                // recurse into subdirectories
-                track_all_recursive(full_path);
-            } else if (S_ISREG(st.st_mode)) {
-                // track regular files
-                track(full_path);
-            }
-        } else {
-            perror("Failed to stat file");
+// 0 when taken, -1 when someone else holds it, 1 outside a repository
+int repo_try_lock() {
+    if (lock_depth > 0) {
+        lock_depth++;
+        return 0;
+    }
+    int result = lock_create();
+    if (result != -1 || !lock_is_stale()) return result;
+
+    // only one waiter at a time replaces a stale lock, and checks it is still stale first:
+    // one that waited here may find the lock already taken over by the one before it
+    int guard = open(LOCK_TAKEOVER_FILE, O_RDWR | O_CREAT, 0644);
+    if (guard < 0) return -1;
+    if (flock(guard, LOCK_EX) == 0 && lock_is_stale()) {
+        unlink(LOCK_FILE);
+        result = lock_create();
+    }
+    // closing drops the flock, and a holder that dies drops it too
+    close(guard);
+    return result;
+}
+
+void repo_lock() {
+    char *value = config_get("lock-timeout");
+    int timeout_ms = (value ? atoi(value) : LOCK_DEFAULT_TIMEOUT) * 1000;
+    int waited_ms = 0, delay_ms = 5;
+    while (repo_try_lock() < 0) {
+        if (waited_ms >= timeout_ms) {
+            printf("Error: Repository is locked by another mnemos (%s). Try again later.\n", MNEMOS_DIR "/lock");
+            exit(1);
         }
+        usleep(delay_ms * 1000);
+        waited_ms += delay_ms;
+        if (delay_ms < 200) delay_ms *= 2;
     }
-    closedir(dir);
 }
 
-void track_all() {
-    // recursive tracking from current dir
-    track_all_recursive(".");
+void repo_unlock() {
+    if (lock_depth == 0) return;
+    if (--lock_depth == 0) unlink(LOCK_FILE);
 }
-void create_directories(const char *path) {
-    char temp[256];
-    strncpy(temp, path, sizeof(temp));
-    temp[sizeof(temp) - 1] = '\0';
 
-    for (char *p = temp + 1; *p; p++) {
-        if (*p == '/') {
-            *p = '\0';
-            // make way for intermediate directory
-            mkdir(temp, 0755); 
-            *p = '/';
+// show or set the sparse checkout, --off removes it
+void sparse(int count, char **prefixes) {
+    if (count == 0) {
+        FILE *f = fopen(SPARSE_FILE, "r");
+        if (!f) {
+            printf("No sparse checkout, the whole tree is checked out.\n");
+            return;
         }
+        char *line = NULL;
+        size_t capacity = 0;
+        while (getline(&line, &capacity, f) != -1) fputs(line, stdout);
+        free(line);
+        fclose(f);
+        return;
     }
-}
 
-// just commit, you have better things to do than read 47 pages of documentation.
-void commit(const char *message) {
-    char line[256];
-    char file_hash[HASH_SIZE];
-    FILE *temp_index;
+    if (count == 1 && strcmp(prefixes[0], "--off") == 0) {
+        unlink(SPARSE_FILE);
+        printf("Sparse checkout off. Revert or recall to bring back the rest of the tree.\n");
+        return;
+    }
 
-    // generate commit ID based on curr timestamp
-    time_t now = time(NULL);
-    char commit_hash[HASH_SIZE];
-    snprintf(commit_hash, sizeof(commit_hash), "%lx", now);
-
-    // make way for commit directory
-    char commit_dir[256];
-    snprintf(commit_dir, sizeof(commit_dir), "%s/%s", COMMITS_DIR, commit_hash);
-    mkdir(commit_dir, 0755);
-
-    // save commit metadata
-    char metadata_path[256];
-    snprintf(metadata_path, sizeof(metadata_path), "%s/message", commit_dir);
-    FILE *metadata = fopen(metadata_path, "w");
-    if (!metadata) {
-        perror("Failed to create commit metadata");
+    struct atomic_file af;
+    if (!atomic_begin(&af, SPARSE_FILE)) {
+        perror("Failed to write sparse checkout");
         exit(1);
     }
-    fprintf(metadata, "message: %s\n", message);
-    fclose(metadata);
-
-    // save commit timestamp
-    char timestamp_path[256];
-    snprintf(timestamp_path, sizeof(timestamp_path), "%s/timestamp", commit_dir);
-    FILE *timestamp = fopen(timestamp_path, "w");
-    if (!timestamp) {
-        perror("Failed to create timestamp file");
+    for (int i = 0; i < count; i++) fprintf(af.f, "%s\n", prefixes[i]);
+    if (atomic_end(&af) != 0) {
+        perror("Failed to write sparse checkout");
         exit(1);
     }
-    fprintf(timestamp, "%ld\n", now);
-    fclose(timestamp);
+    printf("Sparse checkout set to %d path%s. Revert or recall to apply it.\n", count, count == 1 ? "" : "s");
+}
 
-    FILE *index = fopen(INDEX_FILE, "r");
-    if (!index) {
-        perror("Failed to read index");
-        exit(1);
+/*
+ * workers: run fn(ctx, i) for i in [0, count) on every core.
+ * Work is handed out one item at a time, so slow items don't stall a batch.
+ */
+struct parallel_job {
+    void (*fn)(void *ctx, int i);
+    void *ctx;
+    int count;
+    int next;
+};
+
+void *parallel_worker(void *arg) {
+    struct parallel_job *job = arg;
+    int i;
+    while ((i = __sync_fetch_and_add(&job->next, 1)) < job->count) {
+        job->fn(job->ctx, i);
     }
+    return NULL;
+}
 
-    // temp index to track valid files for next commit
-    temp_index = fopen(".mnemos/index.temp", "w");
-    if (!temp_index) {
-        perror("Failed to create temporary index");
-        fclose(index);
-        exit(1);
+#define MAX_WORKERS 256
+
+int worker_count() {
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    if (cores < 1) cores = 1;
+    if (cores > 64) cores = 64;
+    return (int) cores;
+}
+
+void parallel_for_threads(int count, int threads, void (*fn)(void *ctx, int i), void *ctx) {
+    struct parallel_job job = { fn, ctx, count, 0 };
+    // settings are read up front: workers hash files and look objects up, but never touch config
+    large_file_threshold();
+    object_fanout();
+    if (threads > MAX_WORKERS) threads = MAX_WORKERS;
+    if (threads > count) threads = count;
+    if (threads <= 1) {
+        parallel_worker(&job);
+        return;
     }
 
-    // for each file in index
-    while (fgets(line, sizeof(line), index)) {
-        // strip newline
-        line[strcspn(line, "\n")] = 0; 
+    pthread_t ids[MAX_WORKERS];
+    int started = 0;
+    for (int t = 0; t < threads; t++) {
+        if (pthread_create(&ids[started], NULL, parallel_worker, &job) == 0) started++;
+    }
+    // the calling thread helps too, and carries on alone if no thread started
+    parallel_worker(&job);
+    for (int t = 0; t < started; t++) {
+        pthread_join(ids[t], NULL);
+    }
+}
 
-        struct stat st;
-        if (stat(line, &st) == 0) {
-            // hash file content
-            hash_file(line, file_hash);
+// one thread per core, for work that is mostly CPU
+void parallel_for(int count, void (*fn)(void *ctx, int i), void *ctx) {
+    parallel_for_threads(count, worker_count(), fn, ctx);
+}
 
-            // establish object path in objects dir
-            char object_path[256];
-            snprintf(object_path, sizeof(object_path), "%s/%s", OBJECTS_DIR, file_hash);
+/*
+ * large files: above large-file-threshold (config, default 64m) files are
+ * streamed through big aligned buffers by a read-ahead thread while the
+ * caller hashes and writes the previous buffer, so hashing and storing a
+ * huge file is one sequential pass. The hash is the same as hash_file()
+ * gives: content is still fed to murmur in 1024-byte chunks.
+ */
+#define LARGE_FILE_DEFAULT_THRESHOLD (64LL << 20)
+#define STREAM_BUFFER_SIZE (1 << 20)
+#define HASH_CHUNK_SIZE 1024
+
+long long large_file_threshold() {
+    static long long threshold = -1;
+    if (threshold < 0) {
+        threshold = config_get_size("large-file-threshold", LARGE_FILE_DEFAULT_THRESHOLD);
+    }
+    return threshold;
+}
 
-            // save hash reference in commit dir
-            char commit_file_path[256];
-            snprintf(commit_file_path, sizeof(commit_file_path), "%s/%s", commit_dir, line);
-            create_directories(commit_file_path);
+/*
+ * object fan-out: with object-fanout (config) at 1, object abcdef01 is
+ * objects/ab/cdef01, at 2 objects/ab/cd/ef01; at 0 objects/ is flat, as
+ * in repositories made before fan-out. New objects go where the setting
+ * says. Readers look there, then in the other layouts, then there once
+ * more, so an object that `mnemos fanout` renames while they look is
+ * still found. Paths fit in OBJECT_PATH_SIZE.
+ */
+#define OBJECT_FANOUT_MAX 2
+#define OBJECT_FANOUT_DEFAULT 1     // written by init
+#define OBJECT_PATH_SIZE (sizeof(OBJECTS_DIR) + HASH_SIZE + 2 * OBJECT_FANOUT_MAX + 1)
 
-            FILE *commit_entry = fopen(commit_file_path, "w");
-            if (!commit_entry) {
-                perror("Failed to create commit file entry");
-                fclose(index);
-                fclose(temp_index);
-                return;
-            }
-            // save file hash
-            fprintf(commit_entry, "%s\n", file_hash); 
-            fclose(commit_entry);
+static int object_fanout_depth = -1;
 
-            // copy file content to objects (if it doesnt already exist)
-            if (access(object_path, F_OK) == -1) {
-                copy_file(line, object_path);
-            }
+int object_fanout() {
+    if (object_fanout_depth < 0) {
+        long long depth = config_get_size("object-fanout", 0);
+        object_fanout_depth = depth < 0 ? 0 : depth > OBJECT_FANOUT_MAX ? OBJECT_FANOUT_MAX : (int) depth;
+    }
+    return object_fanout_depth;
+}
 
-            // add file back to next commit index
-            fprintf(temp_index, "%s\n", line);
-        } else {
-            printf("Warning: File '%s' is missing. Skipping.\n", line);
-        }
+// hash's path in the layout depth levels deep
+void object_path_at(char *out, const char *hash, int depth) {
+    char *o = out + sprintf(out, "%s/", OBJECTS_DIR);
+    for (int level = 0; level < depth && strlen(hash) > 2; level++) {
+        o += sprintf(o, "%.2s/", hash);
+        hash += 2;
     }
-    fclose(index);
-    fclose(temp_index);
+    strcpy(o, hash);
+}
 
-    // replace old index with updated index
-    rename(".mnemos/index.temp", INDEX_FILE);
+// where a new object hash goes
+void object_path(char *out, const char *hash) {
+    object_path_at(out, hash, object_fanout());
+}
 
-    // update HEAD to point to latest commit
-    FILE *head = fopen(HEAD_FILE, "w");
-    if (!head) {
-        perror("Failed to update HEAD");
-        exit(1);
+// where object hash is now, in any layout; -1 (and where it would go) if nowhere
+int object_find(char *out, const char *hash) {
+    int depth = object_fanout();
+    object_path_at(out, hash, depth);
+    if (access(out, F_OK) == 0) return 0;
+    for (int other = 0; other <= OBJECT_FANOUT_MAX; other++) {
+        if (other == depth) continue;
+        object_path_at(out, hash, other);
+        if (access(out, F_OK) == 0) return 0;
     }
-    fprintf(head, "%s\n", commit_hash);
-    fclose(head);
+    object_path_at(out, hash, depth);
+    return access(out, F_OK) == 0 ? 0 : -1;
+}
 
-    printf("Committed changes: %s\n", message);
+int object_exists(const char *hash) {
+    char path[OBJECT_PATH_SIZE];
+    return object_find(path, hash) == 0;
 }
-// Mnemosyne remembers. 
-// Recursive function to traverse and restore directories and files
-void restore_recursive(const char *src_base, const char *dest_base) {
-    struct stat st;
-    DIR *dir = opendir(src_base);
-    if (!dir) {
-        perror("Failed to open source directory during revert");
-        exit(1);
-    }
 
-    struct dirent *entry;
-    while ((entry = readdir(dir)) != NULL) {
-        // skip special files and metadata
-        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0 ||
-            strcmp(entry->d_name, "timestamp") == 0 || strcmp(entry->d_name, "message") == 0) {
-            continue;
-        }
+// rename a finished temp file into place as object hash
+int object_publish(const char *temp_path, const char *hash) {
+    char path[OBJECT_PATH_SIZE];
+    object_path(path, hash);
+    if (rename(temp_path, path) == 0) return 0;
+    if (errno != ENOENT) return -1;
+    create_directories(path);
+    return rename(temp_path, path);
+}
 
-        char src_entry[512], dest_entry[512];
-        snprintf(src_entry, sizeof(src_entry), "%s/%s", src_base, entry->d_name);
-        snprintf(dest_entry, sizeof(dest_entry), "%s/%s", dest_base, entry->d_name);
+struct read_ahead {
+    int fd;
+    char *buffers[2];
+    size_t lengths[2];
+    int full[2];
+    int done;        // reader hit end of file or an error
+    int error;
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+};
+
+// fill buffer completely unless the file ends, so chunks stay 1024-aligned
+ssize_t read_full(int fd, char *buffer, size_t size) {
+    size_t total = 0;
+    while (total < size) {
+        ssize_t n = read(fd, buffer + total, size - total);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        if (n == 0) break;
+        total += n;
+    }
+    return total;
+}
 
-        if (stat(src_entry, &st) == 0) {
-            if (S_ISDIR(st.st_mode)) {
-                // dir must exist
-                mkdir(dest_entry, 0755);
-                restore_recursive(src_entry, dest_entry); 
-            } else if (S_ISREG(st.st_mode)) {
-                // restore file
-                FILE *hash_file = fopen(src_entry, "r");
-                if (!hash_file) {
-                    perror("Failed to open hash file during restore");
-                    continue;
-                }
+int write_full(int fd, const char *buffer, size_t size) {
+    while (size > 0) {
+        ssize_t n = write(fd, buffer, size);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        buffer += n;
+        size -= n;
+    }
+    return 0;
+}
 
-                char file_hash[HASH_SIZE];
-                if (fgets(file_hash, sizeof(file_hash), hash_file)) {
-                    // strip newline
-                    file_hash[strcspn(file_hash, "\n")] = 0; 
-                }
-                fclose(hash_file);
+void *read_ahead_thread(void *arg) {
+    struct read_ahead *ra = arg;
+    for (int slot = 0; ; slot ^= 1) {
+        pthread_mutex_lock(&ra->lock);
+        while (ra->full[slot]) pthread_cond_wait(&ra->changed, &ra->lock);
+        pthread_mutex_unlock(&ra->lock);
+
+        ssize_t n = read_full(ra->fd, ra->buffers[slot], STREAM_BUFFER_SIZE);
+
+        pthread_mutex_lock(&ra->lock);
+        if (n < 0) ra->error = 1;
+        ra->lengths[slot] = n > 0 ? n : 0;
+        ra->full[slot] = 1;
+        if (n < STREAM_BUFFER_SIZE) ra->done = 1;
+        pthread_cond_broadcast(&ra->changed);
+        pthread_mutex_unlock(&ra->lock);
+        if (n < STREAM_BUFFER_SIZE) return NULL;
+    }
+}
 
-                // locate file in objects
-                char object_path[512];
-                snprintf(object_path, sizeof(object_path), "%s/%s", OBJECTS_DIR, file_hash);
+/*
+ * stream fd_in once: hash into hash_out and copy to fd_out when it's >= 0.
+ * Returns 0, or -1 on a read or write error.
+ */
+int stream_fd(int fd_in, int fd_out, char *hash_out) {
+#ifdef POSIX_FADV_SEQUENTIAL
+    posix_fadvise(fd_in, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+    struct read_ahead ra;
+    memset(&ra, 0, sizeof(ra));
+    ra.fd = fd_in;
+    for (int i = 0; i < 2; i++) {
+        void *buffer;
+        if (posix_memalign(&buffer, 4096, STREAM_BUFFER_SIZE) != 0) {
+            if (i == 1) free(ra.buffers[0]);
+            return -1;
+        }
+        ra.buffers[i] = buffer;
+    }
+    pthread_mutex_init(&ra.lock, NULL);
+    pthread_cond_init(&ra.changed, NULL);
 
-                if (access(object_path, F_OK) != 0) {
-                    printf("Error: Object %s not found for file '%s'\n", file_hash, dest_entry);
-                    continue;
-                }
+    pthread_t reader;
+    int threaded = pthread_create(&reader, NULL, read_ahead_thread, &ra) == 0;
 
-                // restore content from objects/
-                copy_file(object_path, dest_entry);
-                printf("Restored file: %s\n", dest_entry);
-            }
+    uint32_t hash = 0;
+    uint32_t seed = 42;
+    int failed = 0;
+    for (int slot = 0; ; slot ^= 1) {
+        if (threaded) {
+            pthread_mutex_lock(&ra.lock);
+            while (!ra.full[slot]) pthread_cond_wait(&ra.changed, &ra.lock);
+            pthread_mutex_unlock(&ra.lock);
         } else {
-            perror("Failed to stat source entry during revert");
+            // no thread, read inline
+            ssize_t n = read_full(fd_in, ra.buffers[slot], STREAM_BUFFER_SIZE);
+            if (n < 0) ra.error = 1;
+            ra.lengths[slot] = n > 0 ? n : 0;
+            ra.full[slot] = 1;
+            if (n < STREAM_BUFFER_SIZE) ra.done = 1;
         }
+
+        size_t length = ra.lengths[slot];
+        for (size_t off = 0; off < length; off += HASH_CHUNK_SIZE) {
+            size_t chunk = length - off < HASH_CHUNK_SIZE ? length - off : HASH_CHUNK_SIZE;
+            hash = murmur3_32(ra.buffers[slot] + off, chunk, hash ^ seed);
+        }
+        if (fd_out >= 0 && !failed && write_full(fd_out, ra.buffers[slot], length) != 0) {
+            failed = 1;
+        }
+
+        pthread_mutex_lock(&ra.lock);
+        int last = length < STREAM_BUFFER_SIZE;
+        ra.full[slot] = 0;
+        pthread_cond_broadcast(&ra.changed);
+        pthread_mutex_unlock(&ra.lock);
+        if (last) break;
     }
-    closedir(dir);
+
+    if (threaded) pthread_join(reader, NULL);
+    pthread_mutex_destroy(&ra.lock);
+    pthread_cond_destroy(&ra.changed);
+    free(ra.buffers[0]);
+    free(ra.buffers[1]);
+
+    if (hash_out) snprintf(hash_out, HASH_SIZE, "%08x", hash);
+    return ra.error || failed ? -1 : 0;
 }
-/* 
- * Mnemosyne remembers. Revert to another time, a simpler time.
- *
+
+/*
+ * store a large file as an object in one pass: stream it into a temp
+ * object while hashing, then publish it under its hash.
  */
-void revert(const char *commit_hash) {
-    char commit_dir[256];
-    struct stat st;
+int store_large_file(const char *filename, char *hash_out) {
+    int fd_in = open(filename, O_RDONLY);
+    if (fd_in < 0) return -1;
+
+    char temp_path[] = OBJECTS_DIR "/.tmp-XXXXXX";
+    int fd_out = mkstemp(temp_path);
+    if (fd_out < 0) {
+        close(fd_in);
+        return -1;
+    }
 
-    // does commit exist
-    snprintf(commit_dir, sizeof(commit_dir), "%s/%s", COMMITS_DIR, commit_hash);
-    if (stat(commit_dir, &st) != 0) {
-        printf("Error: Commit %s not found.\n", commit_hash);
-        exit(1);
+    int result = stream_fd(fd_in, fd_out, hash_out);
+    close(fd_in);
+    fchmod(fd_out, 0644);
+    if (close(fd_out) != 0) result = -1;
+    if (result != 0) {
+        unlink(temp_path);
+        return -1;
     }
 
-    printf("Reverting to commit: %s\n", commit_hash);
+    if (object_exists(hash_out)) {
+        // content already stored
+        unlink(temp_path);
+    } else if (object_publish(temp_path, hash_out) != 0) {
+        unlink(temp_path);
+        return -1;
+    }
+    return 0;
+}
 
-    // restore files from target commit
-    restore_recursive(commit_dir, ".");
+// hash file content, -1 if file can't be read
+int try_hash_file(const char *filename, char *hash_out) {
+    FILE *file = fopen(filename, "rb");
+    if (!file) {
+        return -1;
+    }
 
-    // remove files not in the target commit
-    FILE *index = fopen(INDEX_FILE, "r");
-    if (!index) {
-        perror("Failed to open index for cleanup");
-        exit(1);
+    struct stat st;
+    if (fstat(fileno(file), &st) == 0 && st.st_size >= large_file_threshold()) {
+        int result = stream_fd(fileno(file), -1, hash_out);
+        fclose(file);
+        return result;
     }
 
-    char line[256];
-    while (fgets(line, sizeof(line), index)) {
-        line[strcspn(line, "\n")] = 0; // remove newline
-        snprintf(commit_dir, sizeof(commit_dir), "%s/%s", COMMITS_DIR, commit_hash);
+    char buffer[1024];
+    size_t bytes_read;
+    uint32_t hash = 0;
 
-        char commit_file_path[512];
-        snprintf(commit_file_path, sizeof(commit_file_path), "%s/%s", commit_dir, line);
+    // seed for MurmurHash
+    uint32_t seed = 42;
 
-        // does file exist in target commit
-        if (stat(commit_file_path, &st) != 0) {
-            printf("Removing: %s\n", line);
-            remove_recursive(line);
-        }
+    while ((bytes_read = fread(buffer, 1, sizeof(buffer), file)) > 0) {
+        hash = murmur3_32(buffer, bytes_read, hash ^ seed);
     }
-    fclose(index);
+    fclose(file);
 
-    // update HEAD
-    FILE *head = fopen(HEAD_FILE, "w");
-    if (!head) {
-        perror("Failed to update HEAD");
+    // hash to string
+    snprintf(hash_out, HASH_SIZE, "%08x", hash);
+    return 0;
+}
+
+void hash_file(const char *filename, char *hash_out) {
+    if (try_hash_file(filename, hash_out) != 0) {
+        perror("Failed to open file for hashing");
         exit(1);
     }
-    fprintf(head, "%s\n", commit_hash);
-    fclose(head);
-
-    printf("Revert complete.\n");
 }
 
 /*
- * moments: simple stroll through project history.
- * 
+ * batched I/O: commit, status and checkout hand their per-file work
+ * (stat, hash, store, copy) to a pool of io-threads workers (config,
+ * default 4 per core and at least 16), so many requests are in flight at
+ * once and latency on cold caches or network storage overlaps instead of
+ * adding up. Workers fill per-file results, callers print them in order.
+ * Workers must not use cmd_arena or print.
  */
-void moments(const char *order_flag) {
-    DIR *dir = opendir(COMMITS_DIR);
-    if (!dir) {
-        perror("Failed to open commits directory");
-        exit(1);
+int io_thread_count() {
+    long long threads = config_get_size("io-threads", 0);
+    if (threads <= 0) {
+        threads = worker_count() * 4;
+        if (threads < 16) threads = 16;
     }
+    return (int) threads;
+}
 
-    struct dirent *entry;
-    struct {
-        char hash[HASH_SIZE];
-        time_t timestamp;
-        char message[256];
-    } commits[1024]; // make this adjustable?
-    int count = 0;
+void io_batch(int count, void (*fn)(void *ctx, int i), void *ctx) {
+    parallel_for_threads(count, io_thread_count(), fn, ctx);
+}
 
-    // collect commit data
-    while ((entry = readdir(dir)) != NULL) {
-        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) {
-            continue;
+// copy fd_in to fd_out, hashing what passes through when hash_out is set
+int copy_fd_hashed(int fd_in, int fd_out, char *hash_out) {
+    struct stat st;
+    if (fstat(fd_in, &st) == 0 && st.st_size >= large_file_threshold()) {
+        return stream_fd(fd_in, fd_out, hash_out);
+    }
+    char buffer[65536];
+    ssize_t n;
+    uint32_t hash = 0;
+    uint32_t seed = 42;
+    while ((n = read_full(fd_in, buffer, sizeof(buffer))) > 0) {
+        // same 1024 byte chunks as try_hash_file
+        for (ssize_t off = 0; hash_out && off < n; off += HASH_CHUNK_SIZE) {
+            size_t chunk = n - off < HASH_CHUNK_SIZE ? n - off : HASH_CHUNK_SIZE;
+            hash = murmur3_32(buffer + off, chunk, hash ^ seed);
         }
+        if (write_full(fd_out, buffer, n) != 0) return -1;
+        if ((size_t) n < sizeof(buffer)) break;
+    }
+    if (hash_out) snprintf(hash_out, HASH_SIZE, "%08x", hash);
+    return n < 0 ? -1 : 0;
+}
 
-        char commit_dir[256], timestamp_path[256], message_path[256];
-        snprintf(commit_dir, sizeof(commit_dir), "%s/%s", COMMITS_DIR, entry->d_name);
+int copy_fd(int fd_in, int fd_out) {
+    return copy_fd_hashed(fd_in, fd_out, NULL);
+}
 
-        snprintf(timestamp_path, sizeof(timestamp_path), "%s/timestamp", commit_dir);
-        snprintf(message_path, sizeof(message_path), "%s/message", commit_dir);
+// copy without exiting, -1 and no partial dest on failure
+int try_copy_file(const char *src, const char *dest) {
+    int fd_in = open(src, O_RDONLY);
+    if (fd_in < 0) return -1;
+    int fd_out = open(dest, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    if (fd_out < 0) {
+        close(fd_in);
+        return -1;
+    }
 
-        FILE *timestamp_file = fopen(timestamp_path, "r");
-        FILE *message_file = fopen(message_path, "r");
+    int result = copy_fd(fd_in, fd_out);
+    close(fd_in);
+    if (close(fd_out) != 0) result = -1;
+    if (result != 0) {
+        int saved = errno;
+        unlink(dest);
+        errno = saved;
+    }
+    return result;
+}
 
-        if (timestamp_file) {
-            fscanf(timestamp_file, "%ld", &commits[count].timestamp);
-            fclose(timestamp_file);
-        } else {
-            commits[count].timestamp = 0;
-        }
+/*
+ * clone: share src's blocks with dest where the filesystem can (FICLONE
+ * on btrfs/XFS, clonefile on APFS), otherwise copy. Objects never change
+ * in place, so a checkout can share their extents safely.
+ */
+// swap two paths in one step, where the system can; -1 otherwise
+int rename_exchange(const char *a, const char *b) {
+#if defined(__linux__) && defined(RENAME_EXCHANGE)
+    return renameat2(AT_FDCWD, a, AT_FDCWD, b, RENAME_EXCHANGE);
+#elif defined(__APPLE__) && defined(RENAME_SWAP)
+    return renamex_np(a, b, RENAME_SWAP);
+#else
+    (void) a;
+    (void) b;
+    errno = ENOSYS;
+    return -1;
+#endif
+}
 
-        if (message_file) {
-            fgets(commits[count].message, sizeof(commits[count].message), message_file);
-            commits[count].message[strcspn(commits[count].message, "\n")] = 0; // remove newline
-            fclose(message_file);
+int try_reflink(const char *src, const char *dest) {
+#ifdef __APPLE__
+    unlink(dest);
+    if (clonefile(src, dest, 0) == 0) return 0;
+#endif
+#if defined(__linux__) && defined(FICLONE)
+    int fd_in = open(src, O_RDONLY);
+    if (fd_in >= 0) {
+        int fd_out = open(dest, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+        if (fd_out >= 0) {
+            int cloned = ioctl(fd_out, FICLONE, fd_in) == 0;
+            int closed = close(fd_out) == 0;
+            close(fd_in);
+            if (cloned && closed) return 0;
         } else {
-            strcpy(commits[count].message, "No message");
+            close(fd_in);
         }
+    }
+#endif
+    return -1;
+}
 
-        strcpy(commits[count].hash, entry->d_name);
-        count++;
+int try_clone_file(const char *src, const char *dest) {
+    if (try_reflink(src, dest) == 0) return 0;
+    return try_copy_file(src, dest);
+}
+
+// store src as object hash: copy into a temp object, publish it with rename
+int store_object(const char *src, const char *hash) {
+    int fd_in = open(src, O_RDONLY);
+    if (fd_in < 0) return -1;
+
+    char temp_path[] = OBJECTS_DIR "/.tmp-XXXXXX";
+    int fd_out = mkstemp(temp_path);
+    if (fd_out < 0) {
+        close(fd_in);
+        return -1;
     }
-    closedir(dir);
+    int result = copy_fd(fd_in, fd_out);
+    close(fd_in);
+    fchmod(fd_out, 0644);
+    if (close(fd_out) != 0) result = -1;
+
+    if (result != 0 || object_publish(temp_path, hash) != 0) {
+        unlink(temp_path);
+        return -1;
+    }
+    return 0;
+}
 
-    // sort commits by timestamp
-    for (int i = 0; i < count - 1; ++i) {
-        for (int j = i + 1; j < count; ++j) {
-            if (commits[i].timestamp > commits[j].timestamp) {
-                // Swap
-                time_t temp_time = commits[i].timestamp;
-                commits[i].timestamp = commits[j].timestamp;
-                commits[j].timestamp = temp_time;
+void remove_recursive(const char *path) {
+    struct stat st;
+    if (stat(path, &st) != 0) return;
 
-                char temp_hash[HASH_SIZE], temp_message[256];
-                strcpy(temp_hash, commits[i].hash);
-                strcpy(temp_message, commits[i].message);
+    if (S_ISDIR(st.st_mode)) {
+        DIR *dir = opendir(path);
+        if (!dir) return;
 
-                strcpy(commits[i].hash, commits[j].hash);
-                strcpy(commits[i].message, commits[j].message);
+        struct dirent *entry;
+        while ((entry = readdir(dir)) != NULL) {
+            if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) continue;
 
-                strcpy(commits[j].hash, temp_hash);
-                strcpy(commits[j].message, temp_message);
-            }
+            struct arena_mark mark = arena_save(&cmd_arena);
+            remove_recursive(arena_printf(&cmd_arena, "%s/%s", path, entry->d_name));
+            arena_restore(&cmd_arena, mark);
         }
+        closedir(dir);
+        rmdir(path);
+    } else {
+        unlink(path);
     }
+}
 
-    printf("Commit Moments:\n");
-    if (strcmp(order_flag, "-n") == 0) {
-        for (int i = count - 1; i >= 0; --i) {
-            printf("Commit: %s | Time: %s | Message: %s\n",
-                   commits[i].hash,
-                   // human-readable time
+// memories are like bookmarks to moments in time
+void revert_clean(const char *commit_hash, struct path_table *scope) {
+    char *commit_dir = arena_printf(&cmd_arena, "%s/%s", COMMITS_DIR, commit_hash);
+
+    // Check if commit exists
+    struct stat st;
+    if (stat(commit_dir, &st) != 0) {
+        printf("Error: Commit %s not found.\n", commit_hash);
+        return;
+    }
+
+    printf("Reverting to commit: %s\n", commit_hash);
+
+    // only given paths, or else the sparse checkout
+    struct path_table sparse;
+    struct path_table *cone = scope ? scope : load_sparse(&sparse) ? &sparse : NULL;
+
+    // build a set of files that should exist
+    struct path_table expected_files;
+    path_table_init(&expected_files, &cmd_arena);
+    DIR *commit_dir_handle = opendir(commit_dir);
+    if (commit_dir_handle) {
+        struct dirent *commit_entry;
+        while ((commit_entry = readdir(commit_dir_handle)) != NULL) {
+            if (strcmp(commit_entry->d_name, ".") == 0 || 
+                strcmp(commit_entry->d_name, "..") == 0 ||
+                strcmp(commit_entry->d_name, "message") == 0 ||
+                strcmp(commit_entry->d_name, "timestamp") == 0) {
+                continue;
+            }
+            // add to expected files set
+            path_add(&expected_files, commit_entry->d_name);
+        }
+        closedir(commit_dir_handle);
+    }
+
+    // check current directory and remove files that shouldnt exist
+    DIR *current_dir = opendir(".");
+    if (current_dir) {
+        struct dirent *entry;
+        while ((entry = readdir(current_dir)) != NULL) {
+            if (strcmp(entry->d_name, ".") == 0 || 
+                strcmp(entry->d_name, "..") == 0 || 
+                strncmp(entry->d_name, ".mnemos", 7) == 0) {
+                continue;
+            }
+
+            // check if file should exist, leaving what's outside the cone alone
+            if (cone_match(cone, entry->d_name) == CONE_IN && !path_has(&expected_files, entry->d_name)) {
+                printf("Removing: %s (not in target commit)\n", entry->d_name);
+                remove_recursive(entry->d_name);
+            }
+        }
+        closedir(current_dir);
+    }
+
+    path_table_free(&expected_files);
+
+    // restore files from commit
+    restore_recursive(commit_dir, ".", cone);
+    if (cone && cone != scope) path_table_free(cone);
+
+    // bringing back some paths leaves HEAD where it was
+    if (!scope) {
+        if (write_file_atomic(HEAD_FILE, arena_printf(&cmd_arena, "%s\n", commit_hash)) != 0) {
+            perror("Failed to update HEAD");
+            return;
+        }
+    }
+
+    printf("Revert complete.\n");
+}
+
+// initialize with init
+void init() {
+    mkdir(MNEMOS_DIR, 0755);
+    mkdir(OBJECTS_DIR, 0755);
+    mkdir(COMMITS_DIR, 0755);
+    // new repositories fan out; a re-init leaves the layout alone
+    if (!config_get("object-fanout")) {
+        config_set("object-fanout", arena_printf(&cmd_arena, "%d", OBJECT_FANOUT_DEFAULT));
+    }
+
+    // if file doesnt exist, create it, otherwise reset to zero bytes
+    FILE *index = fopen(INDEX_FILE, "w");
+    // close
+    fclose(index);
+    
+    // if file doesnt exist, create it, otherwise reset to zero bytes
+    FILE *head = fopen(HEAD_FILE, "w");
+    // close
+    fclose(head);
+
+    printf("Initialized empty mnemos repository in %s\n", MNEMOS_DIR);
+}
+
+// track file against already loaded index, because we care about it now
+void track_path(struct path_table *tracked, const char *filename) {
+    struct stat st;
+    if (stat(filename, &st) != 0) {
+        printf("Error: File '%s' does not exist. Skipping.\n", filename);
+        return;
+    }
+
+    // check if already tracked, we don't need duplicates
+    if (path_has(tracked, filename)) {
+        printf("File '%s' is already tracked. Skipping.\n", filename);
+        return;
+    }
+
+    // add file to index, because we decided it's important
+    FILE *index = fopen(INDEX_FILE, "a");
+    if (!index) {
+        perror("Failed to open index file for appending");
+        exit(1);
+    }
+    fprintf(index, "%s\n", filename);
+    fclose(index);
+    path_add(tracked, filename);
+
+    printf("Tracking file: %s\n", filename);
+}
+
+void track(const char *filename) {
+    struct stat st;
+    if (stat(INDEX_FILE, &st) != 0) {
+        perror("Failed to open index file for reading");
+        exit(1);
+    }
+
+    struct path_table tracked;
+    path_table_init(&tracked, &cmd_arena);
+    load_index(&tracked);
+    track_path(&tracked, filename);
+    path_table_free(&tracked);
+}
+
+// track everything here in current dir like you're a hoarder
+void track_all_recursive(struct path_table *tracked, const char *dir_path) {
+    DIR *dir = opendir(dir_path);
+    if (!dir) {
+        perror("Failed to open directory");
+        exit(1);
+    }
+
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+        // skip special files and .mnemos internals
+        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0 ||
+            strncmp(entry->d_name, ".mnemos", 7) == 0) {
+            continue;
+        }
+
+        struct arena_mark mark = arena_save(&cmd_arena);
+        char *full_path = arena_printf(&cmd_arena, "%s/%s", dir_path, entry->d_name);
+
+        struct stat st;
+        if (stat(full_path, &st) == 0) {
+            if (S_ISDIR(st.st_mode)) {
+                // recurse into subdirectories
+                track_all_recursive(tracked, full_path);
+            } else if (S_ISREG(st.st_mode)) {
+                // track regular files, path stays interned in the table
+                track_path(tracked, full_path);
+            }
+        } else {
+            perror("Failed to stat file");
+        }
+        // interned names live in the table's own arena, safe to drop the walk buffer
+        arena_restore(&cmd_arena, mark);
+    }
+    closedir(dir);
+}
+
+void track_all() {
+    // index loaded once, not reopened for every file
+    struct arena table_arena = {0};
+    struct path_table tracked;
+    path_table_init(&tracked, &table_arena);
+    load_index(&tracked);
+
+    // recursive tracking from current dir
+    track_all_recursive(&tracked, ".");
+
+    path_table_free(&tracked);
+    arena_free(&table_arena);
+}
+void create_directories(const char *path) {
+    // own copy, workers call this too
+    char *temp = strdup(path);
+
+    for (char *p = temp + 1; *p; p++) {
+        if (*p == '/') {
+            *p = '\0';
+            // make way for intermediate directory
+            mkdir(temp, 0755); 
+            *p = '/';
+        }
+    }
+    free(temp);
+}
+
+/*
+ * guess whether a large file is the one HEAD already stored: same size as
+ * its object and not touched since that commit. Then commit only hashes
+ * it instead of streaming gigabytes into a temp object again.
+ */
+int large_file_unchanged(const char *head_commit, const char *path, const struct stat *st,
+                         struct arena *a) {
+    if (head_commit[0] == '\0') return 0;
+
+    char *entry_path = arena_printf(a, "%s/%s/%s", COMMITS_DIR, head_commit, path);
+    char *timestamp_path = arena_printf(a, "%s/%s/timestamp", COMMITS_DIR, head_commit);
+    char hash[HASH_SIZE];
+    if (read_hash_file(entry_path, hash) != 0) return 0;
+
+    struct stat object_st;
+    char object_path[OBJECT_PATH_SIZE];
+    if (object_find(object_path, hash) != 0) return 0;
+    if (stat(object_path, &object_st) != 0 || object_st.st_size != st->st_size) return 0;
+
+    long committed_at = 0;
+    FILE *f = fopen(timestamp_path, "r");
+    if (f) {
+        if (fscanf(f, "%ld", &committed_at) != 1) committed_at = 0;
+        fclose(f);
+    }
+    return st->st_mtime < committed_at;
+}
+
+// one tracked file going into a commit
+struct commit_file {
+    const char *path;
+    char hash[HASH_SIZE];
+    int outside;        // not in the sparse checkout, carried over from HEAD
+    int missing;
+    const char *error;  // what failed, NULL when stored
+    char old_hash[HASH_SIZE];   // in HEAD, "" if new
+    long long size;
+    long long old_size;         // only when the contents changed
+};
+
+struct commit_batch {
+    struct commit_file *files;
+    const char *commit_dir;
+    char head_commit[HASH_SIZE];
+};
+
+// worker: hash, store the object if new, write the commit entry
+void commit_one(void *ctx, int i) {
+    struct commit_batch *batch = ctx;
+    struct commit_file *f = &batch->files[i];
+    struct arena a = {0};
+    struct stat st;
+    if (f->outside) {
+        // not in HEAD (tracked since): nothing to carry over, it comes from disk like the rest
+        char *head_entry = arena_printf(&a, "%s/%s/%s", COMMITS_DIR, batch->head_commit, f->path);
+        if (!batch->head_commit[0] || read_hash_file(head_entry, f->hash) != 0) f->outside = 0;
+    }
+    if (!f->outside && stat(f->path, &st) != 0) f->missing = 1;
+    if (f->missing) {
+        arena_free(&a);
+        return;
+    }
+
+    // what HEAD had there, for the commit's stats
+    if (f->outside) {
+        strcpy(f->old_hash, f->hash);
+    } else if (batch->head_commit[0]) {
+        char *head_entry = arena_printf(&a, "%s/%s/%s", COMMITS_DIR, batch->head_commit, f->path);
+        if (read_hash_file(head_entry, f->old_hash) != 0) f->old_hash[0] = '\0';
+    }
+
+    if (f->outside) {
+        // object is already stored, only the entry is written
+        f->size = object_size(f->hash);
+    } else if (st.st_size >= large_file_threshold() &&
+        !large_file_unchanged(batch->head_commit, f->path, &st, &a)) {
+        // hash and store in a single pass
+        if (store_large_file(f->path, f->hash) != 0) f->error = "Failed to store large file";
+    } else if (try_hash_file(f->path, f->hash) != 0) {
+        f->error = "Failed to open file for hashing";
+    } else {
+        // copy file content to objects (if it doesnt already exist)
+        if (!object_exists(f->hash) && store_object(f->path, f->hash) != 0) {
+            f->error = "Failed to store object";
+        }
+    }
+
+    if (!f->outside) f->size = st.st_size;
+    if (f->old_hash[0] && strcmp(f->old_hash, f->hash) != 0) f->old_size = object_size(f->old_hash);
+
+    if (!f->error) {
+        // save hash reference in commit dir
+        char *commit_file_path = arena_printf(&a, "%s/%s", batch->commit_dir, f->path);
+        create_directories(commit_file_path);
+        FILE *commit_entry = fopen(commit_file_path, "w");
+        if (!commit_entry) {
+            f->error = "Failed to create commit file entry";
+        } else {
+            fprintf(commit_entry, "%s\n", f->hash);
+            if (fclose(commit_entry) != 0) f->error = "Failed to create commit file entry";
+        }
+    }
+    arena_free(&a);
+}
+
+// just commit, you have better things to do than read 47 pages of documentation.
+void commit(const char *message) {
+    char *line = NULL;
+    size_t line_capacity = 0;
+    FILE *temp_index;
+
+    // generate commit ID based on curr timestamp
+    time_t now = time(NULL);
+    char commit_hash[HASH_SIZE];
+    snprintf(commit_hash, sizeof(commit_hash), "%lx", now);
+
+    // the commit is built under a dot name and renamed into place when whole
+    char *commit_dir = arena_printf(&cmd_arena, "%s/%s", COMMITS_DIR, commit_hash);
+    char *build_dir = arena_printf(&cmd_arena, "%s/.tmp-%s-XXXXXX", COMMITS_DIR, commit_hash);
+    if (!mkdtemp(build_dir)) {
+        perror("Failed to create commit directory");
+        exit(1);
+    }
+    chmod(build_dir, 0755);
+
+    // save commit metadata
+    char *metadata_path = arena_printf(&cmd_arena, "%s/message", build_dir);
+    FILE *metadata = fopen(metadata_path, "w");
+    if (!metadata) {
+        perror("Failed to create commit metadata");
+        exit(1);
+    }
+    fprintf(metadata, "message: %s\n", message);
+    fclose(metadata);
+
+    // save commit timestamp
+    char *timestamp_path = arena_printf(&cmd_arena, "%s/timestamp", build_dir);
+    FILE *timestamp = fopen(timestamp_path, "w");
+    if (!timestamp) {
+        perror("Failed to create timestamp file");
+        exit(1);
+    }
+    fprintf(timestamp, "%ld\n", now);
+    fclose(timestamp);
+
+    FILE *index = fopen(INDEX_FILE, "r");
+    if (!index) {
+        perror("Failed to read index");
+        exit(1);
+    }
+
+    // temp index to track valid files for next commit
+    struct atomic_file new_index;
+    temp_index = atomic_begin(&new_index, INDEX_FILE);
+    if (!temp_index) {
+        perror("Failed to create temporary index");
+        fclose(index);
+        exit(1);
+    }
+
+    // every file in index goes to the I/O workers at once
+    struct commit_batch batch;
+    memset(&batch, 0, sizeof(batch));
+    batch.commit_dir = build_dir;
+    if (read_hash_file(HEAD_FILE, batch.head_commit) != 0) batch.head_commit[0] = '\0';
+    struct path_table sparse;
+    struct path_table *cone = load_sparse(&sparse) ? &sparse : NULL;
+
+    int count = 0, capacity = 0;
+    while (getline(&line, &line_capacity, index) != -1) {
+        // strip newline
+        line[strcspn(line, "\n")] = 0; 
+        if (count == capacity) {
+            capacity = capacity ? capacity * 2 : 256;
+            batch.files = realloc(batch.files, capacity * sizeof(struct commit_file));
+        }
+        memset(&batch.files[count], 0, sizeof(struct commit_file));
+        batch.files[count].outside = !cone_has_file(cone, line);
+        batch.files[count++].path = arena_strdup(&cmd_arena, line);
+    }
+    if (cone) path_table_free(cone);
+    free(line);
+    fclose(index);
+
+    io_batch(count, commit_one, &batch);
+
+    // stats against HEAD from the hashes just computed, see commit_stats_commit
+    struct commit_stat stat;
+    memset(&stat, 0, sizeof(stat));
+    snprintf(stat.commit, sizeof(stat.commit), "%s", commit_hash);
+    snprintf(stat.parent, sizeof(stat.parent), "%s", batch.head_commit);
+    long matched = 0;
+    long long matched_bytes = 0;
+
+    for (int i = 0; i < count; i++) {
+        struct commit_file *f = &batch.files[i];
+        if (f->missing) {
+            printf("Warning: File '%s' is missing. Skipping.\n", f->path);
+        } else if (f->error) {
+            printf("Error: %s: %s\n", f->error, f->path);
+            atomic_abort(&new_index);
+            remove_recursive(build_dir);
+            exit(1);
+        } else {
+            // add file back to next commit index
+            fprintf(temp_index, "%s\n", f->path);
+
+            stat.files++;
+            stat.bytes += f->size;
+            if (!f->old_hash[0]) {
+                stat.added++;
+                stat.bytes_in += f->size;
+            } else {
+                matched++;
+                int changed = strcmp(f->old_hash, f->hash) != 0;
+                matched_bytes += changed ? f->old_size : f->size;
+                if (changed) {
+                    stat.modified++;
+                    stat.bytes_in += f->size;
+                    stat.bytes_out += f->old_size;
+                }
+            }
+        }
+    }
+    free(batch.files);
+
+    // publish the commit; one made earlier in the same second is replaced
+    int replaced = 0;
+    if (rename(build_dir, commit_dir) != 0) {
+        replaced = 1;
+        if (rename_exchange(build_dir, commit_dir) == 0) {
+            // build_dir holds the replaced commit now
+            remove_recursive(build_dir);
+        } else {
+            // no swap here: the old one is moved aside first, readers may briefly find neither
+            char *old_dir = arena_printf(&cmd_arena, "%s/.old-%s-%ld", COMMITS_DIR, commit_hash, (long) getpid());
+            int failed = rename(commit_dir, old_dir) != 0;
+            if (!failed && rename(build_dir, commit_dir) != 0) {
+                // put the previous commit back, HEAD still points to it
+                int saved = errno;
+                rename(old_dir, commit_dir);
+                errno = saved;
+                failed = 1;
+            }
+            if (failed) {
+                perror("Failed to publish commit");
+                atomic_abort(&new_index);
+                remove_recursive(build_dir);
+                exit(1);
+            }
+            remove_recursive(old_dir);
+        }
+    }
+
+    // replace old index with updated index
+    if (atomic_end(&new_index) != 0) {
+        perror("Failed to update index");
+        exit(1);
+    }
+
+    // update HEAD to point to latest commit
+    if (write_file_atomic(HEAD_FILE, arena_printf(&cmd_arena, "%s\n", commit_hash)) != 0) {
+        perror("Failed to update HEAD");
+        exit(1);
+    }
+
+    bitmap_index_commit(commit_hash, replaced);
+    history_index_commit(commit_hash, batch.head_commit);
+    message_index_commit(commit_hash, message);
+    commit_stats_commit(&stat, matched, matched_bytes);
+
+    printf("Committed changes: %s\n", message);
+}
+/*
+ * delta checkout: switching a large file (at or above large-file-threshold)
+ * between versions rewrites only the DELTA_BLOCK_SIZE blocks that differ.
+ * Every large object gets its block sums (64 bit hash per block) in
+ * .mnemos/block-sums/<hash>, computed the first time they're needed.
+ * .mnemos/large-files remembers which object each large file was checked
+ * out from, with its size and mtime, so an untouched file isn't even
+ * read; otherwise its blocks are hashed in place. Blocks are compared at
+ * the same offsets, since the file is patched where it lies.
+ *
+ * delta-checkout (config): "on" (default) patches the file in place, as
+ * a plain copy over it would; "safe" writes a temp file and renames it
+ * over; "off" always copies. Where the filesystem can clone, the object
+ * is cloned to a temp file and renamed, which beats any patching.
+ */
+#define BLOCK_SUMS_DIR ".mnemos/block-sums"
+#define LARGE_FILES_FILE ".mnemos/large-files"
+#define DELTA_BLOCK_SIZE (1 << 16)
+
+#define DELTA_OFF 0
+#define DELTA_ON 1
+#define DELTA_SAFE 2
+
+struct block_sums {
+    uint64_t *sums;
+    size_t count;
+};
+
+uint64_t block_hash(const char *data, size_t len) {
+    return (uint64_t) murmur3_32(data, len, 1) << 32 | murmur3_32(data, len, 2);
+}
+
+// sums of every block of fd, read front to back
+int block_sums_compute(int fd, long long size, struct block_sums *out) {
+    out->count = (size + DELTA_BLOCK_SIZE - 1) / DELTA_BLOCK_SIZE;
+    out->sums = malloc((out->count + 1) * sizeof(uint64_t));
+    char *buffer = malloc(STREAM_BUFFER_SIZE);
+    size_t block = 0;
+    ssize_t n;
+    while (block < out->count && (n = read_full(fd, buffer, STREAM_BUFFER_SIZE)) > 0) {
+        for (ssize_t off = 0; off < n && block < out->count; off += DELTA_BLOCK_SIZE) {
+            size_t len = n - off < DELTA_BLOCK_SIZE ? n - off : DELTA_BLOCK_SIZE;
+            out->sums[block++] = block_hash(buffer + off, len);
+        }
+        if (n < STREAM_BUFFER_SIZE) break;
+    }
+    free(buffer);
+    if (block != out->count) {
+        free(out->sums);
+        return -1;
+    }
+    return 0;
+}
+
+// an object's block sums, from block-sums/ or computed and saved there
+int block_sums_for_object(const char *hash, struct block_sums *out) {
+    char object_path[OBJECT_PATH_SIZE];
+    char sums_path[HASH_SIZE + sizeof(BLOCK_SUMS_DIR) + 1];
+    object_find(object_path, hash);
+    snprintf(sums_path, sizeof(sums_path), "%s/%s", BLOCK_SUMS_DIR, hash);
+    struct stat st;
+    if (stat(object_path, &st) != 0) return -1;
+    size_t count = (st.st_size + DELTA_BLOCK_SIZE - 1) / DELTA_BLOCK_SIZE;
+
+    int fd = open(sums_path, O_RDONLY);
+    if (fd >= 0) {
+        out->count = count;
+        out->sums = malloc((count + 1) * sizeof(uint64_t));
+        ssize_t n = read_full(fd, (char *) out->sums, count * sizeof(uint64_t));
+        close(fd);
+        if (n == (ssize_t) (count * sizeof(uint64_t))) return 0;
+        free(out->sums);
+    }
+
+    fd = open(object_path, O_RDONLY);
+    if (fd < 0) return -1;
+    int result = block_sums_compute(fd, st.st_size, out);
+    close(fd);
+    if (result != 0) return -1;
+
+    // a cache: losing a race or failing to save is harmless
+    mkdir(BLOCK_SUMS_DIR, 0755);
+    char temp_path[] = BLOCK_SUMS_DIR "/.tmp-XXXXXX";
+    int temp_fd = mkstemp(temp_path);
+    if (temp_fd >= 0) {
+        int ok = write_full(temp_fd, (const char *) out->sums, count * sizeof(uint64_t)) == 0;
+        fchmod(temp_fd, 0644);
+        if (close(temp_fd) != 0 || !ok || rename(temp_path, sums_path) != 0) unlink(temp_path);
+    }
+    return 0;
+}
+
+// the length of block i in a file of size bytes
+size_t block_length(long long size, size_t i) {
+    long long left = size - (long long) i * DELTA_BLOCK_SIZE;
+    return left < DELTA_BLOCK_SIZE ? left : DELTA_BLOCK_SIZE;
+}
+
+// one file to bring back from objects/
+struct restore_file {
+    const char *src;    // commit entry holding the hash
+    const char *dest;
+    char hash[HASH_SIZE];
+    char known[HASH_SIZE];  // object dest holds now, from large-files, or empty
+    int status;         // RESTORE_*
+    int error;          // errno of a failed copy
+    int large;          // restored from a large object
+    long long size;         // of a large object
+    long long rewritten;    // bytes written by a delta checkout, -1 if copied
+};
+
+#define RESTORE_OK 0
+#define RESTORE_NO_ENTRY 1
+#define RESTORE_NO_OBJECT 2
+#define RESTORE_FAILED 3
+#define RESTORE_CORRUPT 4
+
+struct restore_batch {
+    struct restore_file *files;
+    int count;
+    int capacity;
+    int verify;         // verify-objects: rehash while copying
+    int delta;          // DELTA_*
+};
+
+/*
+ * bring a large existing file to the object: clone and rename when the
+ * filesystem can, else patch the differing blocks. -1 to fall back to a
+ * plain copy.
+ */
+int restore_delta(const char *object_path, long long size, struct restore_file *f, int mode) {
+    char *temp = malloc(strlen(f->dest) + 16);
+    const char *slash = strrchr(f->dest, '/');
+    int dir_len = slash ? (int) (slash - f->dest) + 1 : 0;
+    sprintf(temp, "%.*s.%s-XXXXXX", dir_len, f->dest, f->dest + dir_len);
+    int temp_fd = mkstemp(temp);
+    if (temp_fd < 0) {
+        free(temp);
+        return -1;
+    }
+    close(temp_fd);
+    // the temp file replaces dest, so it gets dest's permissions rather than mkstemp's 0600
+    struct stat dest_st;
+    mode_t perm = stat(f->dest, &dest_st) == 0 ? dest_st.st_mode & 07777 : 0644;
+    if (try_reflink(object_path, temp) == 0 && chmod(temp, perm) == 0 && rename(temp, f->dest) == 0) {
+        free(temp);
+        return 0;
+    }
+
+    // patch a copy when safe, the file itself otherwise
+    const char *target = f->dest;
+    if (mode == DELTA_SAFE) {
+        if (try_copy_file(f->dest, temp) != 0) {
+            unlink(temp);
+            free(temp);
+            return -1;
+        }
+        target = temp;
+    } else {
+        unlink(temp);
+    }
+
+    struct block_sums want, have = { NULL, 0 };
+    long long have_size = 0;
+    int fd = open(target, O_RDWR);
+    struct stat st;
+    int result = -1;
+    if (fd < 0 || fstat(fd, &st) != 0 || block_sums_for_object(f->hash, &want) != 0) goto out;
+    have_size = st.st_size;
+    if (!(f->known[0] && block_sums_for_object(f->known, &have) == 0) &&
+        block_sums_compute(fd, have_size, &have) != 0) {
+        free(want.sums);
+        goto out;
+    }
+
+    int object_fd = open(object_path, O_RDONLY);
+    char *buffer = malloc(DELTA_BLOCK_SIZE);
+    long long rewritten = 0;
+    result = object_fd >= 0 ? 0 : -1;
+    for (size_t i = 0; i < want.count && result == 0; i++) {
+        size_t len = block_length(size, i);
+        if (i < have.count && block_length(have_size, i) == len && have.sums[i] == want.sums[i]) continue;
+        off_t off = (off_t) i * DELTA_BLOCK_SIZE;
+        if (pread(object_fd, buffer, len, off) != (ssize_t) len ||
+            pwrite(fd, buffer, len, off) != (ssize_t) len) {
+            result = -1;
+        }
+        rewritten += len;
+    }
+    if (result == 0 && have_size != size && ftruncate(fd, size) != 0) result = -1;
+    if (result == 0 && mode == DELTA_SAFE && fsync(fd) != 0) result = -1;
+    if (object_fd >= 0) close(object_fd);
+    free(buffer);
+    free(want.sums);
+    free(have.sums);
+    f->rewritten = rewritten;
+
+out:
+    if (fd >= 0 && close(fd) != 0) result = -1;
+    if (target == temp) {
+        if (result == 0 && (chmod(temp, perm) != 0 || rename(temp, f->dest) != 0)) result = -1;
+        if (result != 0) unlink(temp);
+    }
+    free(temp);
+    if (result != 0) f->error = errno;
+    return result;
+}
+
+/*
+ * verify-on-read: copy the object while hashing it in the same pass, a
+ * file whose content doesn't match its name is removed again
+ */
+int restore_verified(const char *object_path, struct restore_file *f) {
+    int fd_in = open(object_path, O_RDONLY);
+    if (fd_in < 0) {
+        f->error = errno;
+        return RESTORE_FAILED;
+    }
+    int fd_out = open(f->dest, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    if (fd_out < 0) {
+        f->error = errno;
+        close(fd_in);
+        return RESTORE_FAILED;
+    }
+
+    char actual[HASH_SIZE];
+    int result = copy_fd_hashed(fd_in, fd_out, actual);
+    if (result != 0) f->error = errno;
+    close(fd_in);
+    if (close(fd_out) != 0 && result == 0) {
+        f->error = errno;
+        result = -1;
+    }
+    if (result == 0 && strcmp(actual, f->hash) == 0) return RESTORE_OK;
+    unlink(f->dest);
+    return result == 0 ? RESTORE_CORRUPT : RESTORE_FAILED;
+}
+
+// worker: read the entry's hash and copy the object into place
+void restore_one(void *ctx, int i) {
+    struct restore_file *f = &((struct restore_batch *) ctx)->files[i];
+    if (read_hash_file(f->src, f->hash) != 0) {
+        f->status = RESTORE_NO_ENTRY;
+        return;
+    }
+
+    // locate file in objects
+    char object_path[OBJECT_PATH_SIZE];
+    if (object_find(object_path, f->hash) != 0) {
+        f->status = RESTORE_NO_OBJECT;
+        return;
+    }
+
+    struct restore_batch *batch = ctx;
+    if (batch->verify) {
+        f->status = restore_verified(object_path, f);
+        return;
+    }
+
+    struct stat object_st, dest_st;
+    f->rewritten = -1;
+    if (stat(object_path, &object_st) == 0 && object_st.st_size >= large_file_threshold()) {
+        f->large = 1;
+        f->size = object_st.st_size;
+        if (strcmp(f->known, f->hash) == 0) {
+            // already checked out and untouched since
+            f->rewritten = 0;
+            f->status = RESTORE_OK;
+            return;
+        }
+        // never patch through to another link of the same file
+        if (batch->delta != DELTA_OFF && lstat(f->dest, &dest_st) == 0 && S_ISREG(dest_st.st_mode) &&
+            dest_st.st_nlink == 1 && restore_delta(object_path, object_st.st_size, f, batch->delta) == 0) {
+            f->status = RESTORE_OK;
+            return;
+        }
+        f->rewritten = -1;
+    }
+
+    // restore content from objects/, sharing blocks where possible
+    if (try_clone_file(object_path, f->dest) == 0) {
+        f->status = RESTORE_OK;
+    } else {
+        f->status = RESTORE_FAILED;
+        f->error = errno;
+    }
+}
+
+// walk a commit tree, making directories and queueing files inside cone
+void collect_restore(struct restore_batch *batch, const char *src_base, const char *dest_base,
+                     const char *rel, struct path_table *cone) {
+    struct stat st;
+    DIR *dir = opendir(src_base);
+    if (!dir) {
+        perror("Failed to open source directory during revert");
+        exit(1);
+    }
+
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+        // skip special files and metadata
+        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0 ||
+            strcmp(entry->d_name, "timestamp") == 0 || strcmp(entry->d_name, "message") == 0) {
+            continue;
+        }
+
+        char *rel_entry = rel[0] ? arena_printf(&cmd_arena, "%s/%s", rel, entry->d_name)
+                                 : arena_strdup(&cmd_arena, entry->d_name);
+        int match = cone_match(cone, rel_entry);
+        if (match == CONE_OUT) continue;
+
+        char *src_entry = arena_printf(&cmd_arena, "%s/%s", src_base, entry->d_name);
+        char *dest_entry = arena_printf(&cmd_arena, "%s/%s", dest_base, entry->d_name);
+
+        if (stat(src_entry, &st) == 0) {
+            if (S_ISDIR(st.st_mode)) {
+                // dir must exist
+                mkdir(dest_entry, 0755);
+                collect_restore(batch, src_entry, dest_entry, rel_entry, match == CONE_IN ? NULL : cone);
+            } else if (S_ISREG(st.st_mode) && match == CONE_IN) {
+                if (batch->count == batch->capacity) {
+                    batch->capacity = batch->capacity ? batch->capacity * 2 : 256;
+                    batch->files = realloc(batch->files, batch->capacity * sizeof(struct restore_file));
+                }
+                struct restore_file *f = &batch->files[batch->count++];
+                memset(f, 0, sizeof(*f));
+                f->src = src_entry;
+                f->dest = dest_entry;
+            }
+        } else {
+            perror("Failed to stat source entry during revert");
+        }
+    }
+    closedir(dir);
+}
+
+// large-files: "<hash> <size> <mtime> <nsec> <path>" per large file checked out
+struct large_file_record {
+    char *path;
+    char hash[HASH_SIZE];
+    long long size;
+    long mtime;
+    long mtime_nsec;
+};
+
+struct large_files {
+    struct large_file_record *records;
+    int count;
+    int capacity;
+    int changed;
+};
+
+int compare_large_file_records(const void *a, const void *b) {
+    return strcmp(((const struct large_file_record *) a)->path, ((const struct large_file_record *) b)->path);
+}
+
+const char *large_file_key(const char *dest) {
+    return strncmp(dest, "./", 2) == 0 ? dest + 2 : dest;
+}
+
+struct large_file_record *large_files_add(struct large_files *lf) {
+    if (lf->count == lf->capacity) {
+        lf->capacity = lf->capacity ? lf->capacity * 2 : 16;
+        lf->records = realloc(lf->records, lf->capacity * sizeof(struct large_file_record));
+    }
+    return &lf->records[lf->count++];
+}
+
+void large_files_load(struct large_files *lf) {
+    memset(lf, 0, sizeof(*lf));
+    FILE *f = fopen(LARGE_FILES_FILE, "r");
+    if (!f) return;
+    char *line = NULL;
+    size_t capacity = 0;
+    while (getline(&line, &capacity, f) != -1) {
+        line[strcspn(line, "\n")] = 0;
+        struct large_file_record r;
+        int used;
+        if (sscanf(line, "%63s %lld %ld %ld %n", r.hash, &r.size, &r.mtime, &r.mtime_nsec, &used) == 4) {
+            r.path = arena_strdup(&cmd_arena, line + used);
+            *large_files_add(lf) = r;
+        }
+    }
+    free(line);
+    fclose(f);
+    qsort(lf->records, lf->count, sizeof(struct large_file_record), compare_large_file_records);
+}
+
+struct large_file_record *large_files_find(struct large_files *lf, const char *path) {
+    struct large_file_record key;
+    key.path = (char *) path;
+    return bsearch(&key, lf->records, lf->count, sizeof(struct large_file_record), compare_large_file_records);
+}
+
+void large_files_save(struct large_files *lf) {
+    struct atomic_file af;
+    if (lf->changed && atomic_begin(&af, LARGE_FILES_FILE)) {
+        for (int i = 0; i < lf->count; i++) {
+            struct large_file_record *r = &lf->records[i];
+            fprintf(af.f, "%s %lld %ld %ld %s\n", r->hash, r->size, r->mtime, r->mtime_nsec, r->path);
+        }
+        atomic_end(&af);
+    }
+    free(lf->records);
+}
+
+// Mnemosyne remembers. 
+// Restore directories and files of a commit tree, file copies run batched
+void restore_recursive(const char *src_base, const char *dest_base, struct path_table *cone) {
+    struct restore_batch batch = { NULL, 0, 0, config_get_flag("verify-objects"), DELTA_ON };
+    char *delta = config_get("delta-checkout");
+    if (delta && strcmp(delta, "off") == 0) batch.delta = DELTA_OFF;
+    if (delta && strcmp(delta, "safe") == 0) batch.delta = DELTA_SAFE;
+    collect_restore(&batch, src_base, dest_base, "", cone);
+
+    // large files still as we checked them out need no reading
+    struct large_files large;
+    large_files_load(&large);
+    for (int i = 0; i < batch.count && large.count > 0; i++) {
+        struct restore_file *f = &batch.files[i];
+        struct large_file_record *r = large_files_find(&large, large_file_key(f->dest));
+        struct stat st;
+        if (r && lstat(f->dest, &st) == 0 && st.st_size == r->size && st.st_mtime == r->mtime &&
+            ST_MTIME_NSEC(st) == r->mtime_nsec) {
+            snprintf(f->known, sizeof(f->known), "%s", r->hash);
+        }
+    }
+
+    io_batch(batch.count, restore_one, &batch);
+
+    // new records go after the sorted ones, which stay searchable
+    int sorted = large.count;
+    for (int i = 0; i < batch.count; i++) {
+        struct restore_file *f = &batch.files[i];
+        struct stat st;
+        if (f->status != RESTORE_OK || !f->large || lstat(f->dest, &st) != 0) continue;
+        int count = large.count;
+        large.count = sorted;
+        struct large_file_record *r = large_files_find(&large, large_file_key(f->dest));
+        large.count = count;
+        if (!r) {
+            r = large_files_add(&large);
+            r->path = arena_strdup(&cmd_arena, large_file_key(f->dest));
+        }
+        snprintf(r->hash, sizeof(r->hash), "%s", f->hash);
+        r->size = st.st_size;
+        r->mtime = st.st_mtime;
+        r->mtime_nsec = ST_MTIME_NSEC(st);
+        large.changed = 1;
+    }
+    qsort(large.records, large.count, sizeof(struct large_file_record), compare_large_file_records);
+    large_files_save(&large);
+
+    for (int i = 0; i < batch.count; i++) {
+        struct restore_file *f = &batch.files[i];
+        if (f->status == RESTORE_OK && f->large && f->rewritten >= 0) {
+            printf("Patched file: %s (%lld of %lld bytes rewritten)\n", f->dest, f->rewritten, f->size);
+        } else if (f->status == RESTORE_OK) {
+            printf("Restored file: %s\n", f->dest);
+        } else if (f->status == RESTORE_NO_ENTRY) {
+            printf("Error: Failed to read hash file during restore: %s\n", f->src);
+        } else if (f->status == RESTORE_NO_OBJECT) {
+            printf("Error: Object %s not found for file '%s'\n", f->hash, f->dest);
+        } else if (f->status == RESTORE_CORRUPT) {
+            printf("Error: Object %s is corrupt, file '%s' not restored (run 'mnemos fsck')\n",
+                   f->hash, f->dest);
+        } else {
+            printf("Error: Failed to restore file '%s': %s\n", f->dest, strerror(f->error));
+        }
+    }
+    free(batch.files);
+}
+/* 
+ * Mnemosyne remembers. Revert to another time, a simpler time.
+ *
+ */
+void revert(const char *commit_hash, struct path_table *scope) {
+    struct stat st;
+
+    // does commit exist
+    char *commit_dir = arena_printf(&cmd_arena, "%s/%s", COMMITS_DIR, commit_hash);
+    if (stat(commit_dir, &st) != 0) {
+        printf("Error: Commit %s not found.\n", commit_hash);
+        exit(1);
+    }
+
+    printf("Reverting to commit: %s\n", commit_hash);
+
+    // only given paths, or else the sparse checkout
+    struct path_table sparse;
+    struct path_table *cone = scope ? scope : load_sparse(&sparse) ? &sparse : NULL;
+
+    // restore files from target commit
+    restore_recursive(commit_dir, ".", cone);
+
+    // remove files not in the target commit
+    FILE *index = fopen(INDEX_FILE, "r");
+    if (!index) {
+        perror("Failed to open index for cleanup");
+        exit(1);
+    }
+
+    char *line = NULL;
+    size_t line_capacity = 0;
+    while (getline(&line, &line_capacity, index) != -1) {
+        line[strcspn(line, "\n")] = 0; // remove newline
+        if (!cone_has_file(cone, line)) continue;
+
+        struct arena_mark mark = arena_save(&cmd_arena);
+        char *commit_file_path = arena_printf(&cmd_arena, "%s/%s", commit_dir, line);
+
+        // does file exist in target commit
+        if (stat(commit_file_path, &st) != 0) {
+            printf("Removing: %s\n", line);
+            remove_recursive(line);
+        }
+        arena_restore(&cmd_arena, mark);
+    }
+    free(line);
+    fclose(index);
+    if (cone && cone != scope) path_table_free(cone);
+
+    // bringing back some paths leaves HEAD where it was
+    if (!scope) {
+        if (write_file_atomic(HEAD_FILE, arena_printf(&cmd_arena, "%s\n", commit_hash)) != 0) {
+            perror("Failed to update HEAD");
+            exit(1);
+        }
+    }
+
+    printf("Revert complete.\n");
+}
+
+/*
+ * moments: simple stroll through project history.
+ * 
+ */
+// one line of changes from commit-stats, trees are never read
+void print_commit_stat(struct commit_stats *stats, const char *commit) {
+    struct commit_stat *e = commit_stats_find(stats, commit);
+    if (!e) {
+        printf("  (no stats, run mnemos backfill-stats)\n");
+        return;
+    }
+    printf("  %ld added, %ld removed, %ld modified, +%lld -%lld bytes (%ld files, %lld bytes)\n",
+           e->added, e->removed, e->modified, e->bytes_in, e->bytes_out, e->files, e->bytes);
+}
+
+void moments(const char *order_flag, int show_stats) {
+    DIR *dir = opendir(COMMITS_DIR);
+    if (!dir) {
+        perror("Failed to open commits directory");
+        exit(1);
+    }
+
+    struct dirent *entry;
+    struct {
+        char hash[HASH_SIZE];
+        time_t timestamp;
+        char message[256];
+    } commits[1024]; // make this adjustable?
+    int count = 0;
+
+    // collect commit data
+    while ((entry = readdir(dir)) != NULL) {
+        // dot names are commits still being built
+        if (entry->d_name[0] == '.') {
+            continue;
+        }
+
+        char commit_dir[256], timestamp_path[256], message_path[256];
+        snprintf(commit_dir, sizeof(commit_dir), "%s/%s", COMMITS_DIR, entry->d_name);
+
+        snprintf(timestamp_path, sizeof(timestamp_path), "%s/timestamp", commit_dir);
+        snprintf(message_path, sizeof(message_path), "%s/message", commit_dir);
+
+        FILE *timestamp_file = fopen(timestamp_path, "r");
+        FILE *message_file = fopen(message_path, "r");
+
+        if (timestamp_file) {
+            fscanf(timestamp_file, "%ld", &commits[count].timestamp);
+            fclose(timestamp_file);
+        } else {
+            commits[count].timestamp = 0;
+        }
+
+        if (message_file) {
+            fgets(commits[count].message, sizeof(commits[count].message), message_file);
+            commits[count].message[strcspn(commits[count].message, "\n")] = 0; // remove newline
+            fclose(message_file);
+        } else {
+            strcpy(commits[count].message, "No message");
+        }
+
+        strcpy(commits[count].hash, entry->d_name);
+        count++;
+    }
+    closedir(dir);
+
+    // sort commits by timestamp
+    for (int i = 0; i < count - 1; ++i) {
+        for (int j = i + 1; j < count; ++j) {
+            if (commits[i].timestamp > commits[j].timestamp) {
+                // Swap
+                time_t temp_time = commits[i].timestamp;
+                commits[i].timestamp = commits[j].timestamp;
+                commits[j].timestamp = temp_time;
+
+                char temp_hash[HASH_SIZE], temp_message[256];
+                strcpy(temp_hash, commits[i].hash);
+                strcpy(temp_message, commits[i].message);
+
+                strcpy(commits[i].hash, commits[j].hash);
+                strcpy(commits[i].message, commits[j].message);
+
+                strcpy(commits[j].hash, temp_hash);
+                strcpy(commits[j].message, temp_message);
+            }
+        }
+    }
+
+    struct commit_stats stats;
+    if (show_stats) commit_stats_read(&stats);
+
+    printf("Commit Moments:\n");
+    if (strcmp(order_flag, "-n") == 0) {
+        for (int i = count - 1; i >= 0; --i) {
+            printf("Commit: %s | Time: %s | Message: %s\n",
+                   commits[i].hash,
+                   // human-readable time
                    ctime(&commits[i].timestamp), 
                    commits[i].message);
+            if (show_stats) print_commit_stat(&stats, commits[i].hash);
+        }
+    } else if (strcmp(order_flag, "-o") == 0) {
+        for (int i = 0; i < count; ++i) {
+            printf("Commit: %s | Time: %s | Message: %s\n",
+                   commits[i].hash,
+                   ctime(&commits[i].timestamp),
+                   commits[i].message);
+            if (show_stats) print_commit_stat(&stats, commits[i].hash);
+        }
+    } else {
+        printf("Invalid flag for moments. Use -n (newest) or -o (oldest).\n");
+    }
+    if (show_stats) commit_stats_free(&stats);
+}
+
+/* 
+ * diff
+ */
+void diff_file(const char *filename, const char *commit1, const char *commit2, int latest_flag) {
+    char *path1, *path2;
+    struct stat st1, st2;
+    int result;
+
+    if (latest_flag) {
+        // get latest commit hash
+        FILE *head_file = fopen(HEAD_FILE, "r");
+        if (!head_file) {
+            printf("Error: Could not open HEAD file to get the latest commit.\n");
+            return;
+        }
+
+        char latest_commit[HASH_SIZE];
+        if (!fgets(latest_commit, sizeof(latest_commit), head_file)) {
+            printf("Error: Could not read the latest commit hash from HEAD file.\n");
+            fclose(head_file);
+            return;
+        }
+        fclose(head_file);
+
+        // trim newline if exists
+        latest_commit[strcspn(latest_commit, "\n")] = 0;
+
+        // path to file in the latest commit
+        path1 = arena_printf(&cmd_arena, "%s/%s/%s", COMMITS_DIR, latest_commit, filename);
+        path2 = arena_strdup(&cmd_arena, filename); // working directory file
+    } else {
+        // paths to files in specified commits
+        path1 = arena_printf(&cmd_arena, "%s/%s/%s", COMMITS_DIR, commit1, filename);
+        path2 = arena_printf(&cmd_arena, "%s/%s/%s", COMMITS_DIR, commit2, filename);
+    }
+
+    // does file exist?
+    if (stat(path1, &st1) != 0) {
+        printf("Error: File '%s' does not exist in the specified commit or latest commit.\n", filename);
+        return;
+    }
+    if (stat(path2, &st2) != 0) {
+        printf("Error: File '%s' does not exist in the working directory or specified commit.\n", filename);
+        return;
+    }
+
+    // history filters can prove two commits agree on the file without diff
+    if (!latest_flag) {
+        struct history h;
+        history_load(&h);
+        char *key = normalize_history_path(filename, &cmd_arena);
+        int same = history_unchanged_between(&h, key, commit1, commit2) ||
+                   history_unchanged_between(&h, key, commit2, commit1);
+        history_free(&h);
+        if (same) {
+            printf("Files are identical.\n");
+            return;
+        }
+    }
+
+    // execute diff command with color
+    char *command = arena_printf(&cmd_arena, "diff --color=always %s %s", path1, path2);
+    result = system(command);
+
+    if (result == 0) {
+        printf("Files are identical.\n");
+    } else if (result == 256) { // exit code 1 translates to 256 in system
+        printf("Files differ.\n");
+    } else {
+        printf("Error running diff command.\n");
+    }
+}
+
+// copy file
+void copy_file(const char *src, const char *dest) {
+    // short writes, read errors and a failing close all count as failure
+    if (try_copy_file(src, dest) != 0) {
+        perror("Failed to copy file");
+        exit(1);
+    }
+}
+
+// remote repository
+// does url_file (a remote's url) name something other than url?
+int remote_url_changed(const char *url_file, const char *url) {
+    char current[4096];
+    FILE *f = fopen(url_file, "r");
+    if (!f) return 1;
+    int read = fgets(current, sizeof(current), f) != NULL;
+    fclose(f);
+    if (!read) return 1;
+    current[strcspn(current, "\n")] = 0;
+    return strcmp(current, url) != 0;
+}
+
+void set_remote(const char *remote_path) {
+    // what the old remote had says nothing about the new one
+    if (remote_url_changed(REMOTE_FILE, remote_path) && access(REMOTE_COMMITS_FILE, F_OK) == 0 &&
+        write_file_atomic(REMOTE_COMMITS_FILE, "") != 0) {
+        perror("Failed to reset remote commits");
+        exit(1);
+    }
+    if (write_file_atomic(REMOTE_FILE, arena_printf(&cmd_arena, "%s\n", remote_path)) != 0) {
+        perror("Failed to set remote");
+        exit(1);
+    }
+
+    printf("Remote set to: %s\n", remote_path);
+}
+
+/*
+ * named remotes: .mnemos/remotes/<name>/ holds url (user@host:/path),
+ * commits (what that remote is known to have, like remote-commits), log
+ * (output of the last send) and status. A group is a file in
+ * .mnemos/remote-groups/ naming its remotes, one per line. The plain
+ * `mnemos remote <path>` remote stays what send and fetch use by default.
+ */
+#define REMOTES_DIR ".mnemos/remotes"
+#define REMOTE_GROUPS_DIR ".mnemos/remote-groups"
+#define SEND_DEFAULT_JOBS 8
+
+// what to send, worked out once for every target
+struct send_lists {
+    char commits_list[sizeof(MNEMOS_DIR "/send-commits-XXXXXX")];
+    char objects_list[sizeof(MNEMOS_DIR "/send-objects-XXXXXX")];
+    int incremental;
+    int commit_count;
+    int object_count;
+};
+
+struct send_target {
+    char *name;
+    char *url;
+    char *known_file;
+    pid_t pid;
+    int result;
+};
+
+// non-dot entries of dir, sorted
+int read_dir_names(const char *dir_path, char ***names_out, struct arena *a) {
+    char **names = NULL;
+    int count = 0, capacity = 0;
+    DIR *dir = opendir(dir_path);
+    if (dir) {
+        struct dirent *entry;
+        while ((entry = readdir(dir)) != NULL) {
+            if (entry->d_name[0] == '.') continue;
+            if (count == capacity) {
+                capacity = capacity ? capacity * 2 : 16;
+                names = realloc(names, capacity * sizeof(char *));
+            }
+            names[count++] = arena_strdup(a, entry->d_name);
+        }
+        closedir(dir);
+    }
+    qsort(names, count, sizeof(char *), compare_names);
+    *names_out = names;
+    return count;
+}
+
+// commits listed in every one of known_files, sorted
+int common_commits(const char **known_files, int file_count, char ***ids_out, struct arena *a) {
+    char **common;
+    int count = read_commit_list(known_files[0], &common, a);
+    qsort(common, count, sizeof(char *), compare_names);
+    for (int f = 1; f < file_count && count > 0; f++) {
+        char **ids;
+        int id_count = read_commit_list(known_files[f], &ids, a);
+        qsort(ids, id_count, sizeof(char *), compare_names);
+        int kept = 0, j = 0;
+        for (int i = 0; i < count; i++) {
+            while (j < id_count && strcmp(ids[j], common[i]) < 0) j++;
+            if (j < id_count && strcmp(ids[j], common[i]) == 0) common[kept++] = common[i];
+        }
+        count = kept;
+        free(ids);
+    }
+    *ids_out = common;
+    return count;
+}
+
+// with bitmaps, only what some target lacks: commits any of them hasn't seen and their objects
+void send_lists_prepare(struct send_lists *lists, const char **known_files, int file_count) {
+    memset(lists, 0, sizeof(*lists));
+    strcpy(lists->commits_list, MNEMOS_DIR "/send-commits-XXXXXX");
+    strcpy(lists->objects_list, MNEMOS_DIR "/send-objects-XXXXXX");
+    char known_list[] = MNEMOS_DIR "/send-known-XXXXXX";
+    int commits_fd = mkstemp(lists->commits_list);
+    int objects_fd = mkstemp(lists->objects_list);
+    int known_fd = mkstemp(known_list);
+    FILE *commits_out = commits_fd >= 0 ? fdopen(commits_fd, "w") : NULL;
+    FILE *objects_out = objects_fd >= 0 ? fdopen(objects_fd, "w") : NULL;
+    FILE *known_out = known_fd >= 0 ? fdopen(known_fd, "w") : NULL;
+    if (known_out) {
+        char **common;
+        int count = common_commits(known_files, file_count, &common, &cmd_arena);
+        for (int i = 0; i < count; i++) fprintf(known_out, "%s\n", common[i]);
+        free(common);
+        fclose(known_out);
+    }
+    lists->incremental = commits_out && objects_out && known_out &&
+        bitmaps_send_lists(known_list, commits_out, objects_out,
+                           &lists->commit_count, &lists->object_count) == 0;
+    if (commits_out) fclose(commits_out);
+    if (objects_out) fclose(objects_out);
+    unlink(known_list);
+
+    if (lists->incremental) {
+        printf("Sending %d new commits and %d objects.\n", lists->commit_count, lists->object_count);
+    }
+}
+
+void send_lists_free(struct send_lists *lists) {
+    unlink(lists->commits_list);
+    unlink(lists->objects_list);
+}
+
+/* SEND - remote
+ * one user@host:/path, 0 when commits and objects all arrived
+*/
+int send_one(const char *remote_path, const struct send_lists *lists) {
+    // user@host and path
+    char remote_host[128] = {0};
+    char remote_dir[128] = {0};
+    char *colon = strchr(remote_path, ':');
+    if (colon) {
+        size_t host_len = colon - remote_path;
+        strncpy(remote_host, remote_path, host_len);
+        remote_host[host_len] = '\0';
+        strcpy(remote_dir, colon + 1);
+    } else {
+        printf("Invalid remote path format. Use user@host:/path/to/repo\n");
+        return 1;
+    }
+
+    // remote directories must be created
+    char command[512];
+    snprintf(command, sizeof(command),
+             "ssh %s 'mkdir -p \"%s/commits\" \"%s/objects\"'",
+             remote_host, remote_dir, remote_dir);
+    int result_mkdir = system(command);
+    if (result_mkdir != 0) {
+        printf("Failed to create remote directories at %s:%s\n", remote_host, remote_dir);
+        return 1;
+    }
+
+    int result_commits, result_objects;
+    if (lists->incremental) {
+        result_commits = result_objects = 0;
+        if (lists->commit_count > 0) {
+            snprintf(command, sizeof(command), "rsync -av -r --files-from=%s %s/ %s:%s/commits/",
+                     lists->commits_list, COMMITS_DIR, remote_host, remote_dir);
+            result_commits = system(command);
+        }
+        if (lists->object_count > 0) {
+            snprintf(command, sizeof(command), "rsync -av --files-from=%s %s/ %s:%s/objects/",
+                     lists->objects_list, OBJECTS_DIR, remote_host, remote_dir);
+            result_objects = system(command);
+        }
+    } else {
+        // rsync commits
+        snprintf(command, sizeof(command), "rsync -av %s/ %s:%s/commits/", COMMITS_DIR, remote_host, remote_dir);
+        result_commits = system(command);
+
+        // rsync objects
+        snprintf(command, sizeof(command), "rsync -av %s/ %s:%s/objects/", OBJECTS_DIR, remote_host, remote_dir);
+        result_objects = system(command);
+    }
+
+    if (result_commits == 0 && result_objects == 0) {
+        printf("Commits and objects sent to remote: %s:%s\n", remote_host, remote_dir);
+
+        // let the remote's post-receive hook know, when it has one
+        char head[HASH_SIZE];
+        if (read_hash_file(HEAD_FILE, head) == 0 && head[0]) {
+            snprintf(command, sizeof(command),
+                     "ssh %s 'for d in \"%s\" \"%s/.mnemos\"; do "
+                     "if [ -x \"$d/hooks/post-receive\" ]; then exec mnemos receive \"%s\" %s; fi; done'",
+                     remote_host, remote_dir, remote_dir, remote_dir, head);
+            if (system(command) != 0) {
+                printf("Remote post-receive hook failed.\n");
+            }
+        }
+        return 0;
+    }
+    if (result_commits != 0) {
+        printf("Failed to send commits to remote.\n");
+    }
+    if (result_objects != 0) {
+        printf("Failed to send objects to remote.\n");
+    }
+    return 1;
+}
+
+void send_remote() {
+    FILE *remote = fopen(REMOTE_FILE, "r");
+    if (!remote) {
+        printf("No remote configured. Use 'mnemos remote <path>' to set one.\n");
+        exit(1);
+    }
+
+    char remote_path[256];
+    fgets(remote_path, sizeof(remote_path), remote);
+    fclose(remote);
+
+    // trim newline
+    remote_path[strcspn(remote_path, "\n")] = 0;
+
+    struct send_lists lists;
+    const char *known_file = REMOTE_COMMITS_FILE;
+    send_lists_prepare(&lists, &known_file, 1);
+    if (send_one(remote_path, &lists) == 0) {
+        record_remote_commits(REMOTE_COMMITS_FILE);
+    }
+    send_lists_free(&lists);
+}
+
+// add the named remote to targets unless it's there already
+void add_send_target(struct send_target **targets, int *count, const char *name) {
+    for (int i = 0; i < *count; i++) {
+        if (strcmp((*targets)[i].name, name) == 0) return;
+    }
+    char url[256];
+    char *url_file = arena_printf(&cmd_arena, "%s/%s/url", REMOTES_DIR, name);
+    FILE *f = fopen(url_file, "r");
+    if (!f || !fgets(url, sizeof(url), f)) {
+        printf("Error: Remote '%s' not found. Use 'mnemos remote add <name> <path>'.\n", name);
+        exit(1);
+    }
+    fclose(f);
+    url[strcspn(url, "\n")] = 0;
+
+    *targets = realloc(*targets, (*count + 1) * sizeof(struct send_target));
+    struct send_target *t = &(*targets)[(*count)++];
+    memset(t, 0, sizeof(*t));
+    t->name = arena_strdup(&cmd_arena, name);
+    t->url = arena_strdup(&cmd_arena, url);
+    t->known_file = arena_printf(&cmd_arena, "%s/%s/commits", REMOTES_DIR, name);
+}
+
+void write_send_status(const struct send_target *t) {
+    char *status_file = arena_printf(&cmd_arena, "%s/%s/status", REMOTES_DIR, t->name);
+    write_file_atomic(status_file, arena_printf(&cmd_arena, "%s %ld\n", t->result == 0 ? "ok" : "failed",
+                                                (long) time(NULL)));
+}
+
+/*
+ * send to named remotes and groups at once: the lists are worked out once,
+ * then up to send-jobs (config, default 8) sends run side by side, each
+ * writing its output to the remote's log. A failed remote doesn't stop
+ * the others.
+ */
+int send_many(int count, char **names) {
+    struct send_target *targets = NULL;
+    int target_count = 0;
+    for (int i = 0; i < count; i++) {
+        char *group_file = arena_printf(&cmd_arena, "%s/%s", REMOTE_GROUPS_DIR, names[i]);
+        char **members;
+        int member_count = read_commit_list(group_file, &members, &cmd_arena);
+        if (member_count == 0) {
+            add_send_target(&targets, &target_count, names[i]);
+        }
+        for (int j = 0; j < member_count; j++) {
+            add_send_target(&targets, &target_count, members[j]);
+        }
+        free(members);
+    }
+    if (target_count == 0) {
+        printf("No remotes to send to.\n");
+        return 1;
+    }
+
+    const char **known_files = malloc(target_count * sizeof(char *));
+    for (int i = 0; i < target_count; i++) known_files[i] = targets[i].known_file;
+    struct send_lists lists;
+    send_lists_prepare(&lists, known_files, target_count);
+    free(known_files);
+
+    int jobs = (int) config_get_size("send-jobs", SEND_DEFAULT_JOBS);
+    if (jobs < 1) jobs = 1;
+    int next = 0, running = 0, done = 0, failed = 0;
+    while (done < target_count) {
+        while (running < jobs && next < target_count) {
+            struct send_target *t = &targets[next++];
+            char *log_file = arena_printf(&cmd_arena, "%s/%s/log", REMOTES_DIR, t->name);
+            printf("Sending to %s (%s)\n", t->name, t->url);
+            fflush(stdout);
+            t->pid = fork();
+            if (t->pid == 0) {
+                int fd = open(log_file, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+                if (fd >= 0) {
+                    dup2(fd, STDOUT_FILENO);
+                    dup2(fd, STDERR_FILENO);
+                    close(fd);
+                }
+                int result = send_one(t->url, &lists);
+                fflush(stdout);
+                _exit(result);
+            }
+            if (t->pid < 0) {
+                perror("Failed to start send");
+                t->result = 1;
+                done++;
+                failed++;
+                continue;
+            }
+            running++;
+        }
+        if (running == 0) continue;
+
+        int status;
+        pid_t pid = wait(&status);
+        if (pid < 0) {
+            if (errno == EINTR) continue;
+            break;
+        }
+        for (int i = 0; i < target_count; i++) {
+            struct send_target *t = &targets[i];
+            if (t->pid != pid) continue;
+            t->result = WIFEXITED(status) ? WEXITSTATUS(status) : 1;
+            write_send_status(t);
+            done++;
+            running--;
+            if (t->result == 0) {
+                record_remote_commits(t->known_file);
+                printf("[%d/%d] %s: sent\n", done, target_count, t->name);
+            } else {
+                failed++;
+                printf("[%d/%d] %s: FAILED, see %s/%s/log\n", done, target_count, t->name,
+                       REMOTES_DIR, t->name);
+            }
+            fflush(stdout);
+        }
+    }
+    send_lists_free(&lists);
+
+    printf("Sent to %d of %d remotes.\n", target_count - failed, target_count);
+    free(targets);
+    return failed ? 1 : 0;
+}
+
+// remote add/remove/group/list
+void remote_add(const char *name, const char *url) {
+    if (strchr(name, '/') || name[0] == '.') {
+        printf("Error: Invalid remote name '%s'\n", name);
+        exit(1);
+    }
+    mkdir(REMOTES_DIR, 0755);
+    mkdir(arena_printf(&cmd_arena, "%s/%s", REMOTES_DIR, name), 0755);
+    // a new url is a new remote: what the old one had doesn't count
+    char *url_file = arena_printf(&cmd_arena, "%s/%s/url", REMOTES_DIR, name);
+    if (remote_url_changed(url_file, url)) unlink(arena_printf(&cmd_arena, "%s/%s/commits", REMOTES_DIR, name));
+    if (write_file_atomic(url_file, arena_printf(&cmd_arena, "%s\n", url)) != 0) {
+        perror("Failed to add remote");
+        exit(1);
+    }
+    printf("Remote %s set to: %s\n", name, url);
+}
+
+void remote_remove(const char *name) {
+    char *dir = arena_printf(&cmd_arena, "%s/%s", REMOTES_DIR, name);
+    struct stat st;
+    if (name[0] == '.' || strchr(name, '/') || stat(dir, &st) != 0) {
+        printf("Error: Remote '%s' not found\n", name);
+        exit(1);
+    }
+    remove_recursive(dir);
+    printf("Removed remote: %s\n", name);
+}
+
+void remote_group(const char *group, int count, char **names) {
+    if (strchr(group, '/') || group[0] == '.') {
+        printf("Error: Invalid group name '%s'\n", group);
+        exit(1);
+    }
+    char *group_file = arena_printf(&cmd_arena, "%s/%s", REMOTE_GROUPS_DIR, group);
+    if (count == 0) {
+        unlink(group_file);
+        printf("Removed group: %s\n", group);
+        return;
+    }
+    struct stat st;
+    char *members = "";
+    for (int i = 0; i < count; i++) {
+        if (stat(arena_printf(&cmd_arena, "%s/%s/url", REMOTES_DIR, names[i]), &st) != 0) {
+            printf("Error: Remote '%s' not found\n", names[i]);
+            exit(1);
+        }
+        members = arena_printf(&cmd_arena, "%s%s\n", members, names[i]);
+    }
+    mkdir(REMOTE_GROUPS_DIR, 0755);
+    if (write_file_atomic(group_file, members) != 0) {
+        perror("Failed to write group");
+        exit(1);
+    }
+    printf("Group %s: %d remotes\n", group, count);
+}
+
+// every remote with where it points and how its last send went
+void remote_list() {
+    char default_remote[256];
+    FILE *f = fopen(REMOTE_FILE, "r");
+    if (f) {
+        if (fgets(default_remote, sizeof(default_remote), f)) {
+            default_remote[strcspn(default_remote, "\n")] = 0;
+            printf("(default)  %s\n", default_remote);
+        }
+        fclose(f);
+    }
+
+    struct arena_mark mark = arena_save(&cmd_arena);
+    char **names;
+    int count = read_dir_names(REMOTES_DIR, &names, &cmd_arena);
+    for (int i = 0; i < count; i++) {
+        char url[256] = "", status[64] = "never sent";
+        char *url_file = arena_printf(&cmd_arena, "%s/%s/url", REMOTES_DIR, names[i]);
+        char *status_file = arena_printf(&cmd_arena, "%s/%s/status", REMOTES_DIR, names[i]);
+        if ((f = fopen(url_file, "r"))) {
+            if (fgets(url, sizeof(url), f)) url[strcspn(url, "\n")] = 0;
+            fclose(f);
+        }
+        if ((f = fopen(status_file, "r"))) {
+            char result[16];
+            long when;
+            if (fscanf(f, "%15s %ld", result, &when) == 2) {
+                time_t t = when;
+                char date[32];
+                strftime(date, sizeof(date), "%Y-%m-%d %H:%M:%S", localtime(&t));
+                snprintf(status, sizeof(status), "%s %s", result, date);
+            }
+            fclose(f);
+        }
+        printf("%-10s %s  [%s]\n", names[i], url, status);
+    }
+    free(names);
+
+    count = read_dir_names(REMOTE_GROUPS_DIR, &names, &cmd_arena);
+    for (int i = 0; i < count; i++) {
+        char **members;
+        int member_count = read_commit_list(arena_printf(&cmd_arena, "%s/%s", REMOTE_GROUPS_DIR, names[i]),
+                                            &members, &cmd_arena);
+        printf("group %s:", names[i]);
+        for (int j = 0; j < member_count; j++) printf(" %s", members[j]);
+        printf("\n");
+        free(members);
+    }
+    free(names);
+    arena_restore(&cmd_arena, mark);
+}
+
+// fetch commits from remote
+void fetch() {
+    FILE *remote = fopen(REMOTE_FILE, "r");
+    if (!remote) {
+        printf("No remote configured. Use 'mnemos remote <path>' to set one.\n");
+        exit(1);
+    }
+
+    char remote_path[256];
+    fgets(remote_path, sizeof(remote_path), remote);
+    fclose(remote);
+
+    // trim newline
+    remote_path[strcspn(remote_path, "\n")] = 0;
+
+    // .mnemos must exist
+    struct stat st;
+    if (stat(MNEMOS_DIR, &st) != 0) {
+        printf("Error: This is not a Mnemos repository. Initialize it first with 'mnemos init'.\n");
+        exit(1);
+    }
+
+    // rsync commits
+    char command[512];
+    snprintf(command, sizeof(command), "rsync -av %s/commits/ %s/", remote_path, COMMITS_DIR);
+    int result_commits = system(command);
+
+    // rsync objects
+    snprintf(command, sizeof(command), "rsync -av %s/objects/ %s/", remote_path, OBJECTS_DIR);
+    int result_objects = system(command);
+
+    if (result_commits == 0 && result_objects == 0) {
+        printf("Commits and objects fetched from remote: %s\n", remote_path);
+    } else {
+        if (result_commits != 0) {
+            printf("Failed to fetch commits from remote.\n");
+        }
+        if (result_objects != 0) {
+            printf("Failed to fetch objects from remote.\n");
+        }
+    }
+}
+
+// create remote repository from local mnemos
+void create_remote(const char *remote_path) {
+    char command[512];
+
+    // single quotes around the mkdir command to so shell interprets ~ correctly
+    snprintf(command, sizeof(command),
+             "ssh %s 'mkdir -p \"%s/commits\" && mkdir -p \"%s/objects\" && touch \"%s/HEAD\"'",
+             remote_path, remote_path, remote_path, remote_path);
+    int result = system(command);
+
+    if (result == 0) {
+        printf("Created remote repository at: %s\n", remote_path);
+        set_remote(remote_path); // automatically set new remote
+    } else {
+        printf("Failed to create remote repository.\n");
+    }
+}
+
+// just init repo on remote from local
+void remote_init() {
+    FILE *remote = fopen(REMOTE_FILE, "r");
+    if (!remote) {
+        printf("No remote configured. Use 'mnemos remote <path>' to set one.\n");
+        return;
+    }
+
+    char remote_path[256];
+    if (!fgets(remote_path, sizeof(remote_path), remote)) {
+        fclose(remote);
+        printf("Failed to read remote configuration.\n");
+        return;
+    }
+    fclose(remote);
+
+    // trim newline
+    remote_path[strcspn(remote_path, "\n")] = 0;
+
+    // make sure remote_path is not empty
+    if (strlen(remote_path) == 0) {
+        printf("Remote path is empty. Please set a valid remote path.\n");
+        return;
+    }
+
+    // extract user@host and remote directory
+    char user_host[128] = {0};
+    char remote_dir[128] = {0};
+    char *colon = strchr(remote_path, ':');
+    if (colon) {
+        size_t host_len = colon - remote_path;
+        strncpy(user_host, remote_path, host_len);
+        user_host[host_len] = '\0';
+        strcpy(remote_dir, colon + 1);
+    } else {
+        printf("Invalid remote path format. Use user@host:/path/to/repo\n");
+        return;
+    }
+
+    // for SSH command
+    char command[512];
+    snprintf(command, sizeof(command),
+             "ssh %s 'mkdir -p \"%s/commits\" && mkdir -p \"%s/objects\" && touch \"%s/HEAD\" && touch \"%s/index\"'",
+             user_host, remote_dir, remote_dir, remote_dir, remote_dir);
+
+    // debug
+    // printf("Executing command: %s\n", command);
+
+    // execute 
+    int result = system(command);
+
+    if (result == 0) {
+        printf("Initialized remote repository at: %s\n", remote_path);
+    } else {
+        printf("Failed to initialize remote repository at: %s\n", remote_path);
+    }
+}
+
+/*
+ * post-receive hook: after a send, the receiving repository runs
+ * .mnemos/hooks/post-receive <old tip> <new tip>, with every path that
+ * changed between the two trees on stdin, each ending in a NUL. The tip
+ * last handed to the hook is kept in .mnemos/received, so the first
+ * receive gets "-" as old tip and every path as added. When the hook
+ * fails, received stays put and the next receive covers both sends.
+ */
+#define HOOK_FILE ".mnemos/hooks/post-receive"
+#define RECEIVED_FILE ".mnemos/received"
+
+void write_changed_path(void *ctx, const char *path, const char *old_hash, const char *new_hash) {
+    (void) old_hash;
+    (void) new_hash;
+    FILE *hook = ctx;
+    fwrite(path, 1, strlen(path) + 1, hook);
+}
+
+// run from the sending side: mnemos receive <repository> <new tip>
+int receive(const char *repo_dir, const char *new_tip) {
+    // the remote path may be the repository or its .mnemos directory
+    if (enter_repository(repo_dir) != 0) return 1;
+
+    struct stat st;
+    if (stat(arena_printf(&cmd_arena, "%s/%s", COMMITS_DIR, new_tip), &st) != 0) {
+        printf("Error: Commit %s not found.\n", new_tip);
+        return 1;
+    }
+    if (access(HOOK_FILE, X_OK) != 0) return 0;
+
+    char old_tip[HASH_SIZE] = "";
+    if (read_hash_file(RECEIVED_FILE, old_tip) != 0 ||
+        stat(arena_printf(&cmd_arena, "%s/%s", COMMITS_DIR, old_tip), &st) != 0) {
+        old_tip[0] = 0;
+    }
+    if (strcmp(old_tip, new_tip) == 0) return 0;
+
+    fflush(stdout);
+    FILE *hook = popen(arena_printf(&cmd_arena, "%s %s %s", HOOK_FILE,
+                                    old_tip[0] ? old_tip : "-", new_tip), "w");
+    if (!hook) {
+        perror("Failed to run post-receive hook");
+        return 1;
+    }
+    // a hook that doesn't read its input must not kill us
+    signal(SIGPIPE, SIG_IGN);
+    diff_trees(old_tip, new_tip, "", write_changed_path, hook, &cmd_arena);
+    int status = pclose(hook);
+    signal(SIGPIPE, SIG_DFL);
+
+    if (status != 0) {
+        printf("Error: post-receive hook failed, it will see these changes again next time.\n");
+        return 1;
+    }
+    if (write_file_atomic(RECEIVED_FILE, arena_printf(&cmd_arena, "%s\n", new_tip)) != 0) {
+        perror("Failed to record received commit");
+        return 1;
+    }
+    return 0;
+}
+
+void list_commits() {
+    DIR *dir = opendir(COMMITS_DIR);
+    if (!dir) {
+        perror("Failed to open commits directory");
+        exit(1);
+    }
+
+    struct dirent *entry;
+    struct {
+        char hash[HASH_SIZE];
+        time_t timestamp;
+    } commits[1024];
+    int count = 0;
+
+    while ((entry = readdir(dir)) != NULL) {
+        // dot names are commits still being built
+        if (entry->d_name[0] == '.') {
+            continue;
+        }
+
+        // stamp of Time for each commit, so we can see how old we get
+        char timestamp_path[256];
+        snprintf(timestamp_path, sizeof(timestamp_path), "%s/%s/timestamp", COMMITS_DIR, entry->d_name);
+
+        FILE *timestamp_file = fopen(timestamp_path, "r");
+        if (timestamp_file) {
+            commits[count].timestamp = 0;
+            fscanf(timestamp_file, "%ld", &commits[count].timestamp);
+            fclose(timestamp_file);
+        } else {
+            commits[count].timestamp = 0; // missing timestamp
+        }
+
+        strcpy(commits[count].hash, entry->d_name);
+        count++;
+    }
+    closedir(dir);
+
+    // sort commits by timestamp
+    for (int i = 0; i < count - 1; ++i) {
+        for (int j = i + 1; j < count; ++j) {
+            if (commits[i].timestamp > commits[j].timestamp) {
+                // swap
+                time_t temp_time = commits[i].timestamp;
+                commits[i].timestamp = commits[j].timestamp;
+                commits[j].timestamp = temp_time;
+
+                char temp_hash[HASH_SIZE];
+                strcpy(temp_hash, commits[i].hash);
+                strcpy(commits[i].hash, commits[j].hash);
+                strcpy(commits[j].hash, temp_hash);
+            }
+        }
+    }
+
+    // print commits
+    printf("Commits (newest to oldest):\n");
+    for (int i = count - 1; i >= 0; --i) {
+        printf("Commit: %s, Timestamp: %ld\n", commits[i].hash, commits[i].timestamp);
+    }
+}
+
+/*
+ * untracked cache: .mnemos/untracked-cache remembers, per directory, its
+ * mtime and its children. A directory whose mtime hasn't moved can't have
+ * gained or lost entries, so status reuses the list instead of reading it
+ * again. Directories with no tracked file below them are shown once as
+ * "dir/" and never walked.
+ */
+#define UNTRACKED_CACHE_FILE ".mnemos/untracked-cache"
+
+struct dir_record {
+    char *path;
+    time_t mtime;
+    long mtime_nsec;
+    char **names;   // children, directories end in '/'
+    int count;
+};
+
+struct untracked_cache {
+    struct arena arena;
+    time_t written_at;
+    struct dir_record *old;     // as loaded, sorted by path
+    int old_count;
+    struct dir_record *fresh;   // what this walk saw
+    int fresh_count;
+    int fresh_capacity;
+    int reread;                 // directories that had to be read again
+};
+
+int compare_dir_records(const void *a, const void *b) {
+    return strcmp(((const struct dir_record *) a)->path, ((const struct dir_record *) b)->path);
+}
+
+int compare_names(const void *a, const void *b) {
+    return strcmp(*(char *const *) a, *(char *const *) b);
+}
+
+void untracked_cache_load(struct untracked_cache *uc) {
+    FILE *f = fopen(UNTRACKED_CACHE_FILE, "r");
+    if (!f) return;
+
+    long written_at;
+    if (fscanf(f, "mnemos-untracked-cache %ld\n", &written_at) != 1) {
+        fclose(f);
+        return;
+    }
+    uc->written_at = written_at;
+
+    int capacity = 0;
+    char *line = NULL;
+    size_t line_capacity = 0;
+    while (getline(&line, &line_capacity, f) != -1) {
+        line[strcspn(line, "\n")] = 0;
+        long sec, nsec;
+        int count, offset;
+        if (sscanf(line, "D %ld %ld %d %n", &sec, &nsec, &count, &offset) != 3) break;
+
+        if (uc->old_count == capacity) {
+            capacity = capacity ? capacity * 2 : 64;
+            uc->old = realloc(uc->old, capacity * sizeof(struct dir_record));
+        }
+        struct dir_record *r = &uc->old[uc->old_count++];
+        r->path = arena_strdup(&uc->arena, line + offset);
+        r->mtime = sec;
+        r->mtime_nsec = nsec;
+        r->count = 0;
+        r->names = arena_alloc(&uc->arena, (count + 1) * sizeof(char *));
+        for (int i = 0; i < count && getline(&line, &line_capacity, f) != -1; i++) {
+            line[strcspn(line, "\n")] = 0;
+            r->names[r->count++] = arena_strdup(&uc->arena, line);
+        }
+    }
+    free(line);
+    fclose(f);
+    qsort(uc->old, uc->old_count, sizeof(struct dir_record), compare_dir_records);
+}
+
+void untracked_cache_save(struct untracked_cache *uc) {
+    char temp_path[] = MNEMOS_DIR "/untracked-cache-XXXXXX";
+    int fd = mkstemp(temp_path);
+    FILE *f = fd >= 0 ? fdopen(fd, "w") : NULL;
+    if (!f) return;
+
+    fprintf(f, "mnemos-untracked-cache %ld\n", (long) time(NULL));
+    for (int i = 0; i < uc->fresh_count; i++) {
+        struct dir_record *r = &uc->fresh[i];
+        fprintf(f, "D %ld %ld %d %s\n", (long) r->mtime, r->mtime_nsec, r->count, r->path);
+        for (int j = 0; j < r->count; j++) fprintf(f, "%s\n", r->names[j]);
+    }
+    fchmod(fd, 0644);
+    if (fclose(f) != 0 || rename(temp_path, UNTRACKED_CACHE_FILE) != 0) {
+        unlink(temp_path);
+    }
+}
+
+// children of a directory, from the cache when its mtime says nothing changed
+struct dir_record *untracked_dir(struct untracked_cache *uc, const char *dir_path, const char *rel) {
+    struct stat st;
+    if (stat(dir_path, &st) != 0) return NULL;
+
+    struct dir_record key = { (char *) rel, 0, 0, NULL, 0 };
+    struct dir_record *cached = uc->old_count ?
+        bsearch(&key, uc->old, uc->old_count, sizeof(struct dir_record), compare_dir_records) : NULL;
+
+    if (uc->fresh_count == uc->fresh_capacity) {
+        uc->fresh_capacity = uc->fresh_capacity ? uc->fresh_capacity * 2 : 64;
+        uc->fresh = realloc(uc->fresh, uc->fresh_capacity * sizeof(struct dir_record));
+    }
+    struct dir_record *r = &uc->fresh[uc->fresh_count++];
+    r->path = arena_strdup(&uc->arena, rel);
+    r->mtime = st.st_mtime;
+    r->mtime_nsec = ST_MTIME_NSEC(st);
+
+    // an mtime in the same second the cache was written may hide a later change
+    if (cached && cached->mtime == r->mtime && cached->mtime_nsec == r->mtime_nsec &&
+        cached->mtime < uc->written_at) {
+        r->names = cached->names;
+        r->count = cached->count;
+        return r;
+    }
+
+    uc->reread++;
+    r->names = NULL;
+    r->count = 0;
+    DIR *dir = opendir(dir_path);
+    if (!dir) return r;
+
+    int capacity = 0;
+    char **names = NULL;
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0 ||
+            strncmp(entry->d_name, ".mnemos", 7) == 0) {
+            continue;
+        }
+        char *child = arena_printf(&cmd_arena, "%s/%s", dir_path, entry->d_name);
+        struct stat child_st;
+        if (stat(child, &child_st) != 0) continue;
+
+        const char *suffix;
+        if (S_ISDIR(child_st.st_mode)) {
+            suffix = "/";
+        } else if (S_ISREG(child_st.st_mode)) {
+            suffix = "";
+        } else {
+            continue;
+        }
+        if (r->count == capacity) {
+            capacity = capacity ? capacity * 2 : 16;
+            names = realloc(names, capacity * sizeof(char *));
+        }
+        names[r->count++] = arena_printf(&uc->arena, "%s%s", entry->d_name, suffix);
+    }
+    closedir(dir);
+
+    qsort(names, r->count, sizeof(char *), compare_names);
+    r->names = arena_alloc(&uc->arena, (r->count + 1) * sizeof(char *));
+    if (r->count) memcpy(r->names, names, r->count * sizeof(char *));
+    free(names);
+    return r;
+}
+
+// rel is relative to the working directory, "" for the top; nothing outside cone is read
+void untracked_walk(struct untracked_cache *uc, struct path_table *tracked,
+                    struct path_table *cone, const char *rel) {
+    struct dir_record *r = untracked_dir(uc, rel[0] ? rel : ".", rel[0] ? rel : ".");
+    if (!r) return;
+
+    char **names = r->names;
+    int count = r->count;
+    for (int i = 0; i < count; i++) {
+        size_t len = strlen(names[i]);
+        int is_dir = names[i][len - 1] == '/';
+        char *child_rel = rel[0] ? arena_printf(&cmd_arena, "%s/%.*s", rel, (int) (len - is_dir), names[i])
+                                 : arena_printf(&cmd_arena, "%.*s", (int) (len - is_dir), names[i]);
+        int match = cone_match(cone, child_rel);
+        if (match == CONE_OUT) continue;
+        if (is_dir) {
+            if (match == CONE_PARENT) {
+                // only on the way to the cone
+                untracked_walk(uc, tracked, cone, child_rel);
+            } else if (path_lookup(tracked, child_rel) == PATH_NONE) {
+                // nothing tracked below: show the directory, skip its contents
+                printf("\033[90m%s/\n\033[0m", child_rel);
+            } else {
+                untracked_walk(uc, tracked, NULL, child_rel);
+            }
+        } else if (match == CONE_IN && !path_has(tracked, child_rel)) {
+            printf("\033[90m%s\n\033[0m", child_rel);
+        }
+    }
+}
+
+// show untracked files below the current directory, inside cone
+void print_untracked(struct path_table *tracked, struct path_table *cone) {
+    printf("\nUntracked files:\n");
+    printf("----------------\n");
+
+    struct untracked_cache uc;
+    memset(&uc, 0, sizeof(uc));
+    untracked_cache_load(&uc);
+    untracked_walk(&uc, tracked, cone, "");
+
+    // rewrite when a directory was read again or one disappeared
+    if (uc.reread > 0 || uc.fresh_count != uc.old_count) {
+        untracked_cache_save(&uc);
+    }
+    free(uc.old);
+    free(uc.fresh);
+    arena_free(&uc.arena);
+}
+
+// status from the warm cache of `mnemos serve`, no file is opened or hashed here
+void status_cached() {
+    printf("Status of tracked files:\n");
+    printf("------------------------\n");
+
+    struct path_table sparse;
+    struct path_table *cone = load_sparse(&sparse) ? &sparse : NULL;
+    for (int i = 0; i < repo_cache->count; i++) {
+        struct cache_entry *e = &repo_cache->entries[i];
+        if (!cone_has_file(cone, e->path)) {
+            continue;
+        } else if (e->missing) {
+            printf("\033[31m[MISSING]\033[0m %s\n", e->path);
+        } else if (e->head_hash[0] == '\0') {
+            printf("\033[36m[NEW]\033[0m %s\n", e->path);
+        } else if (strcmp(e->work_hash, e->head_hash) == 0) {
+            printf("\033[32m[UNCHANGED]\033[0m %s\n", e->path);
+        } else {
+            printf("\033[33m[MODIFIED]\033[0m %s\n", e->path);
+        }
+    }
+
+    print_untracked(&repo_cache->tracked, cone);
+    if (cone) path_table_free(cone);
+}
+
+// one tracked file as status sees it
+struct status_file {
+    const char *path;
+    int state;  // STATUS_*
+};
+
+#define STATUS_UNKNOWN 0
+#define STATUS_MISSING 1
+#define STATUS_NEW 2
+#define STATUS_UNCHANGED 3
+#define STATUS_MODIFIED 4
+
+struct status_batch {
+    struct status_file *files;
+    int count;
+    const char *head_commit;
+};
+
+// worker: stat, hash and compare against the hash in HEAD
+void status_one(void *ctx, int i) {
+    struct status_batch *batch = ctx;
+    struct status_file *f = &batch->files[i];
+
+    struct stat st;
+    char current_hash[HASH_SIZE];
+    if (stat(f->path, &st) != 0 || try_hash_file(f->path, current_hash) != 0) {
+        f->state = STATUS_MISSING;
+        return;
+    }
+    if (batch->head_commit[0] == '\0') {
+        f->state = STATUS_NEW;
+        return;
+    }
+
+    // is file modified compared to last commit?
+    struct arena a = {0};
+    char committed_hash[HASH_SIZE];
+    char *commit_file_path = arena_printf(&a, "%s/%s/%s", COMMITS_DIR, batch->head_commit, f->path);
+    FILE *commit_file = fopen(commit_file_path, "r");
+    if (!commit_file) {
+        f->state = STATUS_NEW;
+    } else {
+        if (fgets(committed_hash, sizeof(committed_hash), commit_file)) {
+            committed_hash[strcspn(committed_hash, "\n")] = 0;
+            f->state = strcmp(current_hash, committed_hash) == 0 ? STATUS_UNCHANGED : STATUS_MODIFIED;
+        }
+        fclose(commit_file);
+    }
+    arena_free(&a);
+}
+
+// status function
+void status() {
+    if (repo_cache && repo_cache->loaded) {
+        status_cached();
+        return;
+    }
+
+    FILE *index = fopen(INDEX_FILE, "r");
+    if (!index) {
+        printf("No tracked files found. Use 'mnemos track <file>' to start tracking files.\n");
+        return;
+    }
+
+    // current HEAD commit for comparing
+    char head_commit[HASH_SIZE] = {0};
+    FILE *head = fopen(HEAD_FILE, "r");
+    if (head) {
+        if (fgets(head_commit, sizeof(head_commit), head)) {
+            head_commit[strcspn(head_commit, "\n")] = 0; // remove newline
+        }
+        fclose(head);
+    }
+
+    printf("Status of tracked files:\n");
+    printf("------------------------\n");
+
+    struct path_table tracked;
+    path_table_init(&tracked, &cmd_arena);
+    struct path_table sparse;
+    struct path_table *cone = load_sparse(&sparse) ? &sparse : NULL;
+
+    struct status_batch batch;
+    memset(&batch, 0, sizeof(batch));
+    batch.head_commit = head_commit;
+
+    int capacity = 0;
+    char *line = NULL;
+    size_t line_capacity = 0;
+    while (getline(&line, &line_capacity, index) != -1) {
+        line[strcspn(line, "\n")] = 0; // remove newline
+        path_add(&tracked, line);
+        // outside the sparse checkout there is nothing on disk to look at
+        if (!cone_has_file(cone, line)) continue;
+        if (batch.count == capacity) {
+            capacity = capacity ? capacity * 2 : 256;
+            batch.files = realloc(batch.files, capacity * sizeof(struct status_file));
+        }
+        memset(&batch.files[batch.count], 0, sizeof(struct status_file));
+        batch.files[batch.count++].path = arena_strdup(&cmd_arena, line);
+    }
+    free(line);
+    fclose(index);
+
+    // stat and hash every tracked file on the I/O workers
+    io_batch(batch.count, status_one, &batch);
+
+    for (int i = 0; i < batch.count; i++) {
+        struct status_file *f = &batch.files[i];
+        switch (f->state) {
+            case STATUS_MISSING:
+                printf("\033[31m[MISSING]\033[0m %s\n", f->path);
+                break;
+            case STATUS_NEW:
+                printf("\033[36m[NEW]\033[0m %s\n", f->path);
+                break;
+            case STATUS_UNCHANGED:
+                printf("\033[32m[UNCHANGED]\033[0m %s\n", f->path);
+                break;
+            case STATUS_MODIFIED:
+                printf("\033[33m[MODIFIED]\033[0m %s\n", f->path);
+                break;
+        }
+    }
+    free(batch.files);
+
+    print_untracked(&tracked, cone);
+    path_table_free(&tracked);
+    if (cone) path_table_free(cone);
+}
+
+/*
+ * memories: loose files .mnemos/memories/<name> (a name with slashes makes
+ * subdirectories), and .mnemos/packed-memories, sorted lines
+ * "<name> <commit>" found by binary search. A loose memory overrides a
+ * packed one of the same name. `mnemos pack-memories` moves the loose
+ * ones into the packed file.
+ */
+#define MEMORIES_DIR ".mnemos/memories"
+#define PACKED_MEMORIES_FILE ".mnemos/packed-memories"
+
+struct packed_memories {
+    char *data;
+    size_t size;
+};
+
+void packed_memories_open(struct packed_memories *pm) {
+    memset(pm, 0, sizeof(*pm));
+    int fd = open(PACKED_MEMORIES_FILE, O_RDONLY);
+    if (fd < 0) return;
+    struct stat st;
+    if (fstat(fd, &st) == 0 && st.st_size > 0) {
+        void *data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data != MAP_FAILED) {
+            pm->data = data;
+            pm->size = st.st_size;
+        }
+    }
+    close(fd);
+}
+
+void packed_memories_close(struct packed_memories *pm) {
+    if (pm->data) munmap(pm->data, pm->size);
+}
+
+// the name of the line at start: up to the last space before the newline
+size_t packed_name_length(const struct packed_memories *pm, size_t start, size_t *line_end) {
+    size_t end = start;
+    while (end < pm->size && pm->data[end] != '\n') end++;
+    *line_end = end;
+    size_t name_end = end;
+    while (name_end > start && pm->data[name_end - 1] != ' ') name_end--;
+    return name_end > start ? name_end - start - 1 : end - start;
+}
+
+// offset of the first line whose name sorts at or after key
+size_t packed_memories_seek(const struct packed_memories *pm, const char *key) {
+    size_t key_len = strlen(key);
+    size_t lo = 0, hi = pm->size;
+    while (lo < hi) {
+        size_t start = lo + (hi - lo) / 2;
+        while (start > lo && pm->data[start - 1] != '\n') start--;
+        size_t end;
+        size_t len = packed_name_length(pm, start, &end);
+        int cmp = memcmp(pm->data + start, key, len < key_len ? len : key_len);
+        if (cmp == 0) cmp = len < key_len ? -1 : len > key_len ? 1 : 0;
+        if (cmp < 0) {
+            lo = end + 1;
+        } else {
+            hi = start;
+        }
+    }
+    return lo;
+}
+
+// a loose memory file's path, NULL for names that would leave memories/
+char *memory_path(const char *name) {
+    if (!name[0] || name[0] == '/' || name[0] == '.' || strstr(name, "/.") || strchr(name, ' ')) return NULL;
+    return arena_printf(&cmd_arena, "%s/%s", MEMORIES_DIR, name);
+}
+
+// commit a memory points to, loose first, then packed. -1 if there's no such memory
+int resolve_memory(const char *name, char *commit_out) {
+    char *path = memory_path(name);
+    if (!path) return -1;
+    if (read_hash_file(path, commit_out) == 0) return 0;
+
+    struct packed_memories pm;
+    packed_memories_open(&pm);
+    int found = -1;
+    size_t start = packed_memories_seek(&pm, name), end;
+    if (start < pm.size) {
+        size_t len = packed_name_length(&pm, start, &end);
+        if (len == strlen(name) && memcmp(pm.data + start, name, len) == 0 && end - start > len + 1) {
+            snprintf(commit_out, HASH_SIZE, "%.*s", (int) (end - start - len - 1), pm.data + start + len + 1);
+            found = 0;
+        }
+    }
+    packed_memories_close(&pm);
+    return found;
+}
+
+// a memory, or else a commit id
+void resolve_commit(const char *name, char *commit_out) {
+    if (resolve_memory(name, commit_out) != 0) snprintf(commit_out, HASH_SIZE, "%s", name);
+}
+
+struct memory_entry {
+    char *name;
+    char commit[HASH_SIZE];
+};
+
+int compare_memory_entries(const void *a, const void *b) {
+    return strcmp(((const struct memory_entry *) a)->name, ((const struct memory_entry *) b)->name);
+}
+
+void collect_loose_memories(const char *dir_path, const char *rel, struct memory_entry **entries,
+                            int *count, int *capacity) {
+    char **names;
+    int name_count = read_dir_names(dir_path, &names, &cmd_arena);
+    for (int i = 0; i < name_count; i++) {
+        char *path = arena_printf(&cmd_arena, "%s/%s", dir_path, names[i]);
+        char *name = rel[0] ? arena_printf(&cmd_arena, "%s/%s", rel, names[i]) : names[i];
+        struct stat st;
+        if (stat(path, &st) != 0) continue;
+        if (S_ISDIR(st.st_mode)) {
+            collect_loose_memories(path, name, entries, count, capacity);
+            continue;
+        }
+        if (*count == *capacity) {
+            *capacity = *capacity ? *capacity * 2 : 64;
+            *entries = realloc(*entries, *capacity * sizeof(struct memory_entry));
+        }
+        struct memory_entry *e = &(*entries)[*count];
+        e->name = name;
+        if (read_hash_file(path, e->commit) != 0) e->commit[0] = 0;
+        (*count)++;
+    }
+    free(names);
+}
+
+/*
+ * every memory matching pattern (a shell glob, NULL for all) in name
+ * order, loose ones overriding packed ones. Packed memories are only read
+ * from the first name that can match.
+ */
+int for_each_memory(const char *pattern, void (*fn)(void *ctx, const char *name, const char *commit),
+                    void *ctx) {
+    struct memory_entry *loose = NULL;
+    int loose_count = 0, capacity = 0;
+    collect_loose_memories(MEMORIES_DIR, "", &loose, &loose_count, &capacity);
+    qsort(loose, loose_count, sizeof(struct memory_entry), compare_memory_entries);
+
+    char *prefix = arena_strdup(&cmd_arena, pattern ? pattern : "");
+    prefix[strcspn(prefix, "*?[\\")] = 0;
+    size_t prefix_len = strlen(prefix);
+
+    struct packed_memories pm;
+    packed_memories_open(&pm);
+    size_t pos = packed_memories_seek(&pm, prefix);
+    int i = 0, count = 0;
+    while (1) {
+        char *packed_name = NULL, *packed_commit = NULL;
+        size_t end = pos;
+        if (pos < pm.size) {
+            size_t len = packed_name_length(&pm, pos, &end);
+            if (len >= prefix_len && memcmp(pm.data + pos, prefix, prefix_len) == 0) {
+                packed_name = arena_printf(&cmd_arena, "%.*s", (int) len, pm.data + pos);
+                packed_commit = arena_printf(&cmd_arena, "%.*s", (int) (end > pos + len ? end - pos - len - 1 : 0),
+                                             pm.data + pos + len + 1);
+            }
+        }
+        while (i < loose_count && strncmp(loose[i].name, prefix, prefix_len) < 0) i++;
+        int loose_left = i < loose_count && strncmp(loose[i].name, prefix, prefix_len) == 0;
+        if (!packed_name && !loose_left) break;
+
+        const char *name, *commit;
+        int cmp = !packed_name ? -1 : !loose_left ? 1 : strcmp(loose[i].name, packed_name);
+        if (cmp <= 0) {
+            name = loose[i].name;
+            commit = loose[i].commit;
+            i++;
+            if (cmp == 0) pos = end + 1;
+        } else {
+            name = packed_name;
+            commit = packed_commit;
+            pos = end + 1;
+        }
+        if (!pattern || fnmatch(pattern, name, 0) == 0) {
+            fn(ctx, name, commit);
+            count++;
+        }
+    }
+    packed_memories_close(&pm);
+    free(loose);
+    return count;
+}
+
+// in place of branches, we have "memories" - different remembered states
+// memory is just a named pointer to commit but conceptually simpler
+void create_memory(const char *memory_name) {
+    char *memory_file = memory_path(memory_name);
+    if (!memory_file) {
+        printf("Error: Invalid memory name '%s'\n", memory_name);
+        return;
+    }
+    
+    // Get current HEAD
+    FILE *head = fopen(HEAD_FILE, "r");
+    if (!head) {
+        printf("Error: No moments captured yet\n");
+        return;
+    }
+    
+    char current_commit[HASH_SIZE];
+    if (fgets(current_commit, sizeof(current_commit), head)) {
+        current_commit[strcspn(current_commit, "\n")] = 0;  // remove newline
+    }
+    fclose(head);
+    
+    // create memory pointing to current moment
+    mkdir(MEMORIES_DIR, 0755);  // directory should exist
+    create_directories(memory_file);
+    if (write_file_atomic(memory_file, current_commit) != 0) {
+        printf("Error: Could not capture memory\n");
+        return;
+    }
+    
+    printf("Captured memory: %s\n", memory_name);
+}
+
+void print_memory(void *ctx, const char *name, const char *commit) {
+    (void) ctx;
+    printf("  %s -> moment %s\n", name, commit);
+}
+
+// show what memories are saved, all or those matching pattern
+void list_memories(const char *pattern) {
+    printf("Captured memories:\n");
+    if (for_each_memory(pattern, print_memory, NULL) == 0) {
+        printf("  (none%s)\n", pattern ? " matching" : "");
+    }
+}
+
+struct memory_list {
+    struct memory_entry *entries;
+    int count;
+    int capacity;
+};
+
+void add_memory_entry(void *ctx, const char *name, const char *commit) {
+    struct memory_list *list = ctx;
+    if (list->count == list->capacity) {
+        list->capacity = list->capacity ? list->capacity * 2 : 1024;
+        list->entries = realloc(list->entries, list->capacity * sizeof(struct memory_entry));
+    }
+    struct memory_entry *e = &list->entries[list->count++];
+    e->name = arena_strdup(&cmd_arena, name);
+    snprintf(e->commit, sizeof(e->commit), "%s", commit);
+}
+
+// drop empty directories under memories/ after packing
+void prune_memory_dirs(const char *dir_path) {
+    char **names;
+    int count = read_dir_names(dir_path, &names, &cmd_arena);
+    for (int i = 0; i < count; i++) {
+        char *path = arena_printf(&cmd_arena, "%s/%s", dir_path, names[i]);
+        struct stat st;
+        if (lstat(path, &st) == 0 && S_ISDIR(st.st_mode)) {
+            prune_memory_dirs(path);
+            rmdir(path);
+        }
+    }
+    free(names);
+}
+
+// move every loose memory into packed-memories
+void pack_memories() {
+    struct memory_list list = { NULL, 0, 0 };
+    for_each_memory(NULL, add_memory_entry, &list);
+
+    struct atomic_file af;
+    if (!atomic_begin(&af, PACKED_MEMORIES_FILE)) {
+        perror("Failed to write packed memories");
+        exit(1);
+    }
+    for (int i = 0; i < list.count; i++) {
+        if (list.entries[i].commit[0]) fprintf(af.f, "%s %s\n", list.entries[i].name, list.entries[i].commit);
+    }
+    if (atomic_end(&af) != 0) {
+        perror("Failed to write packed memories");
+        exit(1);
+    }
+
+    // loose files go once they're safely packed
+    int loose = 0;
+    for (int i = 0; i < list.count; i++) {
+        char *path = memory_path(list.entries[i].name);
+        if (list.entries[i].commit[0] && unlink(path) == 0) loose++;
+    }
+    prune_memory_dirs(MEMORIES_DIR);
+    printf("Packed %d memories (%d were loose).\n", list.count, loose);
+    free(list.entries);
+}
+
+// go back to a saved memory (recall)
+void recall_memory(const char *memory_name, struct path_table *scope) {
+    char commit_hash[HASH_SIZE];
+    if (resolve_memory(memory_name, commit_hash) != 0) {
+        printf("Error: Memory '%s' not found\n", memory_name);
+        return;
+    }
+    
+    printf("Recalling memory: %s\n", memory_name);
+    revert_clean(commit_hash, scope);  // Use existing revert functionality
+}
+
+// blend another memory into current state
+void blend_memory(const char *source_memory) {
+    // Get source commit
+    char source_commit[HASH_SIZE];
+    if (resolve_memory(source_memory, source_commit) != 0) {
+        printf("Error: Memory '%s' not found\n", source_memory);
+        return;
+    }
+
+    // Get list of files from source commit
+    char *source_dir = arena_printf(&cmd_arena, "%s/%s", COMMITS_DIR, source_commit);
+    
+    DIR *dir = opendir(source_dir);
+    if (!dir) {
+        printf("Error: Cannot read source memory state\n");
+        return;
+    }
+
+    printf("Blending memory '%s' into current state...\n", source_memory);
+    struct history history;
+    history_load(&history);
+
+    // files the source memory moved since HEAD are blended at their old path
+    char head[HASH_SIZE];
+    char **renames = NULL;
+    int rename_count = 0;
+    if (read_hash_file(HEAD_FILE, head) == 0 && head[0]) {
+        rename_count = detect_renames(head, source_commit, &renames, &cmd_arena);
+    }
+    
+    // for each file in source memory
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+        if (strcmp(entry->d_name, ".") == 0 || 
+            strcmp(entry->d_name, "..") == 0 ||
+            strcmp(entry->d_name, "message") == 0 ||
+            strcmp(entry->d_name, "timestamp") == 0) {
+            continue;
+        }
+
+        char *source_file = arena_printf(&cmd_arena, "%s/%s", source_dir, entry->d_name);
+        char *current_file = arena_strdup(&cmd_arena, entry->d_name);
+
+        char **move = rename_count ? bsearch(&current_file, renames, rename_count, 2 * sizeof(char *),
+                                             compare_names) : NULL;
+        if (move && access(current_file, F_OK) == -1 && access(move[1], F_OK) != -1) {
+            printf("File moved in '%s': %s -> %s\n", source_memory, move[1], entry->d_name);
+            printf("  Move it? [Y/n]: ");
+            char response[10];
+            fgets(response, sizeof(response), stdin);
+            // kept where it is, and not offered again as a new file
+            if (response[0] == 'n' || response[0] == 'N') continue;
+            create_directories(current_file);
+            if (rename(move[1], current_file) != 0) {
+                perror("Error moving file");
+                continue;
+            }
+        }
+
+        // does file exist in current state
+        if (access(current_file, F_OK) != -1) {
+            char current_hash[HASH_SIZE], source_hash[HASH_SIZE];
+            hash_file(current_file, current_hash);
+            
+            FILE *source_hash_file = fopen(source_file, "r");
+            if (source_hash_file) {
+                fgets(source_hash, sizeof(source_hash), source_hash_file);
+                source_hash[strcspn(source_hash, "\n")] = 0;
+                fclose(source_hash_file);
+
+                if (strcmp(current_hash, source_hash) != 0) {
+                    printf("File differs: %s\n", entry->d_name);
+                    const char *changed_in = history_last_change(&history, entry->d_name, source_commit);
+                    if (changed_in) printf("  Last changed in '%s' at moment %s\n", source_memory, changed_in);
+                    printf("  Keep current version? [Y/n]: ");
+                    char response[10];
+                    fgets(response, sizeof(response), stdin);
+                    if (response[0] == 'n' || response[0] == 'N') {
+                        // restore file from source memory
+                        char object_path[OBJECT_PATH_SIZE];
+                        object_find(object_path, source_hash);
+                        copy_file(object_path, current_file);
+                        printf("  Updated with version from '%s'\n", source_memory);
+                    }
+                }
+            }
+        } else {
+            // if file doesnt exist in current state offer to add it
+            printf("New file from '%s': %s\n", source_memory, entry->d_name);
+            printf("  Add this file? [Y/n]: ");
+            char response[10];
+            fgets(response, sizeof(response), stdin);
+            if (response[0] != 'n' && response[0] != 'N') {
+                // file hash from source memory
+                FILE *source_hash_file = fopen(source_file, "r");
+                if (source_hash_file) {
+                    char file_hash[HASH_SIZE];
+                    fgets(file_hash, sizeof(file_hash), source_hash_file);
+                    file_hash[strcspn(file_hash, "\n")] = 0;
+                    fclose(source_hash_file);
+
+                    // restore file from objects
+                    char object_path[OBJECT_PATH_SIZE];
+                    object_find(object_path, file_hash);
+                    create_directories(current_file);
+                    copy_file(object_path, current_file);
+                    printf("  Added file from '%s'\n", source_memory);
+                }
+            }
+        }
+    }
+    closedir(dir);
+    history_free(&history);
+
+    printf("Memory blend complete. Don't forget to commit the changes!\n");
+}
+
+/*
+ * work trees: more checkouts of one repository. A work tree's .mnemos
+ * has its own HEAD, index and caches, while objects, commits, memories
+ * and the rest of the shared state are symlinks into the main .mnemos,
+ * so nothing is stored twice. Files are checked out by cloning objects
+ * where the filesystem supports it. .mnemos/worktrees lists them.
+ */
+#define WORKTREES_FILE ".mnemos/worktrees"
+
+static const char *worktree_shared_dirs[] = {
+    "objects", "commits", "memories", "remotes", "remote-groups", NULL
+};
+static const char *worktree_shared_files[] = {
+    "config", "remote", "remote-commits", "packed-memories", NULL
+};
+
+// where a possibly linked state file really lives
+char *link_target(const char *path, struct arena *a) {
+    char target[4096];
+    ssize_t len = readlink(path, target, sizeof(target) - 1);
+    if (len <= 0) return arena_strdup(a, path);
+    target[len] = '\0';
+    return arena_strdup(a, target);
+}
+
+// create dir, or take one that exists but is empty; checkouts into it delete what isn't theirs
+int make_empty_dir(const char *dir, int *created) {
+    *created = mkdir(dir, 0755) == 0;
+    if (*created) return 0;
+    if (errno != EEXIST) return -1;
+    DIR *d = opendir(dir);
+    if (!d) return -1;
+    int empty = 1;
+    struct dirent *entry;
+    while (empty && (entry = readdir(d)) != NULL) {
+        empty = strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0;
+    }
+    closedir(d);
+    if (!empty) errno = ENOTEMPTY;
+    return empty ? 0 : -1;
+}
+
+void write_index_entry(void *ctx, const char *path, const char *hash) {
+    (void) hash;
+    fprintf(ctx, "%s\n", path);
+}
+
+void worktree_add(const char *dir, const char *memory_name) {
+    char commit_hash[HASH_SIZE];
+    resolve_commit(memory_name, commit_hash);
+    struct stat st;
+    if (stat(arena_printf(&cmd_arena, "%s/%s", COMMITS_DIR, commit_hash), &st) != 0) {
+        printf("Error: Memory '%s' not found\n", memory_name);
+        return;
+    }
+
+    char *main_dir = realpath(MNEMOS_DIR, NULL);
+    if (!main_dir) {
+        printf("Error: Not a mnemos repository\n");
+        return;
+    }
+    int created;
+    if (make_empty_dir(dir, &created) != 0) {
+        if (errno == ENOTEMPTY) {
+            printf("Error: %s already exists and is not empty\n", dir);
+        } else {
+            perror("Failed to create work tree");
+        }
+        free(main_dir);
+        return;
+    }
+    // a checkout in the main tree would remove it, its .mnemos and all
+    char *tree_dir = realpath(".", NULL);
+    char *new_dir = realpath(dir, NULL);
+    size_t tree_len = tree_dir ? strlen(tree_dir) : 0;
+    int inside = tree_dir && new_dir && strncmp(new_dir, tree_dir, tree_len) == 0 &&
+                 (new_dir[tree_len] == '/' || new_dir[tree_len] == '\0');
+    free(tree_dir);
+    free(new_dir);
+    if (inside) {
+        printf("Error: %s is inside this work tree; put work trees next to it instead\n", dir);
+        if (created) rmdir(dir);
+        free(main_dir);
+        return;
+    }
+    char *state_dir = arena_printf(&cmd_arena, "%s/%s", dir, MNEMOS_DIR);
+    if (mkdir(state_dir, 0755) != 0) {
+        printf("Error: %s already has a %s directory\n", dir, MNEMOS_DIR);
+        free(main_dir);
+        return;
+    }
+
+    mkdir(MNEMOS_DIR "/memories", 0755);
+    mkdir(REMOTES_DIR, 0755);
+    mkdir(REMOTE_GROUPS_DIR, 0755);
+    for (int i = 0; worktree_shared_dirs[i]; i++) {
+        symlink(arena_printf(&cmd_arena, "%s/%s", main_dir, worktree_shared_dirs[i]),
+                arena_printf(&cmd_arena, "%s/%s", state_dir, worktree_shared_dirs[i]));
+    }
+    // bitmaps only if they are on, files even before they exist
+    if (stat(MNEMOS_DIR "/bitmaps", &st) == 0) {
+        symlink(arena_printf(&cmd_arena, "%s/bitmaps", main_dir),
+                arena_printf(&cmd_arena, "%s/bitmaps", state_dir));
+    }
+    for (int i = 0; worktree_shared_files[i]; i++) {
+        symlink(arena_printf(&cmd_arena, "%s/%s", main_dir, worktree_shared_files[i]),
+                arena_printf(&cmd_arena, "%s/%s", state_dir, worktree_shared_files[i]));
+    }
+
+    // everything in the commit is tracked there
+    FILE *index = fopen(arena_printf(&cmd_arena, "%s/index", state_dir), "w");
+    if (!index) {
+        perror("Failed to create work tree index");
+        free(main_dir);
+        exit(1);
+    }
+    for_each_tree_entry(arena_printf(&cmd_arena, "%s/%s", COMMITS_DIR, commit_hash),
+                        write_index_entry, index, &cmd_arena);
+    fclose(index);
+
+    char *work_dir = realpath(dir, NULL);
+    FILE *list = fopen(WORKTREES_FILE, "a");
+    if (list) {
+        fprintf(list, "%s %s\n", commit_hash, work_dir ? work_dir : dir);
+        fclose(list);
+    }
+    free(work_dir);
+    free(main_dir);
+
+    // check out from inside the new tree, HEAD goes to its own .mnemos
+    if (chdir(dir) != 0) {
+        perror("Failed to enter work tree");
+        exit(1);
+    }
+    printf("Preparing work tree %s (memory %s)\n", dir, memory_name);
+    revert_clean(commit_hash, NULL);
+}
+
+void worktree_list() {
+    char *main_dir = realpath(".", NULL);
+    printf("  %s (main)\n", main_dir ? main_dir : ".");
+    free(main_dir);
+
+    FILE *list = fopen(WORKTREES_FILE, "r");
+    if (!list) return;
+    char *line = NULL;
+    size_t capacity = 0;
+    while (getline(&line, &capacity, list) != -1) {
+        line[strcspn(line, "\n")] = 0;
+        char *path = strchr(line, ' ');
+        if (!path) continue;
+        path++;
+
+        // show where each one is now, gone ones as such
+        char head[HASH_SIZE];
+        char *head_file = arena_printf(&cmd_arena, "%s/%s", path, HEAD_FILE);
+        if (read_hash_file(head_file, head) == 0) {
+            printf("  %s -> moment %s\n", path, head);
+        } else {
+            printf("  %s (missing)\n", path);
+        }
+    }
+    free(line);
+    fclose(list);
+}
+
+/*
+ * clone: a local copy of a repository. Objects never change once
+ * written, so they are hardlinked (or cloned, or copied when the two
+ * directories are on different filesystems). Commits, memories and the
+ * small state files are copied, since some of them are rewritten in
+ * place. The work tree is then checked out from the new objects.
+ */
+struct clone_file {
+    char *src;
+    char *dest;
+    int link;       // may share the inode with src
+    int linked;
+    int error;      // errno of a failed copy
+};
+
+struct clone_batch {
+    struct clone_file *files;
+    int count;
+    int capacity;
+};
+
+void clone_one(void *ctx, int i) {
+    struct clone_file *f = &((struct clone_batch *) ctx)->files[i];
+    if (f->link && link(f->src, f->dest) == 0) {
+        f->linked = 1;
+    } else if ((f->link ? try_clone_file(f->src, f->dest) : try_copy_file(f->src, f->dest)) != 0) {
+        f->error = errno ? errno : EIO;
+    }
+}
+
+// queue every file below src for dest, making directories on the way
+void collect_clone(struct clone_batch *batch, const char *src, const char *dest, int link) {
+    struct stat st;
+    if (stat(src, &st) != 0) return;
+    if (S_ISDIR(st.st_mode)) {
+        mkdir(dest, 0755);
+        DIR *dir = opendir(src);
+        if (!dir) return;
+        struct dirent *entry;
+        while ((entry = readdir(dir)) != NULL) {
+            // dot files are temp files still being written
+            if (entry->d_name[0] == '.') continue;
+            collect_clone(batch, arena_printf(&cmd_arena, "%s/%s", src, entry->d_name),
+                          arena_printf(&cmd_arena, "%s/%s", dest, entry->d_name), link);
+        }
+        closedir(dir);
+    } else if (S_ISREG(st.st_mode)) {
+        if (batch->count == batch->capacity) {
+            batch->capacity = batch->capacity ? batch->capacity * 2 : 1024;
+            batch->files = realloc(batch->files, batch->capacity * sizeof(struct clone_file));
+        }
+        struct clone_file *f = &batch->files[batch->count++];
+        memset(f, 0, sizeof(*f));
+        f->src = (char *) src;
+        f->dest = (char *) dest;
+        f->link = link;
+    }
+}
+
+// state copied as is; caches tied to the source's files are left behind
+static const char *clone_copied[] = {
+    "commits", "memories", "bitmaps", "HEAD", "index", "remote", "remote-commits", "remotes", "remote-groups",
+    "packed-memories", "config", "sparse", "history-index", "message-index", "message-index.log",
+    "commit-stats", NULL
+};
+
+void clone_repo(const char *src_dir, const char *dest_dir) {
+    char *src_state = arena_printf(&cmd_arena, "%s/%s", src_dir, MNEMOS_DIR);
+    struct stat st;
+    if (stat(arena_printf(&cmd_arena, "%s/objects", src_state), &st) != 0) {
+        printf("Error: %s is not a mnemos repository\n", src_dir);
+        return;
+    }
+    int created;
+    if (make_empty_dir(dest_dir, &created) != 0) {
+        if (errno == ENOTEMPTY) {
+            printf("Error: %s already exists and is not empty\n", dest_dir);
+        } else {
+            perror("Failed to create clone directory");
+        }
+        return;
+    }
+    char *dest_state = arena_printf(&cmd_arena, "%s/%s", dest_dir, MNEMOS_DIR);
+    if (mkdir(dest_state, 0755) != 0) {
+        printf("Error: %s already has a %s directory\n", dest_dir, MNEMOS_DIR);
+        return;
+    }
+
+    struct clone_batch batch = { NULL, 0, 0 };
+    collect_clone(&batch, arena_printf(&cmd_arena, "%s/objects", src_state),
+                  arena_printf(&cmd_arena, "%s/objects", dest_state), 1);
+    int object_count = batch.count;
+    for (int i = 0; clone_copied[i]; i++) {
+        collect_clone(&batch, arena_printf(&cmd_arena, "%s/%s", src_state, clone_copied[i]),
+                      arena_printf(&cmd_arena, "%s/%s", dest_state, clone_copied[i]), 0);
+    }
+    mkdir(arena_printf(&cmd_arena, "%s/commits", dest_state), 0755);
+
+    io_batch(batch.count, clone_one, &batch);
+
+    int linked = 0, failed = 0;
+    for (int i = 0; i < batch.count; i++) {
+        struct clone_file *f = &batch.files[i];
+        if (f->error) {
+            printf("Error: Failed to clone '%s': %s\n", f->src, strerror(f->error));
+            failed++;
+        }
+        linked += f->linked;
+    }
+    free(batch.files);
+    if (failed) {
+        printf("Clone incomplete, %d file%s failed.\n", failed, failed == 1 ? "" : "s");
+        exit(1);
+    }
+    printf("Cloned %d objects (%d linked) and %d state files into %s\n",
+           object_count, linked, batch.count - object_count, dest_dir);
+
+    // check out HEAD in the clone
+    if (chdir(dest_dir) != 0) {
+        perror("Failed to enter clone");
+        exit(1);
+    }
+    char head[HASH_SIZE];
+    if (read_hash_file(HEAD_FILE, head) == 0 && head[0]) {
+        revert_clean(head, NULL);
+    }
+}
+
+// read the hash a commit entry points to, -1 if unreadable
+int read_hash_file(const char *path, char *hash_out) {
+    FILE *f = fopen(path, "r");
+    if (!f) return -1;
+    int ok = fgets(hash_out, HASH_SIZE, f) != NULL;
+    fclose(f);
+    if (!ok) return -1;
+    hash_out[strcspn(hash_out, "\n")] = 0;
+    return 0;
+}
+
+// skip commit metadata files when walking a commit tree
+int is_commit_metadata(const char *name) {
+    return strcmp(name, "message") == 0 || strcmp(name, "timestamp") == 0;
+}
+
+void walk_tree_entries(const char *dir_path, const char *rel,
+                       void (*fn)(void *ctx, const char *path, const char *hash),
+                       void *ctx, struct arena *a) {
+    DIR *dir = opendir(dir_path);
+    if (!dir) return;
+
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) continue;
+        if (rel[0] == '\0' && is_commit_metadata(entry->d_name)) continue;
+
+        struct arena_mark mark = arena_save(a);
+        char *path = arena_printf(a, "%s/%s", dir_path, entry->d_name);
+        char *rel_path = rel[0] ? arena_printf(a, "%s/%s", rel, entry->d_name)
+                                : arena_strdup(a, entry->d_name);
+        struct stat st;
+        if (stat(path, &st) == 0) {
+            if (S_ISDIR(st.st_mode)) {
+                walk_tree_entries(path, rel_path, fn, ctx, a);
+            } else if (S_ISREG(st.st_mode)) {
+                char hash[HASH_SIZE];
+                if (read_hash_file(path, hash) == 0) {
+                    fn(ctx, rel_path, hash);
+                }
+            }
+        }
+        arena_restore(a, mark);
+    }
+    closedir(dir);
+}
+
+// call fn for every file in a commit tree with its path and object hash
+void for_each_tree_entry(const char *commit_dir,
+                         void (*fn)(void *ctx, const char *path, const char *hash),
+                         void *ctx, struct arena *a) {
+    walk_tree_entries(commit_dir, "", fn, ctx, a);
+}
+
+/*
+ * object list: every object name in objects/, sorted. Positions in this
+ * list are what gc's mark bitmap indexes.
+ */
+struct object_list {
+    char **names;
+    int count;
+};
+
+
+// a fan-out directory: two hex digits (objects themselves are longer)
+int is_fanout_dir(const char *name) {
+    return strlen(name) == 2 && isxdigit((unsigned char) name[0]) && isxdigit((unsigned char) name[1]);
+}
+
+void list_objects_in(struct object_list *list, int *capacity, const char *dir_path, const char *prefix,
+                     int level, struct arena *a) {
+    DIR *dir = opendir(dir_path);
+    if (!dir) return;
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+        // dot files are temp objects still being written
+        if (entry->d_name[0] == '.') continue;
+        if (level < OBJECT_FANOUT_MAX && is_fanout_dir(entry->d_name)) {
+            // not from an arena: a may be cmd_arena, holding the names
+            char sub_path[OBJECT_PATH_SIZE], sub_prefix[2 * OBJECT_FANOUT_MAX + 1];
+            snprintf(sub_path, sizeof(sub_path), "%s/%.2s", dir_path, entry->d_name);
+            snprintf(sub_prefix, sizeof(sub_prefix), "%s%.2s", prefix, entry->d_name);
+            list_objects_in(list, capacity, sub_path, sub_prefix, level + 1, a);
+            continue;
+        }
+        if (list->count == *capacity) {
+            *capacity = *capacity ? *capacity * 2 : 1024;
+            list->names = realloc(list->names, *capacity * sizeof(char *));
+        }
+        list->names[list->count++] = arena_printf(a, "%s%s", prefix, entry->d_name);
+    }
+    closedir(dir);
+}
+
+// every layout at once; an object being moved by fanout is listed once
+void list_objects(struct object_list *list, struct arena *a) {
+    list->names = NULL;
+    list->count = 0;
+    int capacity = 0;
+    list_objects_in(list, &capacity, OBJECTS_DIR, "", 0, a);
+    qsort(list->names, list->count, sizeof(char *), compare_names);
+    int kept = 0;
+    for (int i = 0; i < list->count; i++) {
+        if (kept > 0 && strcmp(list->names[kept - 1], list->names[i]) == 0) continue;
+        list->names[kept++] = list->names[i];
+    }
+    list->count = kept;
+}
+
+int find_object(const struct object_list *list, const char *hash) {
+    char **found = bsearch(&hash, list->names, list->count, sizeof(char *), compare_names);
+    return found ? (int) (found - list->names) : -1;
+}
+
+// list of commit ids in commits/, unsorted
+int list_commit_ids(char ***ids_out, struct arena *a) {
+    char **ids = NULL;
+    int count = 0, capacity = 0;
+    DIR *dir = opendir(COMMITS_DIR);
+    if (dir) {
+        struct dirent *entry;
+        while ((entry = readdir(dir)) != NULL) {
+            if (entry->d_name[0] == '.') continue;
+            if (count == capacity) {
+                capacity = capacity ? capacity * 2 : 256;
+                ids = realloc(ids, capacity * sizeof(char *));
+            }
+            ids[count++] = arena_strdup(a, entry->d_name);
+        }
+        closedir(dir);
+    }
+    *ids_out = ids;
+    return count;
+}
+
+/*
+ * tree lists: a commit tree (or a subtree of one) as a path-sorted array,
+ * so two trees can be compared in one merge pass.
+ */
+struct tree_entry {
+    char *path;
+    char hash[HASH_SIZE];
+};
+
+struct tree_list {
+    struct tree_entry *entries;
+    int count;
+    int capacity;
+    struct arena arena;     // own arena: the walk rewinds the caller's per entry
+};
+
+void tree_list_add(void *ctx, const char *path, const char *hash) {
+    struct tree_list *t = ctx;
+    if (t->count == t->capacity) {
+        t->capacity = t->capacity ? t->capacity * 2 : 256;
+        t->entries = realloc(t->entries, t->capacity * sizeof(struct tree_entry));
+    }
+    struct tree_entry *e = &t->entries[t->count++];
+    e->path = arena_strdup(&t->arena, path);
+    strcpy(e->hash, hash);
+}
+
+int compare_tree_entries(const void *a, const void *b) {
+    return strcmp(((const struct tree_entry *) a)->path, ((const struct tree_entry *) b)->path);
+}
+
+// entries of commit (or only those under prefix, "" for all), sorted by path
+void load_tree(struct tree_list *t, const char *commit, const char *prefix, struct arena *a) {
+    memset(t, 0, sizeof(*t));
+    if (!commit || !commit[0]) return;
+
+    char *commit_dir = arena_printf(a, "%s/%s", COMMITS_DIR, commit);
+    if (!prefix[0]) {
+        for_each_tree_entry(commit_dir, tree_list_add, t, a);
+    } else {
+        char *path = arena_printf(a, "%s/%s", commit_dir, prefix);
+        struct stat st;
+        if (stat(path, &st) != 0) return;
+        if (S_ISDIR(st.st_mode)) {
+            walk_tree_entries(path, prefix, tree_list_add, t, a);
+        } else {
+            char hash[HASH_SIZE];
+            if (read_hash_file(path, hash) == 0) tree_list_add(t, prefix, hash);
+        }
+    }
+    qsort(t->entries, t->count, sizeof(struct tree_entry), compare_tree_entries);
+}
+
+void free_tree(struct tree_list *t) {
+    free(t->entries);
+    arena_free(&t->arena);
+}
+
+/*
+ * diff_trees: call fn for every path that differs between two commits.
+ * old_hash is NULL for added paths, new_hash NULL for removed ones. An
+ * empty old_commit compares against nothing, so everything is added.
+ * Returns how many paths differed.
+ */
+int diff_trees(const char *old_commit, const char *new_commit, const char *prefix,
+               void (*fn)(void *ctx, const char *path, const char *old_hash, const char *new_hash),
+               void *ctx, struct arena *a) {
+    struct arena_mark mark = arena_save(a);
+    struct tree_list old_tree, new_tree;
+    load_tree(&old_tree, old_commit, prefix, a);
+    load_tree(&new_tree, new_commit, prefix, a);
+
+    int changed = 0, i = 0, j = 0;
+    while (i < old_tree.count || j < new_tree.count) {
+        int cmp = i == old_tree.count ? 1 : j == new_tree.count ? -1
+                : strcmp(old_tree.entries[i].path, new_tree.entries[j].path);
+        if (cmp < 0) {
+            if (fn) fn(ctx, old_tree.entries[i].path, old_tree.entries[i].hash, NULL);
+            i++;
+            changed++;
+        } else if (cmp > 0) {
+            if (fn) fn(ctx, new_tree.entries[j].path, NULL, new_tree.entries[j].hash);
+            j++;
+            changed++;
+        } else {
+            if (strcmp(old_tree.entries[i].hash, new_tree.entries[j].hash) != 0) {
+                if (fn) fn(ctx, new_tree.entries[j].path, old_tree.entries[i].hash, new_tree.entries[j].hash);
+                changed++;
+            }
+            i++;
+            j++;
+        }
+    }
+    free_tree(&old_tree);
+    free_tree(&new_tree);
+    arena_restore(a, mark);
+    return changed;
+}
+
+/*
+ * history index: .mnemos/history-index has one line per commit,
+ *
+ *     <commit> <parent or -> <timestamp> <words> <bloom words in hex>
+ *
+ * where the Bloom filter holds every path the commit changed against its
+ * parent, plus each of their directories. "Did commit X touch src/foo.c?"
+ * is then a few bit tests; a hit is confirmed against the trees, a miss
+ * never needs them. Lines are appended by commit(); commits that arrived
+ * some other way are filled in (parent = previous by time) the next time
+ * the index is read. A later line for the same commit wins. The
+ * structures are declared at the top of the file.
+ */
+// "./src/lib/" -> "src/lib"
+char *normalize_history_path(const char *path, struct arena *a) {
+    while (strncmp(path, "./", 2) == 0) path += 2;
+    char *p = arena_strdup(a, path);
+    size_t len = strlen(p);
+    while (len > 1 && p[len - 1] == '/') p[--len] = '\0';
+    return p;
+}
+
+void bloom_bits(const char *key, size_t len, int words, uint32_t bits[BLOOM_HASHES]) {
+    uint32_t h1 = murmur3_32(key, len, 0x9747b28cu);
+    uint32_t h2 = murmur3_32(key, len, h1) | 1;
+    uint32_t total = (uint32_t) words * 64;
+    for (int i = 0; i < BLOOM_HASHES; i++) {
+        bits[i] = (h1 + (uint32_t) i * h2) % total;
+    }
+}
+
+void bloom_add(uint64_t *bloom, int words, const char *key, size_t len) {
+    uint32_t bits[BLOOM_HASHES];
+    bloom_bits(key, len, words, bits);
+    for (int i = 0; i < BLOOM_HASHES; i++) bloom[bits[i] / 64] |= 1ULL << (bits[i] % 64);
+}
+
+// 0 means the commit certainly did not change path
+int bloom_maybe(const struct history_entry *e, const char *path) {
+    if (e->words == 0) return 1;
+    uint32_t bits[BLOOM_HASHES];
+    bloom_bits(path, strlen(path), e->words, bits);
+    for (int i = 0; i < BLOOM_HASHES; i++) {
+        if (!(e->bloom[bits[i] / 64] & (1ULL << (bits[i] % 64)))) return 0;
+    }
+    return 1;
+}
+
+int compare_history_entries(const void *a, const void *b) {
+    return strcmp(((const struct history_entry *) a)->commit, ((const struct history_entry *) b)->commit);
+}
+
+int compare_history_lines(const void *a, const void *b) {
+    const struct history_entry *x = a, *y = b;
+    int cmp = strcmp(x->commit, y->commit);
+    return cmp ? cmp : x->line - y->line;
+}
+
+struct history_entry *history_find(struct history *h, const char *commit) {
+    if (!commit || !commit[0] || h->count == 0) return NULL;
+    struct history_entry key;
+    snprintf(key.commit, sizeof(key.commit), "%s", commit);
+    return bsearch(&key, h->entries, h->count, sizeof(struct history_entry), compare_history_entries);
+}
+
+struct history_entry *history_append(struct history *h) {
+    if (h->count == h->capacity) {
+        h->capacity = h->capacity ? h->capacity * 2 : 256;
+        h->entries = realloc(h->entries, h->capacity * sizeof(struct history_entry));
+    }
+    struct history_entry *e = &h->entries[h->count++];
+    memset(e, 0, sizeof(*e));
+    return e;
+}
+
+// read the index as is, keeping the last line for each commit
+// add the entries in path to h, unsorted
+void history_read_file(struct history *h, const char *path) {
+    FILE *f = fopen(path, "r");
+    if (!f) return;
+
+    char *line = NULL;
+    size_t line_capacity = 0;
+    while (getline(&line, &line_capacity, f) != -1) {
+        char commit[HASH_SIZE], parent[HASH_SIZE];
+        long timestamp;
+        int words, offset;
+        if (sscanf(line, "%63s %63s %ld %d %n", commit, parent, &timestamp, &words, &offset) != 4 ||
+            words < 0 || strlen(line + offset) < (size_t) words * 16) {
+            continue;
+        }
+        struct history_entry *e = history_append(h);
+        strcpy(e->commit, commit);
+        strcpy(e->parent, strcmp(parent, "-") == 0 ? "" : parent);
+        e->timestamp = timestamp;
+        e->words = words;
+        e->line = h->count;
+        e->bloom = arena_alloc(&h->arena, (words + 1) * sizeof(uint64_t));
+        for (int i = 0; i < words; i++) {
+            char word[17];
+            memcpy(word, line + offset + i * 16, 16);
+            word[16] = '\0';
+            e->bloom[i] = strtoull(word, NULL, 16);
+        }
+    }
+    free(line);
+    fclose(f);
+}
+
+void history_sort(struct history *h) {
+    // duplicates end up in file order, keep the last one
+    qsort(h->entries, h->count, sizeof(struct history_entry), compare_history_lines);
+    int kept = 0;
+    for (int i = 0; i < h->count; i++) {
+        if (i + 1 < h->count && strcmp(h->entries[i].commit, h->entries[i + 1].commit) == 0) continue;
+        h->entries[kept++] = h->entries[i];
+    }
+    h->count = kept;
+}
+
+void history_read(struct history *h) {
+    memset(h, 0, sizeof(*h));
+    history_read_file(h, HISTORY_INDEX_FILE);
+    history_sort(h);
+}
+
+void history_free(struct history *h) {
+    free(h->entries);
+    arena_free(&h->arena);
+}
+
+struct bloom_build {
+    uint64_t *bloom;
+    int words;
+};
+
+void bloom_add_changed(void *ctx, const char *path, const char *old_hash, const char *new_hash) {
+    struct bloom_build *b = ctx;
+    (void) old_hash;
+    (void) new_hash;
+    // the path and every directory above it
+    size_t len = strlen(path);
+    bloom_add(b->bloom, b->words, path, len);
+    for (size_t i = len; i > 0; i--) {
+        if (path[i - 1] == '/') bloom_add(b->bloom, b->words, path, i - 1);
+    }
+}
+
+int count_path_keys(const char *path) {
+    int keys = 1;
+    for (const char *p = path; *p; p++) keys += *p == '/';
+    return keys;
+}
+
+void count_changed(void *ctx, const char *path, const char *old_hash, const char *new_hash) {
+    (void) old_hash;
+    (void) new_hash;
+    *(int *) ctx += count_path_keys(path);
+}
+
+// a filter sized for keys paths and directories
+void bloom_build_init(struct bloom_build *b, int keys) {
+    b->words = (keys * BLOOM_BITS_PER_PATH + 63) / 64;
+    if (b->words < 1) b->words = 1;
+    b->bloom = calloc(b->words, sizeof(uint64_t));
+}
+
+// append the line for commit with a filled filter, and free it
+void history_write_bloom(FILE *f, const char *commit, const char *parent, long timestamp,
+                         struct bloom_build *b) {
+    char *record = NULL;
+    size_t record_len = 0;
+    FILE *line = open_memstream(&record, &record_len);
+    fprintf(line, "%s %s %ld %d ", commit, parent[0] ? parent : "-", timestamp, b->words);
+    for (int i = 0; i < b->words; i++) fprintf(line, "%016llx", (unsigned long long) b->bloom[i]);
+    fprintf(line, "\n");
+    fclose(line);
+    append_record(f, record, record_len);
+    free(record);
+    free(b->bloom);
+    b->bloom = NULL;
+}
+
+// append the line for commit, diffed against parent ("" for none)
+void history_write_entry(FILE *f, const char *commit, const char *parent, long timestamp) {
+    struct arena_mark mark = arena_save(&cmd_arena);
+    int keys = 0;
+    diff_trees(parent, commit, "", count_changed, &keys, &cmd_arena);
+
+    struct bloom_build b;
+    bloom_build_init(&b, keys);
+    diff_trees(parent, commit, "", bloom_add_changed, &b, &cmd_arena);
+    history_write_bloom(f, commit, parent, timestamp, &b);
+    arena_restore(&cmd_arena, mark);
+}
+
+long read_commit_timestamp(const char *commit) {
+    char *path = arena_printf(&cmd_arena, "%s/%s/timestamp", COMMITS_DIR, commit);
+    FILE *f = fopen(path, "r");
+    long timestamp = 0;
+    if (f) {
+        if (fscanf(f, "%ld", &timestamp) != 1) timestamp = 0;
+        fclose(f);
+    }
+    return timestamp;
+}
+
+// called by commit() with the HEAD it replaced
+void history_index_commit(const char *commit, const char *parent) {
+    char own_parent[HASH_SIZE];
+    snprintf(own_parent, sizeof(own_parent), "%s", parent);
+
+    // a second commit in the same second replaces the first, keep its parent
+    if (strcmp(own_parent, commit) == 0) {
+        struct history h;
+        history_read(&h);
+        struct history_entry *e = history_find(&h, commit);
+        snprintf(own_parent, sizeof(own_parent), "%s", e ? e->parent : "");
+        history_free(&h);
+    }
+
+    FILE *f = fopen(HISTORY_INDEX_FILE, "a");
+    if (!f) return;
+    history_write_entry(f, commit, own_parent, read_commit_timestamp(commit));
+    fclose(f);
+}
+
+struct commit_time {
+    char *commit;
+    long timestamp;
+};
+
+int compare_commit_times(const void *a, const void *b) {
+    const struct commit_time *x = a, *y = b;
+    if (x->timestamp != y->timestamp) return x->timestamp < y->timestamp ? -1 : 1;
+    return strcmp(x->commit, y->commit);
+}
+
+// read the index, indexing commits it doesn't know yet
+void history_load(struct history *h) {
+    history_read(h);
+
+    char **ids;
+    int count = list_commit_ids(&ids, &cmd_arena);
+    int missing = 0;
+    for (int i = 0; i < count; i++) {
+        if (!history_find(h, ids[i])) missing++;
+    }
+
+    if (missing > 0) {
+        struct commit_time *order = malloc(count * sizeof(struct commit_time));
+        for (int i = 0; i < count; i++) {
+            struct history_entry *e = history_find(h, ids[i]);
+            order[i].commit = ids[i];
+            order[i].timestamp = e ? e->timestamp : read_commit_timestamp(ids[i]);
+        }
+        qsort(order, count, sizeof(struct commit_time), compare_commit_times);
+
+        // only a lock holder appends; without it (a writer is busy) the
+        // entries go to a file of this command's own and are read from there
+        int locked = repo_try_lock() == 0;
+        char temp_path[] = MNEMOS_DIR "/.tmp-history-XXXXXX";
+        FILE *f = NULL;
+        if (locked) {
+            f = fopen(HISTORY_INDEX_FILE, "a");
+        } else {
+            int fd = mkstemp(temp_path);
+            if (fd >= 0 && !(f = fdopen(fd, "w"))) close(fd);
+        }
+        if (f) {
+            for (int i = 0; i < count; i++) {
+                if (history_find(h, order[i].commit)) continue;
+                history_write_entry(f, order[i].commit, i > 0 ? order[i - 1].commit : "", order[i].timestamp);
+            }
+            fclose(f);
+            if (locked) {
+                history_free(h);
+                history_read(h);
+            } else {
+                history_read_file(h, temp_path);
+                history_sort(h);
+            }
+        }
+        if (locked) {
+            repo_unlock();
+        } else if (f) {
+            unlink(temp_path);
+        }
+        free(order);
+    }
+    free(ids);
+}
+
+// did commit really change path (file or directory) against its parent?
+int history_changed(const struct history_entry *e, const char *path) {
+    if (!bloom_maybe(e, path)) return 0;
+    return diff_trees(e->parent, e->commit, path, NULL, NULL, &cmd_arena) > 0;
+}
+
+// the newest commit at or before from that changed path, NULL if none
+const char *history_last_change(struct history *h, const char *path, const char *from) {
+    struct history_entry *e = history_find(h, from);
+    for (int steps = 0; e && steps <= h->count; steps++) {
+        if (history_changed(e, path)) return e->commit;
+        e = history_find(h, e->parent);
+    }
+    return NULL;
+}
+
+// 1 if path is certainly the same in older and newer, from the filters alone
+int history_unchanged_between(struct history *h, const char *path, const char *older, const char *newer) {
+    struct history_entry *e = history_find(h, newer);
+    for (int steps = 0; e && steps <= h->count; steps++) {
+        if (strcmp(e->commit, older) == 0) return 1;
+        if (bloom_maybe(e, path)) return 0;
+        e = history_find(h, e->parent);
+    }
+    return 0;
+}
+
+/*
+ * commit stats: .mnemos/commit-stats has one line per commit,
+ *
+ *     <commit> <parent or -> <files> <bytes> <added> <removed> <modified> <bytes in> <bytes out>
+ *
+ * files and bytes are the whole tree; bytes in are the new contents of
+ * added and modified files, bytes out the old contents of removed and
+ * modified ones. commit() derives its line from the hashes it just
+ * computed and its parent's totals, without reading a tree; `mnemos
+ * backfill-stats` diffs the trees of commits that have no line yet.
+ * A later line for the same commit wins. moments --stat only reads this
+ * file.
+ */
+int compare_commit_stats(const void *a, const void *b) {
+    return strcmp(((const struct commit_stat *) a)->commit, ((const struct commit_stat *) b)->commit);
+}
+
+int compare_commit_stat_lines(const void *a, const void *b) {
+    const struct commit_stat *x = a, *y = b;
+    int cmp = strcmp(x->commit, y->commit);
+    return cmp ? cmp : x->line - y->line;
+}
+
+// one line of the file, 0 if it is whole
+int commit_stat_parse(const char *line, struct commit_stat *e) {
+    memset(e, 0, sizeof(*e));
+    if (sscanf(line, "%63s %63s %ld %lld %ld %ld %ld %lld %lld", e->commit, e->parent, &e->files, &e->bytes,
+               &e->added, &e->removed, &e->modified, &e->bytes_in, &e->bytes_out) != 9) {
+        return -1;
+    }
+    if (strcmp(e->parent, "-") == 0) e->parent[0] = '\0';
+    return 0;
+}
+
+// file order, for writing the file back
+int compare_commit_stat_line_numbers(const void *a, const void *b) {
+    return ((const struct commit_stat *) a)->line - ((const struct commit_stat *) b)->line;
+}
+
+void commit_stats_read(struct commit_stats *s) {
+    memset(s, 0, sizeof(*s));
+    FILE *f = fopen(COMMIT_STATS_FILE, "r");
+    if (!f) return;
+
+    char *line = NULL;
+    size_t line_capacity = 0;
+    while (getline(&line, &line_capacity, f) != -1) {
+        struct commit_stat e;
+        if (commit_stat_parse(line, &e) != 0) continue;
+        if (s->count == s->capacity) {
+            s->capacity = s->capacity ? s->capacity * 2 : 256;
+            s->entries = realloc(s->entries, s->capacity * sizeof(struct commit_stat));
+        }
+        e.line = s->count;
+        s->entries[s->count++] = e;
+    }
+    free(line);
+    fclose(f);
+
+    // duplicates end up in file order, keep the last one
+    qsort(s->entries, s->count, sizeof(struct commit_stat), compare_commit_stat_lines);
+    int kept = 0;
+    for (int i = 0; i < s->count; i++) {
+        if (i + 1 < s->count && strcmp(s->entries[i].commit, s->entries[i + 1].commit) == 0) continue;
+        s->entries[kept++] = s->entries[i];
+    }
+    s->lines = s->count;
+    s->count = kept;
+}
+
+/*
+ * commit's line without reading the whole file: scan back from the end
+ * in blocks, the first match is the last line. commit() looks for its
+ * parent, whose line is nearly always the last one. -1 if it has none.
+ */
+#define COMMIT_STATS_SCAN_BLOCK 4096
+
+int commit_stats_find_last(const char *commit, struct commit_stat *out) {
+    if (!commit || !commit[0]) return -1;
+    int fd = open(COMMIT_STATS_FILE, O_RDONLY);
+    if (fd < 0) return -1;
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        return -1;
+    }
+
+    // buffer holds a block, then the start of a line the block after it cut off
+    size_t capacity = 2 * COMMIT_STATS_SCAN_BLOCK, carry = 0;
+    char *buffer = malloc(capacity);
+    int found = -1;
+    for (off_t end = st.st_size; end > 0 && found != 0;) {
+        off_t start = end > COMMIT_STATS_SCAN_BLOCK ? end - COMMIT_STATS_SCAN_BLOCK : 0;
+        size_t n = end - start;
+        if (n + carry > capacity) {
+            capacity = 2 * (n + carry);
+            buffer = realloc(buffer, capacity);
+        }
+        memmove(buffer + n, buffer, carry);
+        if (pread(fd, buffer, n, start) != (ssize_t) n) break;
+        size_t len = n + carry;
+
+        // whole lines, last first; the first one may go on in the block before
+        size_t line_end = len;
+        while (found != 0) {
+            size_t line_start = line_end;
+            while (line_start > 0 && buffer[line_start - 1] != '\n') line_start--;
+            if (line_start == 0 && start > 0) {
+                carry = line_end;
+                break;
+            }
+            char line[512];
+            snprintf(line, sizeof(line), "%.*s", (int) (line_end - line_start), buffer + line_start);
+            struct commit_stat e;
+            if (commit_stat_parse(line, &e) == 0 && strcmp(e.commit, commit) == 0) {
+                *out = e;
+                found = 0;
+            }
+            if (line_start == 0) break;
+            line_end = line_start - 1;
+        }
+        end = start;
+    }
+    free(buffer);
+    close(fd);
+    return found;
+}
+
+struct commit_stat *commit_stats_find(struct commit_stats *s, const char *commit) {
+    if (!commit || !commit[0] || s->count == 0) return NULL;
+    struct commit_stat key;
+    snprintf(key.commit, sizeof(key.commit), "%s", commit);
+    return bsearch(&key, s->entries, s->count, sizeof(struct commit_stat), compare_commit_stats);
+}
+
+void commit_stats_free(struct commit_stats *s) {
+    free(s->entries);
+}
+
+void commit_stat_append(FILE *f, const struct commit_stat *e) {
+    char record[512];
+    int len = snprintf(record, sizeof(record), "%s %s %ld %lld %ld %ld %ld %lld %lld\n", e->commit,
+                       e->parent[0] ? e->parent : "-", e->files, e->bytes, e->added, e->removed, e->modified,
+                       e->bytes_in, e->bytes_out);
+    append_record(f, record, len);
+}
+
+long long object_size(const char *hash) {
+    char path[OBJECT_PATH_SIZE];
+    object_find(path, hash);
+    struct stat st;
+    return stat(path, &st) == 0 ? st.st_size : 0;
+}
+
+void stat_add_changed(void *ctx, const char *path, const char *old_hash, const char *new_hash) {
+    struct commit_stat *e = ctx;
+    (void) path;
+    if (old_hash && new_hash) {
+        e->modified++;
+    } else if (new_hash) {
+        e->added++;
+    } else {
+        e->removed++;
+    }
+    if (new_hash) e->bytes_in += object_size(new_hash);
+    if (old_hash) e->bytes_out += object_size(old_hash);
+}
+
+void stat_add_total(void *ctx, const char *path, const char *hash) {
+    struct commit_stat *e = ctx;
+    (void) path;
+    e->files++;
+    e->bytes += object_size(hash);
+}
+
+// the changes of e->commit against e->parent, from their trees
+void commit_stat_diff(struct commit_stat *e, struct arena *a) {
+    e->added = e->removed = e->modified = 0;
+    e->bytes_in = e->bytes_out = 0;
+    diff_trees(e->parent, e->commit, "", stat_add_changed, e, a);
+}
+
+// totals follow from the parent's, else the tree is counted
+void commit_stat_totals(struct commit_stat *e, const struct commit_stat *parent, struct arena *a) {
+    if (parent || !e->parent[0]) {
+        e->files = (parent ? parent->files : 0) + e->added - e->removed;
+        e->bytes = (parent ? parent->bytes : 0) + e->bytes_in - e->bytes_out;
+        return;
+    }
+    e->files = 0;
+    e->bytes = 0;
+    for_each_tree_entry(arena_printf(a, "%s/%s", COMMITS_DIR, e->commit), stat_add_total, e, a);
+}
+
+/*
+ * called by commit() with what it saw: e has the new tree's totals and
+ * its added and modified files against HEAD (e->parent), matched and
+ * matched_bytes how many of its files HEAD had and their old size. The
+ * rest of HEAD was removed.
+ */
+void commit_stats_commit(struct commit_stat *e, long matched, long long matched_bytes) {
+    struct commit_stat parent_stat;
+    struct commit_stat *parent = commit_stats_find_last(e->parent, &parent_stat) == 0 ? &parent_stat : NULL;
+
+    if (strcmp(e->parent, e->commit) == 0) {
+        // a second commit in the same second replaces the first, diff against its parent
+        snprintf(e->parent, sizeof(e->parent), "%.*s", (int) sizeof(e->parent) - 1,
+                 parent ? parent->parent : "");
+        struct arena_mark mark = arena_save(&cmd_arena);
+        commit_stat_diff(e, &cmd_arena);
+        arena_restore(&cmd_arena, mark);
+    } else if (parent) {
+        e->removed = parent->files - matched;
+        e->bytes_out += parent->bytes - matched_bytes;
+    } else if (e->parent[0]) {
+        // HEAD came from elsewhere and has no line, so nothing to subtract from
+        struct arena_mark mark = arena_save(&cmd_arena);
+        commit_stat_diff(e, &cmd_arena);
+        arena_restore(&cmd_arena, mark);
+    }
+
+    FILE *f = fopen(COMMIT_STATS_FILE, "a");
+    if (!f) return;
+    commit_stat_append(f, e);
+    fclose(f);
+}
+
+void commit_stat_one(void *ctx, int i) {
+    struct commit_stat *jobs = ctx;
+    struct arena a = {0};
+    commit_stat_diff(&jobs[i], &a);
+    arena_free(&a);
+}
+
+// stats for every commit that has none, diffs on all cores
+void backfill_stats() {
+    struct commit_stats s;
+    commit_stats_read(&s);
+    struct history h;
+    history_load(&h);
+
+    // oldest first, so a parent's totals are known before its children's
+    struct commit_time *order = malloc((h.count + 1) * sizeof(struct commit_time));
+    int count = 0;
+    for (int i = 0; i < h.count; i++) {
+        if (commit_stats_find(&s, h.entries[i].commit)) continue;
+        order[count].commit = h.entries[i].commit;
+        order[count++].timestamp = h.entries[i].timestamp;
+    }
+    qsort(order, count, sizeof(struct commit_time), compare_commit_times);
+
+    struct commit_stat *jobs = calloc(count + 1, sizeof(struct commit_stat));
+    for (int i = 0; i < count; i++) {
+        snprintf(jobs[i].commit, sizeof(jobs[i].commit), "%s", order[i].commit);
+        snprintf(jobs[i].parent, sizeof(jobs[i].parent), "%s", history_find(&h, order[i].commit)->parent);
+    }
+    parallel_for(count, commit_stat_one, jobs);
+
+    // lines a same-second commit replaced only pile up: rewrite without them while here
+    int compact = s.lines > s.count;
+    struct atomic_file af;
+    FILE *f = NULL;
+    if (compact && (f = atomic_begin(&af, COMMIT_STATS_FILE))) {
+        struct commit_stat *kept = malloc((s.count + 1) * sizeof(struct commit_stat));
+        memcpy(kept, s.entries, s.count * sizeof(struct commit_stat));
+        qsort(kept, s.count, sizeof(struct commit_stat), compare_commit_stat_line_numbers);
+        for (int i = 0; i < s.count; i++) commit_stat_append(f, &kept[i]);
+        free(kept);
+    } else if (!compact && count) {
+        f = fopen(COMMIT_STATS_FILE, "a");
+    }
+    if ((compact || count) && !f) {
+        perror("Failed to write commit stats");
+        exit(1);
+    }
+    for (int i = 0; i < count; i++) {
+        const struct commit_stat *parent = commit_stats_find(&s, jobs[i].parent);
+        for (int j = i - 1; !parent && j >= 0; j--) {
+            if (strcmp(jobs[j].commit, jobs[i].parent) == 0) parent = &jobs[j];
+        }
+        struct arena_mark mark = arena_save(&cmd_arena);
+        commit_stat_totals(&jobs[i], parent, &cmd_arena);
+        arena_restore(&cmd_arena, mark);
+        commit_stat_append(f, &jobs[i]);
+    }
+    if (compact && atomic_end(&af) != 0) {
+        perror("Failed to write commit stats");
+        exit(1);
+    } else if (!compact && f) {
+        fclose(f);
+    }
+    printf("Recorded stats for %d commits (%d already had them).\n", count, s.count);
+    if (compact) printf("Dropped %d replaced lines.\n", s.lines - s.count);
+
+    free(jobs);
+    free(order);
+    history_free(&h);
+    commit_stats_free(&s);
+}
+
+void print_moment(const char *commit, long timestamp) {
+    char message[256] = "No message";
+    char *message_path = arena_printf(&cmd_arena, "%s/%s/message", COMMITS_DIR, commit);
+    FILE *f = fopen(message_path, "r");
+    if (f) {
+        if (fgets(message, sizeof(message), f)) message[strcspn(message, "\n")] = 0;
+        fclose(f);
+    }
+    time_t t = timestamp;
+    printf("Commit: %s | Time: %s | Message: %s\n", commit, ctime(&t), message);
+}
+
+int compare_history_newest(const void *a, const void *b) {
+    const struct history_entry *x = *(struct history_entry *const *) a;
+    const struct history_entry *y = *(struct history_entry *const *) b;
+    if (x->timestamp != y->timestamp) return x->timestamp > y->timestamp ? -1 : 1;
+    return strcmp(y->commit, x->commit);
+}
+
+/*
+ * rename and copy detection between two commits.
+ *
+ * Exact matches come first: an added path whose object hash equals a
+ * removed one is a rename, equal to any other old path a copy. What is
+ * left is compared by content: every candidate gets a MinHash sketch of
+ * its lines, and locality-sensitive hashing over bands of the sketch
+ * only pairs up files that share a band, instead of comparing every
+ * added file with every removed one.
+ */
+#define MINHASH_SIZE 64
+#define LSH_BANDS 16
+#define LSH_ROWS (MINHASH_SIZE / LSH_BANDS)
+#define RENAME_THRESHOLD 50     // percent of matching sketch slots
+
+struct change {
+    char kind;              // 'A', 'D', 'M', 'R' or 'C'
+    char *path;             // new path, old one for 'D'
+    char *old_path;         // source of 'R' and 'C'
+    char old_hash[HASH_SIZE];
+    char new_hash[HASH_SIZE];
+    int similarity;         // percent, for 'R' and 'C'
+};
+
+struct change_set {
+    struct change *items;
+    int count;
+    int capacity;
+    struct arena arena;
+};
+
+struct change *change_add(struct change_set *set, char kind, const char *path,
+                          const char *old_hash, const char *new_hash) {
+    if (set->count == set->capacity) {
+        set->capacity = set->capacity ? set->capacity * 2 : 64;
+        set->items = realloc(set->items, set->capacity * sizeof(struct change));
+    }
+    struct change *c = &set->items[set->count++];
+    memset(c, 0, sizeof(*c));
+    c->kind = kind;
+    c->path = arena_strdup(&set->arena, path);
+    if (old_hash) strcpy(c->old_hash, old_hash);
+    if (new_hash) strcpy(c->new_hash, new_hash);
+    return c;
+}
+
+void collect_change(void *ctx, const char *path, const char *old_hash, const char *new_hash) {
+    change_add(ctx, !old_hash ? 'A' : !new_hash ? 'D' : 'M', path, old_hash, new_hash);
+}
+
+// one side of an inexact match: a file and its sketch
+struct sketch {
+    struct change *change;
+    const char *hash;       // object to read
+    int is_source;
+    int usable;             // readable, not empty, not too large
+    uint32_t mins[MINHASH_SIZE];
+};
+
+struct sketch_batch {
+    struct sketch *items;
+    long long max_size;
+};
+
+uint32_t minhash_mix(uint32_t h, int i) {
+    uint64_t x = ((uint64_t) h << 32 | (uint32_t) i) * 0x9e3779b97f4a7c15ULL;
+    x ^= x >> 29;
+    x *= 0xbf58476d1ce4e5b9ULL;
+    x ^= x >> 32;
+    return (uint32_t) x;
+}
+
+// worker: MinHash over the object's lines
+void sketch_one(void *ctx, int i) {
+    struct sketch_batch *batch = ctx;
+    struct sketch *s = &batch->items[i];
+    char object_path[OBJECT_PATH_SIZE];
+    object_find(object_path, s->hash);
+
+    struct stat st;
+    if (stat(object_path, &st) != 0 || st.st_size == 0 || st.st_size >= batch->max_size) return;
+    FILE *f = fopen(object_path, "r");
+    if (!f) return;
+
+    for (int k = 0; k < MINHASH_SIZE; k++) s->mins[k] = UINT32_MAX;
+    char *line = NULL;
+    size_t line_capacity = 0;
+    ssize_t len;
+    while ((len = getline(&line, &line_capacity, f)) != -1) {
+        uint32_t h = murmur3_32(line, len, 0);
+        for (int k = 0; k < MINHASH_SIZE; k++) {
+            uint32_t v = minhash_mix(h, k);
+            if (v < s->mins[k]) s->mins[k] = v;
+        }
+    }
+    free(line);
+    fclose(f);
+    s->usable = 1;
+}
+
+const char *path_basename(const char *path) {
+    const char *slash = strrchr(path, '/');
+    return slash ? slash + 1 : path;
+}
+
+int sketch_similarity(const struct sketch *a, const struct sketch *b) {
+    int same = 0;
+    for (int k = 0; k < MINHASH_SIZE; k++) same += a->mins[k] == b->mins[k];
+    return same * 100 / MINHASH_SIZE;
+}
+
+struct band_key {
+    uint32_t key;
+    int sketch;
+};
+
+int compare_band_keys(const void *a, const void *b) {
+    const struct band_key *x = a, *y = b;
+    if (x->key != y->key) return x->key < y->key ? -1 : 1;
+    return x->sketch - y->sketch;
+}
+
+struct match {
+    int source;
+    int dest;
+    int similarity;
+    int same_name;          // equal basenames win ties
+};
+
+int compare_matches(const void *a, const void *b) {
+    const struct match *x = a, *y = b;
+    if (x->similarity != y->similarity) return y->similarity - x->similarity;
+    if (x->same_name != y->same_name) return y->same_name - x->same_name;
+    if (x->dest != y->dest) return x->dest - y->dest;
+    return x->source - y->source;
+}
+
+struct hash_ref {
+    const char *hash;
+    const char *path;
+    struct change *change;  // removed entry, NULL for unchanged paths
+};
+
+int compare_hash_refs(const void *a, const void *b) {
+    const struct hash_ref *x = a, *y = b;
+    int cmp = strcmp(x->hash, y->hash);
+    return cmp ? cmp : strcmp(x->path, y->path);
+}
+
+// pair every added path with the removed one holding the same object
+void exact_renames(struct change_set *set, const char *old_commit) {
+    struct tree_list old_tree;
+    load_tree(&old_tree, old_commit, "", &cmd_arena);
+
+    // tree and changes are both in path order, so one pass links them
+    struct hash_ref *refs = malloc((old_tree.count + 1) * sizeof(struct hash_ref));
+    int ref_count = 0;
+    for (int i = 0, j = 0; i < old_tree.count; i++) {
+        refs[ref_count].hash = old_tree.entries[i].hash;
+        refs[ref_count].path = old_tree.entries[i].path;
+        refs[ref_count].change = NULL;
+        while (j < set->count && strcmp(set->items[j].path, refs[ref_count].path) < 0) j++;
+        if (j < set->count && set->items[j].kind == 'D' &&
+            strcmp(set->items[j].path, refs[ref_count].path) == 0) {
+            refs[ref_count].change = &set->items[j];
+        }
+        ref_count++;
+    }
+    qsort(refs, ref_count, sizeof(struct hash_ref), compare_hash_refs);
+
+    // renames first, so a removed file goes to one added path...
+    for (int pass = 0; pass < 2; pass++) {
+        for (int i = 0; i < set->count; i++) {
+            struct change *c = &set->items[i];
+            if (c->kind != 'A') continue;
+            struct hash_ref key = { c->new_hash, "", NULL };
+            int lo = 0, hi = ref_count;
+            while (lo < hi) {
+                int mid = (lo + hi) / 2;
+                if (compare_hash_refs(&refs[mid], &key) < 0) lo = mid + 1; else hi = mid;
+            }
+            for (int j = lo; j < ref_count && strcmp(refs[j].hash, c->new_hash) == 0; j++) {
+                struct change *removed = refs[j].change;
+                if (pass == 0 && (!removed || removed->kind != 'D')) continue;
+                // ...and the rest of the matches are copies
+                c->kind = pass == 0 ? 'R' : 'C';
+                c->old_path = arena_strdup(&set->arena, refs[j].path);
+                strcpy(c->old_hash, refs[j].hash);
+                c->similarity = 100;
+                if (pass == 0) removed->kind = 0;
+                break;
+            }
+        }
+    }
+    free(refs);
+    free_tree(&old_tree);
+}
+
+// pair what's left by content, through MinHash and LSH bands
+void similar_renames(struct change_set *set) {
+    struct sketch_batch batch;
+    batch.max_size = large_file_threshold();
+    batch.items = malloc((set->count + 1) * sizeof(struct sketch));
+    int count = 0;
+    for (int i = 0; i < set->count; i++) {
+        struct change *c = &set->items[i];
+        if (c->kind != 'A' && c->kind != 'D' && c->kind != 'M') continue;
+        struct sketch *s = &batch.items[count++];
+        memset(s, 0, sizeof(*s));
+        s->change = c;
+        s->is_source = c->kind != 'A';
+        s->hash = s->is_source ? c->old_hash : c->new_hash;
+    }
+    parallel_for(count, sketch_one, &batch);
+
+    // files sharing all rows of any band become candidates
+    struct band_key *keys = malloc((count * LSH_BANDS + 1) * sizeof(struct band_key));
+    struct match *matches = NULL;
+    int match_count = 0, match_capacity = 0;
+    for (int band = 0; band < LSH_BANDS; band++) {
+        int key_count = 0;
+        for (int i = 0; i < count; i++) {
+            if (!batch.items[i].usable) continue;
+            keys[key_count].key = murmur3_32((const char *) &batch.items[i].mins[band * LSH_ROWS],
+                                             LSH_ROWS * sizeof(uint32_t), band);
+            keys[key_count].sketch = i;
+            key_count++;
+        }
+        qsort(keys, key_count, sizeof(struct band_key), compare_band_keys);
+
+        for (int start = 0; start < key_count;) {
+            int end = start;
+            while (end < key_count && keys[end].key == keys[start].key) end++;
+            for (int i = start; i < end; i++) {
+                struct sketch *dest = &batch.items[keys[i].sketch];
+                if (dest->is_source) continue;
+                for (int j = start; j < end; j++) {
+                    struct sketch *source = &batch.items[keys[j].sketch];
+                    if (!source->is_source) continue;
+                    int similarity = sketch_similarity(source, dest);
+                    if (similarity < RENAME_THRESHOLD) continue;
+                    if (match_count == match_capacity) {
+                        match_capacity = match_capacity ? match_capacity * 2 : 64;
+                        matches = realloc(matches, match_capacity * sizeof(struct match));
+                    }
+                    matches[match_count].source = keys[j].sketch;
+                    matches[match_count].dest = keys[i].sketch;
+                    matches[match_count].similarity = similarity;
+                    matches[match_count].same_name = strcmp(path_basename(source->change->path),
+                                                            path_basename(dest->change->path)) == 0;
+                    match_count++;
+                }
+            }
+            start = end;
+        }
+    }
+    free(keys);
+
+    // best pairs first: renames of removed files, then copies of anything
+    qsort(matches, match_count, sizeof(struct match), compare_matches);
+    for (int pass = 0; pass < 2; pass++) {
+        for (int i = 0; i < match_count; i++) {
+            struct change *dest = batch.items[matches[i].dest].change;
+            struct change *source = batch.items[matches[i].source].change;
+            if (dest->kind != 'A') continue;
+            int renamed = source->kind == 'D';
+            if (pass == 0 && !renamed) continue;
+            dest->kind = renamed ? 'R' : 'C';
+            dest->old_path = arena_strdup(&set->arena, source->path);
+            strcpy(dest->old_hash, source->old_hash);
+            // 100% is kept for identical objects, a sketch only estimates
+            dest->similarity = matches[i].similarity < 100 ? matches[i].similarity : 99;
+            if (renamed) source->kind = 0;
+        }
+    }
+    free(matches);
+    free(batch.items);
+}
+
+int compare_changes(const void *a, const void *b) {
+    return strcmp(((const struct change *) a)->path, ((const struct change *) b)->path);
+}
+
+// changes from old_commit to new_commit, renames and copies folded in
+void detect_changes(const char *old_commit, const char *new_commit, struct change_set *set) {
+    memset(set, 0, sizeof(*set));
+    // comes out in path order, exact_renames relies on it
+    diff_trees(old_commit, new_commit, "", collect_change, set, &cmd_arena);
+    exact_renames(set, old_commit);
+    similar_renames(set);
+
+    // drop removed entries that became a rename source
+    int kept = 0;
+    for (int i = 0; i < set->count; i++) {
+        if (set->items[i].kind) set->items[kept++] = set->items[i];
+    }
+    set->count = kept;
+    qsort(set->items, set->count, sizeof(struct change), compare_changes);
+}
+
+void free_changes(struct change_set *set) {
+    free(set->items);
+    arena_free(&set->arena);
+}
+
+/*
+ * detect_renames: the renames from old_commit to new_commit as pairs of
+ * new path and old path, sorted by new path so bsearch with compare_names
+ * finds a pair by its new path. For code ahead of struct change.
+ */
+int detect_renames(const char *old_commit, const char *new_commit, char ***pairs_out, struct arena *a) {
+    struct change_set set;
+    detect_changes(old_commit, new_commit, &set);
+    char **pairs = arena_alloc(a, (2 * set.count + 1) * sizeof(char *));
+    int count = 0;
+    for (int i = 0; i < set.count; i++) {
+        if (set.items[i].kind != 'R') continue;
+        pairs[2 * count] = arena_strdup(a, set.items[i].path);
+        pairs[2 * count + 1] = arena_strdup(a, set.items[i].old_path);
+        count++;
+    }
+    free_changes(&set);
+    *pairs_out = pairs;
+    return count;
+}
+
+// mnemos changes <old> <new>
+void show_changes(const char *old_commit, const char *new_commit) {
+    const char *commits[2] = { old_commit, new_commit };
+    for (int i = 0; i < 2; i++) {
+        struct stat st;
+        if (stat(arena_printf(&cmd_arena, "%s/%s", COMMITS_DIR, commits[i]), &st) != 0) {
+            printf("Error: Commit %s not found.\n", commits[i]);
+            return;
+        }
+    }
+
+    struct change_set set;
+    detect_changes(old_commit, new_commit, &set);
+    for (int i = 0; i < set.count; i++) {
+        struct change *c = &set.items[i];
+        if (c->kind == 'R' || c->kind == 'C') {
+            printf("%c %3d%% %s -> %s\n", c->kind, c->similarity, c->old_path, c->path);
+        } else {
+            printf("%c      %s\n", c->kind, c->path);
+        }
+    }
+    if (set.count == 0) printf("No changes between %s and %s\n", old_commit, new_commit);
+    free_changes(&set);
+}
+
+/*
+ * log: commits that changed a path, newest first. Most commits are
+ * ruled out by their Bloom filter without opening their trees. With
+ * follow, a commit that added the path is checked for a rename and the
+ * walk goes on under the old name.
+ */
+void log_path(const char *path, int follow) {
+    struct history h;
+    history_load(&h);
+    char *key = normalize_history_path(path, &cmd_arena);
+
+    struct history_entry **order = malloc((h.count + 1) * sizeof(struct history_entry *));
+    for (int i = 0; i < h.count; i++) order[i] = &h.entries[i];
+    qsort(order, h.count, sizeof(struct history_entry *), compare_history_newest);
+
+    int shown = 0;
+    for (int i = 0; i < h.count; i++) {
+        if (!history_changed(order[i], key)) continue;
+        print_moment(order[i]->commit, order[i]->timestamp);
+        shown++;
+
+        struct stat st;
+        if (!follow || !order[i]->parent[0] ||
+            stat(arena_printf(&cmd_arena, "%s/%s/%s", COMMITS_DIR, order[i]->parent, key), &st) == 0) {
+            continue;
+        }
+        struct change_set set;
+        detect_changes(order[i]->parent, order[i]->commit, &set);
+        for (int j = 0; j < set.count; j++) {
+            if (set.items[j].kind == 'R' && strcmp(set.items[j].path, key) == 0) {
+                printf("  (renamed from %s, %d%% similar)\n", set.items[j].old_path, set.items[j].similarity);
+                key = arena_strdup(&cmd_arena, set.items[j].old_path);
+                break;
+            }
+        }
+        free_changes(&set);
+    }
+    if (shown == 0) printf("No moments changed %s\n", key);
+
+    free(order);
+    history_free(&h);
+}
+
+/*
+ * message index: full-text search over commit messages.
+ *
+ * .mnemos/message-index holds one line per term, sorted by term,
+ *
+ *     <term> <commit> <commit> ...
+ *
+ * with commits in commit order. The line for "*" lists every commit the
+ * file covers. It is searched in place with a binary search over lines.
+ * New commits go to .mnemos/message-index.log as "<commit> <term>..."
+ * lines, which are folded into the main file once there are enough of
+ * them. Hits are checked against the message itself, so a commit that
+ * was replaced within the same second never shows stale terms.
+ * .mnemos/message-index.seen holds the mtime of commits/ at the last
+ * check for unindexed commits, so that check is skipped until it moves.
+ */
+#define MESSAGE_INDEX_FILE ".mnemos/message-index"
+#define MESSAGE_LOG_FILE ".mnemos/message-index.log"
+#define MESSAGE_SEEN_FILE ".mnemos/message-index.seen"
+#define MESSAGE_LOG_MAX 256
+#define MESSAGE_ALL_TERM "*"
+
+// commit ids are hex timestamps, shorter is older
+int compare_commit_ids(const char *a, const char *b) {
+    size_t la = strlen(a), lb = strlen(b);
+    if (la != lb) return la < lb ? -1 : 1;
+    return strcmp(a, b);
+}
+
+int compare_commit_id_ptrs(const void *a, const void *b) {
+    return compare_commit_ids(*(char *const *) a, *(char *const *) b);
+}
+
+// lowercase alphanumeric words of text, at least two characters long
+int tokenize_message(const char *text, char ***terms_out, struct arena *a) {
+    char **terms = NULL;
+    int count = 0, capacity = 0;
+    const char *p = text;
+    while (*p) {
+        while (*p && !isalnum((unsigned char) *p)) p++;
+        const char *start = p;
+        while (*p && isalnum((unsigned char) *p)) p++;
+        size_t len = p - start;
+        if (len < 2) continue;
+
+        char *term = arena_alloc(a, len + 1);
+        for (size_t i = 0; i < len; i++) term[i] = tolower((unsigned char) start[i]);
+        term[len] = '\0';
+
+        int seen = 0;
+        for (int i = 0; i < count && !seen; i++) seen = strcmp(terms[i], term) == 0;
+        if (seen) continue;
+        if (count == capacity) {
+            capacity = capacity ? capacity * 2 : 16;
+            terms = realloc(terms, capacity * sizeof(char *));
+        }
+        terms[count++] = term;
+    }
+    *terms_out = terms;
+    return count;
+}
+
+// the message as stored, without the "message: " prefix
+char *read_commit_message(const char *commit, struct arena *a) {
+    char *path = arena_printf(a, "%s/%s/message", COMMITS_DIR, commit);
+    FILE *f = fopen(path, "r");
+    if (!f) return NULL;
+    char *line = NULL;
+    size_t line_capacity = 0;
+    char *message = NULL;
+    if (getline(&line, &line_capacity, f) != -1) {
+        line[strcspn(line, "\n")] = 0;
+        message = arena_strdup(a, strncmp(line, "message: ", 9) == 0 ? line + 9 : line);
+    }
+    free(line);
+    fclose(f);
+    return message;
+}
+
+void message_log_append(FILE *log, const char *commit, const char *message) {
+    struct arena_mark mark = arena_save(&cmd_arena);
+    char **terms;
+    int count = tokenize_message(message ? message : "", &terms, &cmd_arena);
+    char *record = NULL;
+    size_t record_len = 0;
+    FILE *line = open_memstream(&record, &record_len);
+    fprintf(line, "%s", commit);
+    for (int i = 0; i < count; i++) fprintf(line, " %s", terms[i]);
+    fprintf(line, "\n");
+    fclose(line);
+    append_record(log, record, record_len);
+    free(record);
+    free(terms);
+    arena_restore(&cmd_arena, mark);
+}
+
+struct term_posting {
+    char *term;
+    char *commit;
+};
+
+int compare_term_postings(const void *a, const void *b) {
+    const struct term_posting *x = a, *y = b;
+    int cmp = strcmp(x->term, y->term);
+    return cmp ? cmp : compare_commit_ids(x->commit, y->commit);
+}
+
+struct posting_list {
+    struct term_posting *items;
+    int count;
+    int capacity;
+};
+
+void posting_add(struct posting_list *l, char *term, char *commit) {
+    if (l->count == l->capacity) {
+        l->capacity = l->capacity ? l->capacity * 2 : 1024;
+        l->items = realloc(l->items, l->capacity * sizeof(struct term_posting));
+    }
+    l->items[l->count].term = term;
+    l->items[l->count].commit = commit;
+    l->count++;
+}
+
+// split "<first> <rest> <rest>..." in place, calling fn for each rest word
+void split_words(char *line, void (*fn)(void *ctx, char *first, char *word), void *ctx) {
+    line[strcspn(line, "\n")] = 0;
+    char *save = NULL;
+    char *first = strtok_r(line, " ", &save);
+    if (!first) return;
+    char *word;
+    while ((word = strtok_r(NULL, " ", &save)) != NULL) fn(ctx, first, word);
+    fn(ctx, first, NULL);
+}
+
+struct fold_ctx {
+    struct posting_list *list;
+    struct arena *arena;
+    int from_log;
+};
+
+void fold_word(void *ctx, char *first, char *word) {
+    struct fold_ctx *f = ctx;
+    if (f->from_log) {
+        // "<commit> <term>...", the NULL call marks the commit as indexed
+        posting_add(f->list, arena_strdup(f->arena, word ? word : MESSAGE_ALL_TERM),
+                    arena_strdup(f->arena, first));
+    } else if (word) {
+        posting_add(f->list, arena_strdup(f->arena, first), arena_strdup(f->arena, word));
+    }
+}
+
+// merge the log into the main file and empty it
+void message_index_compact() {
+    struct arena a = {0};
+    struct posting_list list = {0};
+    struct fold_ctx ctx = { &list, &a, 0 };
+    char *line = NULL;
+    size_t line_capacity = 0;
+
+    FILE *f = fopen(MESSAGE_INDEX_FILE, "r");
+    if (f) {
+        while (getline(&line, &line_capacity, f) != -1) split_words(line, fold_word, &ctx);
+        fclose(f);
+    }
+    ctx.from_log = 1;
+    f = fopen(MESSAGE_LOG_FILE, "r");
+    if (f) {
+        while (getline(&line, &line_capacity, f) != -1) split_words(line, fold_word, &ctx);
+        fclose(f);
+    }
+    free(line);
+
+    qsort(list.items, list.count, sizeof(struct term_posting), compare_term_postings);
+
+    char temp_path[] = MNEMOS_DIR "/message-index-XXXXXX";
+    int fd = mkstemp(temp_path);
+    FILE *out = fd >= 0 ? fdopen(fd, "w") : NULL;
+    if (out) {
+        for (int i = 0; i < list.count; i++) {
+            struct term_posting *p = &list.items[i];
+            int new_term = i == 0 || strcmp(list.items[i - 1].term, p->term) != 0;
+            if (!new_term && strcmp(list.items[i - 1].commit, p->commit) == 0) continue;
+            if (new_term) fprintf(out, "%s%s", i ? "\n" : "", p->term);
+            fprintf(out, " %s", p->commit);
+        }
+        if (list.count) fprintf(out, "\n");
+        fchmod(fd, 0644);
+        if (fclose(out) == 0 && rename(temp_path, MESSAGE_INDEX_FILE) == 0) {
+            // an empty log renamed over the full one, so readers see one or the other;
+            // a log left in place is only folded in again, postings are deduplicated
+            if (write_file_atomic(MESSAGE_LOG_FILE, "") != 0) perror("Failed to reset message index log");
+        } else {
+            unlink(temp_path);
+        }
+    }
+    free(list.items);
+    arena_free(&a);
+}
+
+int count_lines(const char *path) {
+    FILE *f = fopen(path, "r");
+    if (!f) return 0;
+    int lines = 0, c;
+    while ((c = getc(f)) != EOF) lines += c == '\n';
+    fclose(f);
+    return lines;
+}
+
+// called by commit() once the message file is written
+void message_index_commit(const char *commit, const char *message) {
+    FILE *log = fopen(MESSAGE_LOG_FILE, "a");
+    if (!log) return;
+    message_log_append(log, commit, message);
+    fclose(log);
+    if (count_lines(MESSAGE_LOG_FILE) >= MESSAGE_LOG_MAX) message_index_compact();
+}
+
+/*
+ * search side: the main file is mapped and each term found with a binary
+ * search over its sorted lines.
+ */
+struct message_index {
+    char *data;
+    size_t size;
+    char **log_lines;   // split later, one per log line
+    int log_count;
+};
+
+void message_index_open(struct message_index *mi) {
+    memset(mi, 0, sizeof(*mi));
+    int fd = open(MESSAGE_INDEX_FILE, O_RDONLY);
+    if (fd >= 0) {
+        struct stat st;
+        if (fstat(fd, &st) == 0 && st.st_size > 0) {
+            void *data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (data != MAP_FAILED) {
+                mi->data = data;
+                mi->size = st.st_size;
+            }
+        }
+        close(fd);
+    }
+
+    FILE *log = fopen(MESSAGE_LOG_FILE, "r");
+    if (log) {
+        int capacity = 0;
+        char *line = NULL;
+        size_t line_capacity = 0;
+        while (getline(&line, &line_capacity, log) != -1) {
+            line[strcspn(line, "\n")] = 0;
+            if (mi->log_count == capacity) {
+                capacity = capacity ? capacity * 2 : 64;
+                mi->log_lines = realloc(mi->log_lines, capacity * sizeof(char *));
+            }
+            mi->log_lines[mi->log_count++] = arena_strdup(&cmd_arena, line);
+        }
+        free(line);
+        fclose(log);
+    }
+}
+
+void message_index_close(struct message_index *mi) {
+    if (mi->data) munmap(mi->data, mi->size);
+    free(mi->log_lines);
+}
+
+// start of term's line in the main file, or -1
+long message_index_find(struct message_index *mi, const char *term) {
+    size_t key_len = strlen(term);
+    size_t lo = 0, hi = mi->size;
+    while (lo < hi) {
+        size_t start = lo + (hi - lo) / 2;
+        while (start > lo && mi->data[start - 1] != '\n') start--;
+        size_t end = start;
+        while (end < mi->size && mi->data[end] != ' ' && mi->data[end] != '\n') end++;
+
+        size_t len = end - start;
+        int cmp = memcmp(mi->data + start, term, len < key_len ? len : key_len);
+        if (cmp == 0) cmp = len < key_len ? -1 : len > key_len ? 1 : 0;
+        if (cmp == 0) return start;
+        if (cmp < 0) {
+            while (end < mi->size && mi->data[end] != '\n') end++;
+            lo = end + 1;
+        } else {
+            hi = start;
+        }
+    }
+    return -1;
+}
+
+// commits whose messages contain term, sorted and unique
+int message_postings(struct message_index *mi, const char *term, char ***out) {
+    char **commits = NULL;
+    int count = 0, capacity = 0;
+
+    long start = message_index_find(mi, term);
+    if (start >= 0) {
+        size_t p = start + strlen(term);
+        while (p < mi->size && mi->data[p] == ' ') {
+            size_t word = ++p;
+            while (p < mi->size && mi->data[p] != ' ' && mi->data[p] != '\n') p++;
+            if (count == capacity) {
+                capacity = capacity ? capacity * 2 : 64;
+                commits = realloc(commits, capacity * sizeof(char *));
+            }
+            commits[count++] = arena_printf(&cmd_arena, "%.*s", (int) (p - word), mi->data + word);
+        }
+    }
+
+    size_t term_len = strlen(term);
+    for (int i = 0; i < mi->log_count; i++) {
+        const char *line = mi->log_lines[i];
+        const char *space = strchr(line, ' ');
+        int all = strcmp(term, MESSAGE_ALL_TERM) == 0;
+        int hit = all;
+        for (const char *w = space; w && !hit; w = strchr(w + 1, ' ')) {
+            hit = strncmp(w + 1, term, term_len) == 0 && (w[1 + term_len] == ' ' || w[1 + term_len] == '\0');
+        }
+        if (!hit) continue;
+        if (count == capacity) {
+            capacity = capacity ? capacity * 2 : 64;
+            commits = realloc(commits, capacity * sizeof(char *));
+        }
+        commits[count++] = arena_printf(&cmd_arena, "%.*s", space ? (int) (space - line) : (int) strlen(line), line);
+    }
+
+    qsort(commits, count, sizeof(char *), compare_commit_id_ptrs);
+    int kept = 0;
+    for (int i = 0; i < count; i++) {
+        if (kept && strcmp(commits[kept - 1], commits[i]) == 0) continue;
+        commits[kept++] = commits[i];
+    }
+    *out = commits;
+    return kept;
+}
+
+// log commits the index has never seen (made before it, or fetched)
+void message_index_backfill() {
+    // commits/ unchanged since the last full check: nothing can be missing
+    struct stat st;
+    if (stat(COMMITS_DIR, &st) != 0) return;
+    long seen_sec = -1, seen_nsec = -1;
+    FILE *seen = fopen(MESSAGE_SEEN_FILE, "r");
+    if (seen) {
+        if (fscanf(seen, "%ld %ld", &seen_sec, &seen_nsec) != 2) seen_sec = -1;
+        fclose(seen);
+    }
+    if (seen_sec == (long) st.st_mtime && seen_nsec == (long) ST_MTIME_NSEC(st)) return;
+
+    // a writer is busy (it may be compacting): search what is indexed now
+    if (repo_try_lock() != 0) return;
+
+    struct message_index mi;
+    message_index_open(&mi);
+    char **known;
+    int known_count = message_postings(&mi, MESSAGE_ALL_TERM, &known);
+    message_index_close(&mi);
+
+    char **ids;
+    int count = list_commit_ids(&ids, &cmd_arena);
+    qsort(ids, count, sizeof(char *), compare_commit_id_ptrs);
+
+    FILE *log = NULL;
+    for (int i = 0, j = 0; i < count; i++) {
+        while (j < known_count && compare_commit_ids(known[j], ids[i]) < 0) j++;
+        if (j < known_count && strcmp(known[j], ids[i]) == 0) continue;
+        if (!log && !(log = fopen(MESSAGE_LOG_FILE, "a"))) break;
+        message_log_append(log, ids[i], read_commit_message(ids[i], &cmd_arena));
+    }
+    if (log) {
+        fclose(log);
+        if (count_lines(MESSAGE_LOG_FILE) >= MESSAGE_LOG_MAX) message_index_compact();
+    }
+    free(known);
+    free(ids);
+
+    // a change later in the same second would share this mtime, so wait
+    if (st.st_mtime < time(NULL)) {
+        write_file_atomic(MESSAGE_SEEN_FILE,
+                          arena_printf(&cmd_arena, "%ld %ld\n", (long) st.st_mtime, (long) ST_MTIME_NSEC(st)));
+    }
+    repo_unlock();
+}
+
+/*
+ * moments --grep: commits whose message has every word of the query,
+ * newest first.
+ */
+void grep_moments(const char *query) {
+    message_index_backfill();
+
+    char **terms;
+    int term_count = tokenize_message(query, &terms, &cmd_arena);
+    if (term_count == 0) {
+        printf("Nothing to search for in '%s'\n", query);
+        free(terms);
+        return;
+    }
+
+    struct message_index mi;
+    message_index_open(&mi);
+
+    // intersect sorted postings, one term at a time
+    char **hits;
+    int hit_count = message_postings(&mi, terms[0], &hits);
+    for (int t = 1; t < term_count && hit_count > 0; t++) {
+        char **other;
+        int other_count = message_postings(&mi, terms[t], &other);
+        int kept = 0;
+        for (int i = 0, j = 0; i < hit_count && j < other_count;) {
+            int cmp = compare_commit_ids(hits[i], other[j]);
+            if (cmp == 0) {
+                hits[kept++] = hits[i];
+                i++;
+                j++;
+            } else if (cmp < 0) {
+                i++;
+            } else {
+                j++;
+            }
+        }
+        hit_count = kept;
+        free(other);
+    }
+    message_index_close(&mi);
+
+    printf("Commit Moments:\n");
+    int shown = 0;
+    for (int i = hit_count - 1; i >= 0; i--) {
+        // confirm against the message, the index may be behind a rewrite
+        char *message = read_commit_message(hits[i], &cmd_arena);
+        if (!message) continue;
+        char **words;
+        int word_count = tokenize_message(message, &words, &cmd_arena);
+        int all = 1;
+        for (int t = 0; t < term_count && all; t++) {
+            int found = 0;
+            for (int w = 0; w < word_count && !found; w++) found = strcmp(words[w], terms[t]) == 0;
+            all = found;
+        }
+        free(words);
+        if (!all) continue;
+        print_moment(hits[i], read_commit_timestamp(hits[i]));
+        shown++;
+    }
+    if (shown == 0) printf("No moments match '%s'\n", query);
+
+    free(hits);
+    free(terms);
+}
+
+/*
+ * reachability bitmaps, opt-in with `mnemos bitmaps`.
+ *
+ * .mnemos/bitmaps/objects is an append-only object order, one
+ * "<hash> <size>" line per object; the line number is the object's bit.
+ * .mnemos/bitmaps/<commit> is an EWAH-compressed bitmap of the objects
+ * that commit's tree needs, so "what does X need" is a file read and
+ * "what does the remote lack" is OR and ANDNOT over words. Objects swept
+ * by gc are set in .mnemos/bitmaps/removed, positions never shift.
+ */
+#define BITMAPS_DIR ".mnemos/bitmaps"
+#define BITMAPS_ORDER_FILE ".mnemos/bitmaps/objects"
+#define BITMAPS_REMOVED_FILE ".mnemos/bitmaps/removed"
+
+struct bitmap {
+    uint64_t *words;
+    size_t count;
+};
+
+void bitmap_grow(struct bitmap *b, size_t words) {
+    if (words <= b->count) return;
+    b->words = realloc(b->words, words * sizeof(uint64_t));
+    if (!b->words) {
+        perror("Out of memory");
+        exit(1);
+    }
+    memset(b->words + b->count, 0, (words - b->count) * sizeof(uint64_t));
+    b->count = words;
+}
+
+void bitmap_set(struct bitmap *b, uint32_t pos) {
+    bitmap_grow(b, pos / 64 + 1);
+    b->words[pos / 64] |= (uint64_t) 1 << (pos % 64);
+}
+
+void bitmap_unset(struct bitmap *b, uint32_t pos) {
+    if (pos / 64 < b->count) b->words[pos / 64] &= ~((uint64_t) 1 << (pos % 64));
+}
+
+int bitmap_get(const struct bitmap *b, uint32_t pos) {
+    return pos / 64 < b->count && (b->words[pos / 64] & ((uint64_t) 1 << (pos % 64)));
+}
+
+void bitmap_or(struct bitmap *dst, const struct bitmap *src) {
+    bitmap_grow(dst, src->count);
+    for (size_t i = 0; i < src->count; i++) dst->words[i] |= src->words[i];
+}
+
+void bitmap_andnot(struct bitmap *dst, const struct bitmap *src) {
+    size_t n = dst->count < src->count ? dst->count : src->count;
+    for (size_t i = 0; i < n; i++) dst->words[i] &= ~src->words[i];
+}
+
+void bitmap_free(struct bitmap *b) {
+    free(b->words);
+    b->words = NULL;
+    b->count = 0;
+}
+
+/*
+ * EWAH: a marker word (bit 0 running bit, bits 1-32 number of clean
+ * all-0/all-1 words, bits 33-63 number of literal words) followed by the
+ * literal words. File: raw word count, encoded word count, encoded words.
+ */
+#define EWAH_MAX_RUN 0xffffffffULL
+#define EWAH_MAX_LITERALS 0x7fffffffULL
+
+int ewah_save(const char *path, const struct bitmap *b) {
+    uint64_t *out = malloc((b->count * 2 + 2) * sizeof(uint64_t));
+    if (!out) return -1;
+    size_t n = 0, i = 0;
+    while (i < b->count) {
+        uint64_t run_bit = b->words[i] == ~(uint64_t) 0;
+        uint64_t clean = run_bit ? ~(uint64_t) 0 : 0;
+        uint64_t run = 0;
+        while (i < b->count && b->words[i] == clean && run < EWAH_MAX_RUN) {
+            run++;
+            i++;
+        }
+        size_t literal_start = i;
+        uint64_t literals = 0;
+        while (i < b->count && b->words[i] != 0 && b->words[i] != ~(uint64_t) 0 &&
+               literals < EWAH_MAX_LITERALS) {
+            literals++;
+            i++;
+        }
+        out[n++] = run_bit | (run << 1) | (literals << 33);
+        memcpy(out + n, b->words + literal_start, literals * sizeof(uint64_t));
+        n += literals;
+    }
+
+    char temp_path[sizeof(BITMAPS_DIR) + 16];
+    snprintf(temp_path, sizeof(temp_path), "%s/.tmp-XXXXXX", BITMAPS_DIR);
+    int fd = mkstemp(temp_path);
+    if (fd < 0) {
+        free(out);
+        return -1;
+    }
+    uint64_t header[2] = { b->count, n };
+    int ok = write(fd, header, sizeof(header)) == (ssize_t) sizeof(header) &&
+             write(fd, out, n * sizeof(uint64_t)) == (ssize_t) (n * sizeof(uint64_t));
+    close(fd);
+    free(out);
+    if (!ok || rename(temp_path, path) != 0) {
+        unlink(temp_path);
+        return -1;
+    }
+    return 0;
+}
+
+int ewah_load(const char *path, struct bitmap *b) {
+    b->words = NULL;
+    b->count = 0;
+    FILE *f = fopen(path, "rb");
+    if (!f) return -1;
+
+    uint64_t header[2];
+    if (fread(header, sizeof(uint64_t), 2, f) != 2) {
+        fclose(f);
+        return -1;
+    }
+    uint64_t *in = malloc((header[1] + 1) * sizeof(uint64_t));
+    if (!in || fread(in, sizeof(uint64_t), header[1], f) != header[1]) {
+        free(in);
+        fclose(f);
+        return -1;
+    }
+    fclose(f);
+
+    bitmap_grow(b, header[0]);
+    size_t pos = 0;
+    for (uint64_t i = 0; i < header[1] && pos <= b->count; ) {
+        uint64_t marker = in[i++];
+        uint64_t run = (marker >> 1) & EWAH_MAX_RUN;
+        uint64_t literals = marker >> 33;
+        if (pos + run + literals > b->count || i + literals > header[1]) break;
+        if (marker & 1) memset(b->words + pos, 0xff, run * sizeof(uint64_t));
+        pos += run;
+        memcpy(b->words + pos, in + i, literals * sizeof(uint64_t));
+        pos += literals;
+        i += literals;
+    }
+    free(in);
+    return 0;
+}
+
+struct object_order {
+    char **names;          // object name by position
+    long long *sizes;
+    int count;
+    int capacity;
+    int saved;             // positions already written to the order file
+    int *sorted;           // positions [0, sorted_count) sorted by name
+    int sorted_count;
+    struct bitmap removed;
+    int removed_dirty;
+    struct arena *arena;
+};
+
+static struct object_order *sort_order;
+
+int compare_order_positions(const void *a, const void *b) {
+    return strcmp(sort_order->names[*(const int *) a], sort_order->names[*(const int *) b]);
+}
+
+void object_order_sort(struct object_order *o) {
+    o->sorted = realloc(o->sorted, (o->count + 1) * sizeof(int));
+    for (int i = 0; i < o->count; i++) o->sorted[i] = i;
+    sort_order = o;
+    qsort(o->sorted, o->count, sizeof(int), compare_order_positions);
+    o->sorted_count = o->count;
+}
+
+void order_append(struct object_order *o, const char *name, long long size) {
+    if (o->count == o->capacity) {
+        o->capacity = o->capacity ? o->capacity * 2 : 1024;
+        o->names = realloc(o->names, o->capacity * sizeof(char *));
+        o->sizes = realloc(o->sizes, o->capacity * sizeof(long long));
+    }
+    o->names[o->count] = arena_strdup(o->arena, name);
+    o->sizes[o->count] = size;
+    o->count++;
+}
+
+// -1 when bitmaps are not enabled in this repository
+int load_object_order(struct object_order *o, struct arena *a) {
+    memset(o, 0, sizeof(*o));
+    o->arena = a;
+    struct stat st;
+    if (stat(BITMAPS_DIR, &st) != 0) return -1;
+
+    FILE *f = fopen(BITMAPS_ORDER_FILE, "r");
+    if (f) {
+        char name[HASH_SIZE];
+        long long size;
+        while (fscanf(f, "%63s %lld", name, &size) == 2) {
+            order_append(o, name, size);
         }
-    } else if (strcmp(order_flag, "-o") == 0) {
-        for (int i = 0; i < count; ++i) {
-            printf("Commit: %s | Time: %s | Message: %s\n",
-                   commits[i].hash,
-                   ctime(&commits[i].timestamp),
-                   commits[i].message);
+        fclose(f);
+    }
+    o->saved = o->count;
+    ewah_load(BITMAPS_REMOVED_FILE, &o->removed);
+    object_order_sort(o);
+    return 0;
+}
+
+int order_find(struct object_order *o, const char *name) {
+    int lo = 0, hi = o->sorted_count - 1;
+    while (lo <= hi) {
+        int mid = (lo + hi) / 2;
+        int cmp = strcmp(o->names[o->sorted[mid]], name);
+        if (cmp == 0) return o->sorted[mid];
+        if (cmp < 0) lo = mid + 1; else hi = mid - 1;
+    }
+    // appended since the last sort
+    for (int i = o->sorted_count; i < o->count; i++) {
+        if (strcmp(o->names[i], name) == 0) return i;
+    }
+    return -1;
+}
+
+int order_add(struct object_order *o, const char *name) {
+    int pos = order_find(o, name);
+    if (pos >= 0) {
+        if (bitmap_get(&o->removed, pos)) {
+            // stored again after gc removed it
+            bitmap_unset(&o->removed, pos);
+            o->removed_dirty = 1;
+        }
+        return pos;
+    }
+
+    char object_path[OBJECT_PATH_SIZE];
+    object_find(object_path, name);
+    struct stat st;
+    order_append(o, name, stat(object_path, &st) == 0 ? (long long) st.st_size : 0);
+    if (o->count - o->sorted_count > 64) object_order_sort(o);
+    return o->count - 1;
+}
+
+void object_order_forget(struct object_order *o, const char *name) {
+    int pos = order_find(o, name);
+    if (pos >= 0) {
+        bitmap_set(&o->removed, pos);
+        o->removed_dirty = 1;
+    }
+}
+
+void save_object_order(struct object_order *o) {
+    if (o->count > o->saved) {
+        FILE *f = fopen(BITMAPS_ORDER_FILE, "a");
+        if (!f) {
+            perror("Failed to update bitmap object order");
+            return;
+        }
+        for (int i = o->saved; i < o->count; i++) {
+            fprintf(f, "%s %lld\n", o->names[i], o->sizes[i]);
+        }
+        fclose(f);
+        o->saved = o->count;
+    }
+    if (o->removed_dirty) {
+        ewah_save(BITMAPS_REMOVED_FILE, &o->removed);
+        o->removed_dirty = 0;
+    }
+}
+
+void free_object_order(struct object_order *o) {
+    free(o->names);
+    free(o->sizes);
+    free(o->sorted);
+    bitmap_free(&o->removed);
+}
+
+struct bitmap_build {
+    struct object_order *order;
+    struct bitmap *bitmap;
+};
+
+void bitmap_build_entry(void *ctx, const char *path, const char *hash) {
+    struct bitmap_build *build = ctx;
+    (void) path;
+    bitmap_set(build->bitmap, order_add(build->order, hash));
+}
+
+// bitmap of one commit, from its file or built from the tree (and saved if persist)
+void commit_bitmap(struct object_order *o, const char *commit, struct bitmap *out, int persist) {
+    char *bitmap_path = arena_printf(o->arena, "%s/%s", BITMAPS_DIR, commit);
+    if (ewah_load(bitmap_path, out) == 0) return;
+
+    struct bitmap_build build = { o, out };
+    struct arena a = {0};
+    for_each_tree_entry(arena_printf(&a, "%s/%s", COMMITS_DIR, commit), bitmap_build_entry, &build, &a);
+    arena_free(&a);
+    if (persist) {
+        ewah_save(bitmap_path, out);
+    }
+}
+
+// feed every object in a commit's bitmap to fn, -1 if the commit has none yet
+int bitmap_mark_commit(struct object_order *o, const char *commit,
+                       void (*fn)(void *ctx, const char *path, const char *hash), void *ctx) {
+    char bitmap_path[sizeof(BITMAPS_DIR) + HASH_SIZE + 1];
+    snprintf(bitmap_path, sizeof(bitmap_path), "%s/%s", BITMAPS_DIR, commit);
+    struct bitmap b;
+    if (ewah_load(bitmap_path, &b) != 0) return -1;
+
+    for (size_t w = 0; w < b.count; w++) {
+        uint64_t word = b.words[w];
+        while (word) {
+            int bit = __builtin_ctzll(word);
+            word &= word - 1;
+            int pos = (int) (w * 64 + bit);
+            if (pos < o->count) fn(ctx, NULL, o->names[pos]);
+        }
+    }
+    bitmap_free(&b);
+    return 0;
+}
+
+// called by commit(), keeps bitmaps current when they are enabled
+void bitmap_index_commit(const char *commit, int replaced) {
+    struct arena a = {0};
+    struct object_order order;
+    if (load_object_order(&order, &a) == 0) {
+        // the bitmap of the commit this one replaced describes the wrong tree
+        if (replaced) unlink(arena_printf(&a, "%s/%s", BITMAPS_DIR, commit));
+        struct bitmap b = {0};
+        commit_bitmap(&order, commit, &b, 1);
+        save_object_order(&order);
+        bitmap_free(&b);
+        free_object_order(&order);
+    }
+    arena_free(&a);
+}
+
+// mnemos bitmaps: enable bitmaps and build them for every commit that lacks one
+void build_bitmaps() {
+    struct stat st;
+    if (stat(MNEMOS_DIR, &st) != 0) {
+        printf("Error: This is not a Mnemos repository. Initialize it first with 'mnemos init'.\n");
+        exit(1);
+    }
+    mkdir(BITMAPS_DIR, 0755);
+
+    struct object_order order;
+    load_object_order(&order, &cmd_arena);
+    int known = order.count;
+
+    char **commits;
+    int commit_count = list_commit_ids(&commits, &cmd_arena);
+    int built = 0;
+    for (int i = 0; i < commit_count; i++) {
+        char *bitmap_path = arena_printf(&cmd_arena, "%s/%s", BITMAPS_DIR, commits[i]);
+        if (stat(bitmap_path, &st) == 0) continue;
+        struct bitmap b = {0};
+        commit_bitmap(&order, commits[i], &b, 1);
+        bitmap_free(&b);
+        built++;
+    }
+
+    // objects no commit uses still count for size stats
+    struct object_list objects;
+    list_objects(&objects, &cmd_arena);
+    for (int i = 0; i < objects.count; i++) {
+        order_add(&order, objects.names[i]);
+    }
+    save_object_order(&order);
+
+    printf("Built bitmaps for %d commits, %d objects indexed (%d new).\n",
+           built, order.count, order.count - known);
+    free(objects.names);
+    free(commits);
+    free_object_order(&order);
+}
+
+// union of the bitmaps of the given commits
+void union_bitmaps(struct object_order *o, char **commits, int count, struct bitmap *out) {
+    for (int i = 0; i < count; i++) {
+        struct bitmap b = {0};
+        commit_bitmap(o, commits[i], &b, 0);
+        bitmap_or(out, &b);
+        bitmap_free(&b);
+    }
+}
+
+// commit ids listed one per line in a file
+int read_commit_list(const char *path, char ***ids_out, struct arena *a) {
+    char **ids = NULL;
+    int count = 0, capacity = 0;
+    FILE *f = fopen(path, "r");
+    if (f) {
+        char id[HASH_SIZE];
+        while (fscanf(f, "%63s", id) == 1) {
+            if (count == capacity) {
+                capacity = capacity ? capacity * 2 : 256;
+                ids = realloc(ids, capacity * sizeof(char *));
+            }
+            ids[count++] = arena_strdup(a, id);
+        }
+        fclose(f);
+    }
+    *ids_out = ids;
+    return count;
+}
+
+/*
+ * what to send: commits not in known_file and the objects they need that
+ * the known commits don't already carry. -1 when bitmaps are not enabled.
+ */
+int bitmaps_send_lists(const char *known_file, FILE *commits_out, FILE *objects_out,
+                       int *commit_count_out, int *object_count_out) {
+    struct arena a = {0};
+    struct object_order order;
+    if (load_object_order(&order, &a) != 0) {
+        arena_free(&a);
+        return -1;
+    }
+
+    char **local, **known;
+    int local_count = list_commit_ids(&local, &a);
+    int known_count = read_commit_list(known_file, &known, &a);
+    struct path_table known_set;
+    path_table_init(&known_set, &a);
+    for (int i = 0; i < known_count; i++) path_add(&known_set, known[i]);
+
+    struct bitmap need = {0}, have = {0};
+    int commit_count = 0;
+    for (int i = 0; i < local_count; i++) {
+        if (path_has(&known_set, local[i])) continue;
+        fprintf(commits_out, "%s\n", local[i]);
+        union_bitmaps(&order, &local[i], 1, &need);
+        commit_count++;
+    }
+    union_bitmaps(&order, known, known_count, &have);
+    bitmap_andnot(&need, &have);
+
+    int object_count = 0;
+    for (int pos = 0; pos < order.count; pos++) {
+        if (bitmap_get(&need, pos) && !bitmap_get(&order.removed, pos)) {
+            // rsync --files-from wants the path under objects/, fan-out dirs and all
+            char object_path[OBJECT_PATH_SIZE];
+            object_find(object_path, order.names[pos]);
+            fprintf(objects_out, "%s\n", object_path + sizeof(OBJECTS_DIR));
+            object_count++;
+        }
+    }
+    *commit_count_out = commit_count;
+    *object_count_out = object_count;
+
+    bitmap_free(&need);
+    bitmap_free(&have);
+    path_table_free(&known_set);
+    free(local);
+    free(known);
+    free_object_order(&order);
+    arena_free(&a);
+    return 0;
+}
+
+// remember which commits the remote has after a successful send
+void record_remote_commits(const char *known_file) {
+    struct arena a = {0};
+    char **ids;
+    int count = list_commit_ids(&ids, &a);
+    struct atomic_file af;
+    if (atomic_begin(&af, known_file)) {
+        for (int i = 0; i < count; i++) fprintf(af.f, "%s\n", ids[i]);
+        atomic_end(&af);
+    }
+    free(ids);
+    arena_free(&a);
+}
+
+/*
+ * bundles: commits and the objects they add in one stream, for sites
+ * rsync can't reach.
+ *
+ *     mnemos-bundle 1 <base or -> <tip>
+ *     O <hash> <size>       then size bytes of object
+ *     C <commit>            then the commit's files, each
+ *     F <size> <path>       then size bytes
+ *     E <records> <checksum>
+ *
+ * Objects come first, so a commit is never published before what it
+ * needs. The checksum is the hash of every byte before the E line, taken
+ * like an object's. The stream runs through gzip; "-" as file is
+ * stdout/stdin.
+ */
+#define BUNDLE_MAGIC "mnemos-bundle 1"
+
+// hash a stream fed in any pieces, same result as hashing it as a file
+struct stream_sum {
+    uint32_t hash;
+    size_t fill;
+    char block[HASH_CHUNK_SIZE];
+};
+
+void sum_update(struct stream_sum *s, const char *data, size_t len) {
+    while (len > 0) {
+        size_t n = sizeof(s->block) - s->fill;
+        if (n > len) n = len;
+        memcpy(s->block + s->fill, data, n);
+        s->fill += n;
+        data += n;
+        len -= n;
+        if (s->fill == sizeof(s->block)) {
+            s->hash = murmur3_32(s->block, s->fill, s->hash ^ 42);
+            s->fill = 0;
+        }
+    }
+}
+
+void sum_final(struct stream_sum *s, char *hash_out) {
+    if (s->fill > 0) {
+        s->hash = murmur3_32(s->block, s->fill, s->hash ^ 42);
+        s->fill = 0;
+    }
+    snprintf(hash_out, HASH_SIZE, "%08x", s->hash);
+}
+
+struct bundle_writer {
+    FILE *out;
+    struct stream_sum sum;
+    char *buffer;
+    int records;
+    int failed;
+};
+
+void bundle_put(struct bundle_writer *w, const char *data, size_t len) {
+    sum_update(&w->sum, data, len);
+    if (fwrite(data, 1, len, w->out) != len) w->failed = 1;
+}
+
+void bundle_line(struct bundle_writer *w, const char *fmt, ...) {
+    char line[4200];
+    va_list args;
+    va_start(args, fmt);
+    int len = vsnprintf(line, sizeof(line), fmt, args);
+    va_end(args);
+    if (len < 0 || len >= (int) sizeof(line)) {
+        w->failed = 1;
+        return;
+    }
+    bundle_put(w, line, len);
+}
+
+// one record: "<kind> <name> <size>" or "F <size> <name>", then the file
+void bundle_put_file(struct bundle_writer *w, char kind, const char *name, const char *path) {
+    int fd = open(path, O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0) {
+        fprintf(stderr, "Error: Failed to read '%s': %s\n", path, strerror(errno));
+        if (fd >= 0) close(fd);
+        w->failed = 1;
+        return;
+    }
+    if (kind == 'O') {
+        bundle_line(w, "O %s %lld\n", name, (long long) st.st_size);
+    } else {
+        bundle_line(w, "F %lld %s\n", (long long) st.st_size, name);
+    }
+    long long left = st.st_size;
+    while (left > 0 && !w->failed) {
+        ssize_t n = read_full(fd, w->buffer, left < STREAM_BUFFER_SIZE ? left : STREAM_BUFFER_SIZE);
+        if (n <= 0) {
+            // the file shrank under us, the bundle would be unreadable
+            w->failed = 1;
+            break;
+        }
+        bundle_put(w, w->buffer, n);
+        left -= n;
+    }
+    close(fd);
+    w->records++;
+}
+
+void bundle_put_tree(struct bundle_writer *w, const char *dir_path, const char *rel) {
+    char **names;
+    int count = read_dir_names(dir_path, &names, &cmd_arena);
+    for (int i = 0; i < count && !w->failed; i++) {
+        struct arena_mark mark = arena_save(&cmd_arena);
+        char *path = arena_printf(&cmd_arena, "%s/%s", dir_path, names[i]);
+        char *rel_path = rel[0] ? arena_printf(&cmd_arena, "%s/%s", rel, names[i]) : names[i];
+        struct stat st;
+        if (stat(path, &st) != 0) {
+            // gone meanwhile, nothing to bundle
+            arena_restore(&cmd_arena, mark);
+            continue;
+        }
+        if (S_ISDIR(st.st_mode)) {
+            bundle_put_tree(w, path, rel_path);
+        } else if (S_ISREG(st.st_mode)) {
+            bundle_put_file(w, 'F', rel_path, path);
+        }
+        arena_restore(&cmd_arena, mark);
+    }
+    free(names);
+}
+
+struct bundle_objects {
+    struct path_table seen;
+    char **hashes;
+    int count;
+    int capacity;
+    struct arena arena;     // own arena: the walk rewinds the caller's per entry
+};
+
+void bundle_base_object(void *ctx, const char *path, const char *hash) {
+    (void) path;
+    path_add(&((struct bundle_objects *) ctx)->seen, hash);
+}
+
+void bundle_need_object(void *ctx, const char *path, const char *hash) {
+    (void) path;
+    struct bundle_objects *o = ctx;
+    if (!path_add(&o->seen, hash)) return;
+    if (o->count == o->capacity) {
+        o->capacity = o->capacity ? o->capacity * 2 : 1024;
+        o->hashes = realloc(o->hashes, o->capacity * sizeof(char *));
+    }
+    o->hashes[o->count++] = arena_strdup(&o->arena, hash);
+}
+
+// records for objects, then commits, then the trailer; header is covered by the checksum
+int bundle_write(FILE *out, const char *header, char **objects, int object_count,
+                 char **commits, int commit_count) {
+    struct bundle_writer w;
+    memset(&w, 0, sizeof(w));
+    w.out = out;
+    w.buffer = malloc(STREAM_BUFFER_SIZE);
+
+    if (header) bundle_line(&w, "%s", header);
+    for (int i = 0; i < object_count && !w.failed; i++) {
+        char object_path[OBJECT_PATH_SIZE];
+        object_find(object_path, objects[i]);
+        bundle_put_file(&w, 'O', objects[i], object_path);
+    }
+    for (int i = 0; i < commit_count && !w.failed; i++) {
+        bundle_line(&w, "C %s\n", commits[i]);
+        w.records++;
+        bundle_put_tree(&w, arena_printf(&cmd_arena, "%s/%s", COMMITS_DIR, commits[i]), "");
+    }
+    char checksum[HASH_SIZE];
+    sum_final(&w.sum, checksum);
+    if (fprintf(out, "E %d %s\n", w.records, checksum) < 0 || fflush(out) != 0) w.failed = 1;
+    free(w.buffer);
+    return w.failed ? -1 : 0;
+}
+
+/*
+ * gzip_open: a stream through gzip, compressing into file or decompressing
+ * from it, "-" for stdout or stdin. The file is opened here and handed to
+ * gzip as its stdio, so its name never goes through a shell.
+ */
+FILE *gzip_open(const char *file, int compress, pid_t *pid_out) {
+    int fd = -1;
+    if (strcmp(file, "-") != 0) {
+        fd = compress ? open(file, O_WRONLY | O_CREAT | O_TRUNC, 0644) : open(file, O_RDONLY);
+        if (fd < 0) {
+            perror(file);
+            return NULL;
+        }
+    }
+    int fds[2];
+    if (pipe(fds) != 0) {
+        perror("Failed to start gzip");
+        if (fd >= 0) close(fd);
+        return NULL;
+    }
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid < 0) {
+        perror("Failed to start gzip");
+        close(fds[0]);
+        close(fds[1]);
+        if (fd >= 0) close(fd);
+        return NULL;
+    }
+    if (pid == 0) {
+        // we write into the pipe and gzip into the file, or the other way round
+        dup2(compress ? fds[0] : fds[1], compress ? STDIN_FILENO : STDOUT_FILENO);
+        if (fd >= 0) dup2(fd, compress ? STDOUT_FILENO : STDIN_FILENO);
+        close(fds[0]);
+        close(fds[1]);
+        if (fd >= 0) close(fd);
+        execlp("gzip", "gzip", compress ? "-1c" : "-dc", (char *) NULL);
+        _exit(127);
+    }
+    if (fd >= 0) close(fd);
+    close(compress ? fds[0] : fds[1]);
+    *pid_out = pid;
+    return fdopen(compress ? fds[1] : fds[0], compress ? "w" : "r");
+}
+
+// close a gzip_open stream, -1 unless gzip finished cleanly
+int gzip_close(FILE *f, pid_t pid) {
+    int failed = fclose(f) != 0;
+    int wstatus;
+    while (waitpid(pid, &wstatus, 0) < 0) {
+        if (errno != EINTR) return -1;
+    }
+    return failed || !WIFEXITED(wstatus) || WEXITSTATUS(wstatus) != 0 ? -1 : 0;
+}
+
+// mnemos bundle create <file> [<since-commit>]: commits after since, and their new objects
+int bundle_create(const char *file, const char *since) {
+    struct stat st;
+    if (stat(COMMITS_DIR, &st) != 0) {
+        fprintf(stderr, "Error: This is not a Mnemos repository. Initialize it first with 'mnemos init'.\n");
+        return 1;
+    }
+    if (since && stat(arena_printf(&cmd_arena, "%s/%s", COMMITS_DIR, since), &st) != 0) {
+        fprintf(stderr, "Error: Commit %s not found.\n", since);
+        return 1;
+    }
+
+    char **ids;
+    int id_count = list_commit_ids(&ids, &cmd_arena);
+    qsort(ids, id_count, sizeof(char *), compare_commit_id_ptrs);
+    int first = 0;
+    while (since && first < id_count && compare_commit_ids(ids[first], since) <= 0) first++;
+    if (first == id_count) {
+        fprintf(stderr, "Nothing to bundle, no commits after %s.\n", since ? since : "the start");
+        free(ids);
+        return 1;
+    }
+
+    // objects the base already has stay out
+    struct bundle_objects objects;
+    memset(&objects, 0, sizeof(objects));
+    path_table_init(&objects.seen, &objects.arena);
+    struct arena walk = {0};
+    if (since) {
+        for_each_tree_entry(arena_printf(&walk, "%s/%s", COMMITS_DIR, since), bundle_base_object, &objects, &walk);
+    }
+    for (int i = first; i < id_count; i++) {
+        for_each_tree_entry(arena_printf(&walk, "%s/%s", COMMITS_DIR, ids[i]), bundle_need_object, &objects, &walk);
+    }
+    arena_free(&walk);
+
+    int to_stdout = strcmp(file, "-") == 0;
+    pid_t gzip;
+    FILE *out = gzip_open(file, 1, &gzip);
+    if (!out) {
+        free(ids);
+        free(objects.hashes);
+        path_table_free(&objects.seen);
+        arena_free(&objects.arena);
+        return 1;
+    }
+    char *header = arena_printf(&cmd_arena, "%s %s %s\n", BUNDLE_MAGIC, since ? since : "-", ids[id_count - 1]);
+    int failed = bundle_write(out, header, objects.hashes, objects.count, ids + first, id_count - first) != 0;
+    if (gzip_close(out, gzip) != 0) failed = 1;
+
+    int commit_count = id_count - first;
+    free(ids);
+    free(objects.hashes);
+    path_table_free(&objects.seen);
+    arena_free(&objects.arena);
+    if (failed) {
+        fprintf(stderr, "Error: Failed to write bundle %s\n", to_stdout ? "to stdout" : file);
+        if (!to_stdout) unlink(file);
+        return 1;
+    }
+    fprintf(to_stdout ? stderr : stdout, "Bundled %d commits and %d objects into %s\n",
+            commit_count, objects.count, to_stdout ? "stdout" : file);
+    return 0;
+}
+
+// read size bytes of payload, into fd_out when it's >= 0
+int bundle_read(FILE *in, struct stream_sum *sum, struct stream_sum *content, int fd_out,
+                long long size, char *buffer) {
+    while (size > 0) {
+        size_t want = size < STREAM_BUFFER_SIZE ? size : STREAM_BUFFER_SIZE;
+        size_t n = fread(buffer, 1, want, in);
+        if (n == 0) return -1;
+        sum_update(sum, buffer, n);
+        if (content) sum_update(content, buffer, n);
+        if (fd_out >= 0 && write_full(fd_out, buffer, n) != 0) return -1;
+        size -= n;
+    }
+    return 0;
+}
+
+// names from a bundle must stay inside the repository
+int bundle_name_ok(const char *name) {
+    if (!name[0] || name[0] == '/' || name[0] == '.') return 0;
+    for (const char *p = name; *p; p++) {
+        if (p[0] == '/' && (p[1] == '.' || p[1] == '/' || p[1] == 0)) return 0;
+    }
+    return 1;
+}
+
+struct pending_commit {
+    char *id;
+    char *temp;     // NULL when the commit was already here
+};
+
+struct bundle_result {
+    int commits;        // newly published
+    int objects;
+    int new_objects;
+};
+
+/*
+ * read records up to the trailer: objects are stored as they pass, after
+ * checking them against their name; commits are built in temp dirs and
+ * published once the checksum holds. NULL, or what was wrong.
+ */
+const char *bundle_ingest(FILE *in, struct stream_sum *sum, struct bundle_result *r) {
+    memset(r, 0, sizeof(*r));
+    char *buffer = malloc(STREAM_BUFFER_SIZE);
+    char *line = NULL;
+    size_t capacity = 0;
+    ssize_t len;
+    struct stat st;
+    struct pending_commit *commits = NULL;
+    int commit_count = 0, records = 0, complete = 0;
+    const char *error = NULL;
+    char *current = NULL;   // temp dir of the commit being read, NULL to skip its files
+    while (!error && (len = getline(&line, &capacity, in)) > 0) {
+        line[strcspn(line, "\n")] = 0;
+        char name[HASH_SIZE];
+        long long size;
+        if (line[0] == 'E') {
+            char checksum[HASH_SIZE], expected[HASH_SIZE];
+            int count;
+            sum_final(sum, checksum);
+            if (sscanf(line, "E %d %63s", &count, expected) != 2 || count != records ||
+                strcmp(checksum, expected) != 0) {
+                error = "checksum mismatch";
+            }
+            complete = 1;
+            break;
+        }
+        sum_update(sum, line, strlen(line));
+        sum_update(sum, "\n", 1);
+        records++;
+
+        if (line[0] == 'O' && sscanf(line, "O %63s %lld", name, &size) == 2 && bundle_name_ok(name)) {
+            r->objects++;
+            struct stream_sum content;
+            memset(&content, 0, sizeof(content));
+            if (object_exists(name)) {
+                if (bundle_read(in, sum, NULL, -1, size, buffer) != 0) error = "truncated";
+                continue;
+            }
+            char temp_path[] = OBJECTS_DIR "/.tmp-XXXXXX";
+            int fd = mkstemp(temp_path);
+            if (fd < 0) {
+                error = strerror(errno);
+                break;
+            }
+            int result = bundle_read(in, sum, &content, fd, size, buffer);
+            fchmod(fd, 0644);
+            if (close(fd) != 0) result = -1;
+            char actual[HASH_SIZE];
+            sum_final(&content, actual);
+            if (result != 0) {
+                error = "truncated";
+            } else if (strcmp(actual, name) != 0) {
+                error = arena_printf(&cmd_arena, "object %s is corrupt", name);
+            } else if (object_publish(temp_path, name) != 0) {
+                error = strerror(errno);
+            } else {
+                r->new_objects++;
+                continue;
+            }
+            unlink(temp_path);
+        } else if (line[0] == 'C' && sscanf(line, "C %63s", name) == 1 && bundle_name_ok(name)) {
+            commits = realloc(commits, (commit_count + 1) * sizeof(struct pending_commit));
+            struct pending_commit *c = &commits[commit_count++];
+            c->id = arena_strdup(&cmd_arena, name);
+            c->temp = NULL;
+            if (stat(arena_printf(&cmd_arena, "%s/%s", COMMITS_DIR, name), &st) != 0) {
+                c->temp = arena_printf(&cmd_arena, "%s/.tmp-%s-XXXXXX", COMMITS_DIR, name);
+                if (!mkdtemp(c->temp)) {
+                    c->temp = NULL;
+                    error = strerror(errno);
+                }
+            }
+            current = c->temp;
+        } else if (line[0] == 'F' && commit_count > 0 && sscanf(line, "F %lld", &size) == 1 &&
+                   strchr(line + 2, ' ') && bundle_name_ok(strchr(line + 2, ' ') + 1)) {
+            int fd = -1;
+            if (current) {
+                char *path = arena_printf(&cmd_arena, "%s/%s", current, strchr(line + 2, ' ') + 1);
+                create_directories(path);
+                fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+                if (fd < 0) {
+                    error = strerror(errno);
+                    break;
+                }
+            }
+            if (bundle_read(in, sum, NULL, fd, size, buffer) != 0) error = "truncated";
+            if (fd >= 0 && close(fd) != 0) error = strerror(errno);
+        } else {
+            error = "bad record";
+        }
+    }
+    if (!error && !complete) error = "truncated";
+    free(line);
+    free(buffer);
+
+    for (int i = 0; i < commit_count; i++) {
+        if (!commits[i].temp) continue;
+        char *commit_dir = arena_printf(&cmd_arena, "%s/%s", COMMITS_DIR, commits[i].id);
+        if (!error && rename(commits[i].temp, commit_dir) == 0) {
+            r->commits++;
+        } else {
+            // broken stream, or the commit arrived meanwhile
+            remove_recursive(commits[i].temp);
+        }
+    }
+    free(commits);
+    return error;
+}
+
+// mnemos bundle apply <file>
+int bundle_apply(const char *file) {
+    struct stat st;
+    if (stat(COMMITS_DIR, &st) != 0 || stat(OBJECTS_DIR, &st) != 0) {
+        printf("Error: This is not a Mnemos repository. Initialize it first with 'mnemos init'.\n");
+        return 1;
+    }
+    pid_t gzip;
+    FILE *in = gzip_open(file, 0, &gzip);
+    if (!in) return 1;
+
+    struct stream_sum sum;
+    memset(&sum, 0, sizeof(sum));
+    char *line = NULL;
+    size_t capacity = 0;
+    ssize_t len = getline(&line, &capacity, in);
+    char base[HASH_SIZE], tip[HASH_SIZE];
+    if (len <= 0 || strncmp(line, BUNDLE_MAGIC " ", sizeof(BUNDLE_MAGIC)) != 0 ||
+        sscanf(line + sizeof(BUNDLE_MAGIC), "%63s %63s", base, tip) != 2) {
+        printf("Error: %s is not a mnemos bundle\n", file);
+        free(line);
+        gzip_close(in, gzip);
+        return 1;
+    }
+    sum_update(&sum, line, len);
+    free(line);
+    if (strcmp(base, "-") != 0 && stat(arena_printf(&cmd_arena, "%s/%s", COMMITS_DIR, base), &st) != 0) {
+        printf("Error: Bundle builds on commit %s, which this repository doesn't have.\n", base);
+        gzip_close(in, gzip);
+        return 1;
+    }
+
+    struct bundle_result r;
+    const char *error = bundle_ingest(in, &sum, &r);
+    if (gzip_close(in, gzip) != 0 && !error) error = "gzip failed";
+    if (error) {
+        printf("Error: Bundle %s is damaged (%s), no commits applied.\n", file, error);
+        return 1;
+    }
+    printf("Applied bundle: %d new commits, %d new objects (%d already here). Tip: %s\n",
+           r.commits, r.new_objects, r.objects - r.new_objects, tip);
+    return 0;
+}
+
+/*
+ * sync: make two repositories hold the same objects and commits, even
+ * without history in common, by comparing fingerprints of ranges instead
+ * of listing everything.
+ *
+ * Every object and commit is an item ("o<hash>", "c<id>.<digest>") at a
+ * 32 bit key. Commit ids are only the second they were made in, so the
+ * digest covers the tree, message and timestamp; the key is of the part
+ * before the dot, which puts two commits of one id in the same range.
+ * Those are reported as conflicts and neither is sent. A range of keys
+ * has a fingerprint: its count and the xor of its items' 64 bit hashes.
+ * The sides trade fingerprints: equal ranges are done, a side with few
+ * items in a range lists them, otherwise it splits the range SYNC_FANOUT
+ * ways and sends those fingerprints. Each round trip
+ * handles every open range at once, so sets that differ in d items agree
+ * after O(log n) rounds and O(d log n) lines. Then each side sends what
+ * the other lacks as bundle records.
+ *
+ * The peer is `mnemos sync-serve <dir>` at the other end of a pipe: over
+ * ssh for user@host:/path, a local process for a plain path.
+ */
+#define SYNC_FANOUT 16
+#define SYNC_LIST_MAX 16
+#define SYNC_KEYS (1ULL << 32)
+
+struct sync_item {
+    uint32_t key;
+    uint64_t fp;
+    char *name;
+};
+
+struct sync_set {
+    struct sync_item *items;
+    int count;
+    struct path_table give_set;     // items the peer lacks
+    char **give;
+    int give_count;
+    int give_capacity;
+    int want_count;
+    char **conflicts;               // commit ids that differ between the sides
+    int conflict_count;
+    struct arena arena;
+};
+
+int compare_sync_items(const void *a, const void *b) {
+    const struct sync_item *x = a, *y = b;
+    if (x->key != y->key) return x->key < y->key ? -1 : 1;
+    return strcmp(x->name, y->name);
+}
+
+void sync_add_item(struct sync_set *set, int *capacity, char type, const char *name) {
+    if (set->count == *capacity) {
+        *capacity = *capacity ? *capacity * 2 : 1024;
+        set->items = realloc(set->items, *capacity * sizeof(struct sync_item));
+    }
+    struct sync_item *item = &set->items[set->count++];
+    item->name = arena_printf(&set->arena, "%c%s", type, name);
+    size_t len = strlen(item->name);
+    item->key = murmur3_32(item->name, strcspn(item->name, "."), 0);
+    item->fp = (uint64_t) murmur3_32(item->name, len, 1) << 32 | murmur3_32(item->name, len, 2);
+}
+
+struct sync_digests {
+    char **ids;
+    uint64_t *digests;
+};
+
+// order-free sum over entries, as trees are walked in directory order
+void sync_digest_entry(void *ctx, const char *path, const char *hash) {
+    uint64_t *digest = ctx;
+    size_t path_len = strlen(path), hash_len = strlen(hash);
+    *digest += (uint64_t) murmur3_32(path, path_len, 1) << 32 | murmur3_32(hash, hash_len, (uint32_t) path_len);
+}
+
+// worker: digest of commit i's tree, message and timestamp
+void sync_digest_commit(void *ctx, int i) {
+    struct sync_digests *d = ctx;
+    struct arena a = {0};
+    char *dir = arena_printf(&a, "%s/%s", COMMITS_DIR, d->ids[i]);
+    uint64_t digest = 0;
+    for_each_tree_entry(dir, sync_digest_entry, &digest, &a);
+    char message[HASH_SIZE] = "", timestamp[HASH_SIZE] = "";
+    try_hash_file(arena_printf(&a, "%s/%s/message", COMMITS_DIR, d->ids[i]), message);
+    try_hash_file(arena_printf(&a, "%s/%s/timestamp", COMMITS_DIR, d->ids[i]), timestamp);
+    digest ^= (uint64_t) murmur3_32(message, strlen(message), 3) << 32 |
+              murmur3_32(timestamp, strlen(timestamp), 4);
+    d->digests[i] = digest;
+    arena_free(&a);
+}
+
+// "c<id>.<digest>" -> length of "c<id>"
+size_t sync_item_id_length(const char *name) {
+    return strcspn(name, ".");
+}
+
+void sync_conflict(struct sync_set *set, const char *name) {
+    char *id = arena_printf(&set->arena, "%.*s", (int) (sync_item_id_length(name) - 1), name + 1);
+    for (int i = 0; i < set->conflict_count; i++) {
+        if (strcmp(set->conflicts[i], id) == 0) return;
+    }
+    set->conflicts = realloc(set->conflicts, (set->conflict_count + 1) * sizeof(char *));
+    set->conflicts[set->conflict_count++] = id;
+}
+
+void sync_load(struct sync_set *set) {
+    memset(set, 0, sizeof(*set));
+    path_table_init(&set->give_set, &set->arena);
+    int capacity = 0;
+    struct object_list objects;
+    list_objects(&objects, &set->arena);
+    for (int i = 0; i < objects.count; i++) sync_add_item(set, &capacity, 'o', objects.names[i]);
+    free(objects.names);
+    char **ids;
+    int id_count = list_commit_ids(&ids, &set->arena);
+    struct sync_digests d = { ids, malloc((id_count + 1) * sizeof(uint64_t)) };
+    parallel_for(id_count, sync_digest_commit, &d);
+    for (int i = 0; i < id_count; i++) {
+        sync_add_item(set, &capacity, 'c', arena_printf(&set->arena, "%s.%016llx", ids[i],
+                                                       (unsigned long long) d.digests[i]));
+    }
+    free(d.digests);
+    free(ids);
+    qsort(set->items, set->count, sizeof(struct sync_item), compare_sync_items);
+}
+
+void sync_free(struct sync_set *set) {
+    free(set->items);
+    free(set->give);
+    free(set->conflicts);
+    path_table_free(&set->give_set);
+    arena_free(&set->arena);
+}
+
+// first item at or after key
+int sync_lower(const struct sync_set *set, uint64_t key) {
+    int lo = 0, hi = set->count;
+    while (lo < hi) {
+        int mid = lo + (hi - lo) / 2;
+        if (set->items[mid].key < key) lo = mid + 1; else hi = mid;
+    }
+    return lo;
+}
+
+void sync_give(struct sync_set *set, const char *name) {
+    if (!path_add(&set->give_set, name)) return;
+    if (set->give_count == set->give_capacity) {
+        set->give_capacity = set->give_capacity ? set->give_capacity * 2 : 256;
+        set->give = realloc(set->give, set->give_capacity * sizeof(char *));
+    }
+    set->give[set->give_count++] = arena_strdup(&set->arena, name);
+}
+
+// describe our side of [lo,hi): the items when few, else a fingerprint
+void sync_offer(struct sync_set *set, FILE *out, uint64_t lo, uint64_t hi) {
+    int first = sync_lower(set, lo), last = sync_lower(set, hi);
+    if (last - first <= SYNC_LIST_MAX || hi - lo <= 1) {
+        fprintf(out, "L %llu %llu", (unsigned long long) lo, (unsigned long long) hi);
+        for (int i = first; i < last; i++) fprintf(out, " %s", set->items[i].name);
+        fprintf(out, "\n");
+        return;
+    }
+    uint64_t fp = 0;
+    for (int i = first; i < last; i++) fp ^= set->items[i].fp;
+    fprintf(out, "R %llu %llu %d %016llx\n", (unsigned long long) lo, (unsigned long long) hi,
+            last - first, (unsigned long long) fp);
+}
+
+// answer one message from the peer into out, returns messages written
+int sync_handle(struct sync_set *set, char *line, FILE *out) {
+    unsigned long long lo, hi, their_fp;
+    int their_count, used;
+    if (sscanf(line, "R %llu %llu %d %llx", &lo, &hi, &their_count, &their_fp) == 4 && lo < hi && hi <= SYNC_KEYS) {
+        int first = sync_lower(set, lo), last = sync_lower(set, hi);
+        uint64_t fp = 0;
+        for (int i = first; i < last; i++) fp ^= set->items[i].fp;
+        if (last - first == their_count && fp == their_fp) return 0;
+        if (last - first <= SYNC_LIST_MAX || hi - lo <= 1) {
+            sync_offer(set, out, lo, hi);
+            return 1;
+        }
+        uint64_t step = (hi - lo + SYNC_FANOUT - 1) / SYNC_FANOUT;
+        int sent = 0;
+        for (uint64_t sub = lo; sub < hi; sub += step, sent++) {
+            sync_offer(set, out, sub, sub + step < hi ? sub + step : hi);
+        }
+        return sent;
+    }
+    if (sscanf(line, "L %llu %llu%n", &lo, &hi, &used) == 2 && lo < hi && hi <= SYNC_KEYS) {
+        // their full list for the range: what we lack we ask for, the rest we give
+        struct path_table theirs;
+        path_table_init(&theirs, &cmd_arena);
+        char *save, *want = NULL;
+        size_t want_len = 0;
+        FILE *wants = open_memstream(&want, &want_len);
+        int wanted = 0;
+        int first = sync_lower(set, lo), last = sync_lower(set, hi);
+        struct path_table mine, my_ids, their_ids;
+        path_table_init(&mine, &cmd_arena);
+        path_table_init(&my_ids, &cmd_arena);
+        path_table_init(&their_ids, &cmd_arena);
+        for (int i = first; i < last; i++) {
+            path_add(&mine, set->items[i].name);
+            path_add(&my_ids, arena_printf(&cmd_arena, "%.*s", (int) sync_item_id_length(set->items[i].name),
+                                           set->items[i].name));
+        }
+        int conflicts = 0;
+        for (char *name = strtok_r(line + used, " ", &save); name; name = strtok_r(NULL, " ", &save)) {
+            path_add(&theirs, name);
+            path_add(&their_ids, arena_printf(&cmd_arena, "%.*s", (int) sync_item_id_length(name), name));
+            if (path_has(&mine, name)) continue;
+            if (path_has(&my_ids, arena_printf(&cmd_arena, "%.*s", (int) sync_item_id_length(name), name))) {
+                // same id, other contents: tell the peer, take nothing
+                sync_conflict(set, name);
+                fprintf(out, "X %s\n", name);
+                conflicts++;
+                continue;
+            }
+            fprintf(wants, " %s", name);
+            wanted++;
+        }
+        for (int i = first; i < last; i++) {
+            const char *name = set->items[i].name;
+            if (path_has(&theirs, name)) continue;
+            char *id = arena_printf(&cmd_arena, "%.*s", (int) sync_item_id_length(name), name);
+            if (path_has(&their_ids, id)) continue;
+            sync_give(set, name);
+        }
+        fclose(wants);
+        if (wanted) fprintf(out, "N%s\n", want);
+        set->want_count += wanted;
+        free(want);
+        path_table_free(&mine);
+        path_table_free(&my_ids);
+        path_table_free(&their_ids);
+        path_table_free(&theirs);
+        return (wanted ? 1 : 0) + conflicts;
+    }
+    if (line[0] == 'X' && line[1] == ' ') {
+        sync_conflict(set, line + 2);
+        return 0;
+    }
+    if (line[0] == 'N' && line[1] == ' ') {
+        char *save;
+        for (char *name = strtok_r(line + 2, " ", &save); name; name = strtok_r(NULL, " ", &save)) {
+            sync_give(set, name);
+        }
+        return 0;
+    }
+    fprintf(stderr, "Error: Bad sync message: %s\n", line);
+    return -1;
+}
+
+/*
+ * read one batch (ending in "."), answering into *reply. Returns the
+ * number of answers, -1 when the peer said it's done ("D"), -2 on error.
+ */
+int sync_round(struct sync_set *set, FILE *in, char **reply, size_t *reply_len) {
+    FILE *out = open_memstream(reply, reply_len);
+    char *line = NULL;
+    size_t capacity = 0;
+    int answers = 0, result = -2;
+    while (getline(&line, &capacity, in) > 0) {
+        line[strcspn(line, "\n")] = 0;
+        if (strcmp(line, ".") == 0) {
+            result = answers;
+            break;
+        }
+        if (strcmp(line, "D") == 0) {
+            result = -1;
+            break;
+        }
+        struct arena_mark mark = arena_save(&cmd_arena);
+        int n = sync_handle(set, line, out);
+        arena_restore(&cmd_arena, mark);
+        if (n < 0) break;
+        answers += n;
+    }
+    free(line);
+    fclose(out);
+    return result;
+}
+
+// send what the peer lacks: objects, then commits oldest first
+int sync_send(struct sync_set *set, FILE *out, int *objects_out, int *commits_out) {
+    char **objects = malloc((set->give_count + 1) * sizeof(char *));
+    char **commits = malloc((set->give_count + 1) * sizeof(char *));
+    int object_count = 0, commit_count = 0;
+    for (int i = 0; i < set->give_count; i++) {
+        if (set->give[i][0] == 'o') objects[object_count++] = set->give[i] + 1;
+        // commits go by id, without the digest
+        if (set->give[i][0] == 'c') {
+            int id_len = (int) sync_item_id_length(set->give[i]) - 1;
+            commits[commit_count++] = arena_printf(&set->arena, "%.*s", id_len, set->give[i] + 1);
+        }
+    }
+    qsort(commits, commit_count, sizeof(char *), compare_commit_id_ptrs);
+    int result = bundle_write(out, NULL, objects, object_count, commits, commit_count);
+    free(objects);
+    free(commits);
+    *objects_out = object_count;
+    *commits_out = commit_count;
+    return result;
+}
+
+// chdir into a repository given as its directory or its .mnemos directory
+int enter_repository(const char *repo_dir) {
+    const char *base = strrchr(repo_dir, '/');
+    base = base ? base + 1 : repo_dir;
+    char *root = strcmp(base, MNEMOS_DIR) == 0 ? arena_printf(&cmd_arena, "%s/..", repo_dir)
+                                               : arena_strdup(&cmd_arena, repo_dir);
+    if (chdir(root) != 0 || access(COMMITS_DIR, F_OK) != 0) {
+        fprintf(stderr, "Error: %s is not a Mnemos repository.\n", repo_dir);
+        return 1;
+    }
+    return 0;
+}
+
+// the far end of sync, speaking on stdin and stdout
+int sync_serve(const char *repo_dir) {
+    if (enter_repository(repo_dir) != 0) return 1;
+    repo_lock();
+    struct sync_set set;
+    sync_load(&set);
+
+    int result;
+    do {
+        char *reply;
+        size_t reply_len;
+        result = sync_round(&set, stdin, &reply, &reply_len);
+        if (result >= 0) {
+            fwrite(reply, 1, reply_len, stdout);
+            printf(".\n");
+            fflush(stdout);
         }
+        free(reply);
+    } while (result >= 0);
+    if (result != -1) {
+        sync_free(&set);
+        return 1;
+    }
+
+    struct stream_sum sum;
+    memset(&sum, 0, sizeof(sum));
+    struct bundle_result r;
+    const char *error = bundle_ingest(stdin, &sum, &r);
+    if (error) fprintf(stderr, "Error: Sync stream damaged (%s)\n", error);
+    int objects, commits;
+    int failed = sync_send(&set, stdout, &objects, &commits) != 0 || error;
+    sync_free(&set);
+    return failed;
+}
+
+// mnemos sync <remote name | user@host:/path | local path>
+int sync_repo(const char *target) {
+    struct stat st;
+    if (stat(COMMITS_DIR, &st) != 0) {
+        printf("Error: This is not a Mnemos repository. Initialize it first with 'mnemos init'.\n");
+        return 1;
+    }
+
+    char url[256];
+    snprintf(url, sizeof(url), "%s", target);
+    FILE *f = fopen(arena_printf(&cmd_arena, "%s/%s/url", REMOTES_DIR, target), "r");
+    if (f) {
+        if (fgets(url, sizeof(url), f)) url[strcspn(url, "\n")] = 0;
+        fclose(f);
+    }
+
+    char *command;
+    char *colon = strchr(url, ':');
+    if (colon && url[0] != '/' && url[0] != '.') {
+        command = arena_printf(&cmd_arena, "ssh %.*s 'mnemos sync-serve \"%s\"'",
+                               (int) (colon - url), url, colon + 1);
     } else {
-        printf("Invalid flag for moments. Use -n (newest) or -o (oldest).\n");
+        // the same mnemos as us serves the other side
+        char self[4096];
+        ssize_t n = readlink("/proc/self/exe", self, sizeof(self) - 1);
+        self[n > 0 ? n : 0] = 0;
+        command = arena_printf(&cmd_arena, "\"%s\" sync-serve \"%s\"", n > 0 ? self : "mnemos", url);
+    }
+
+    int to_peer[2], from_peer[2];
+    if (pipe(to_peer) != 0 || pipe(from_peer) != 0) {
+        perror("Failed to create pipes");
+        return 1;
+    }
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid < 0) {
+        perror("Failed to start sync peer");
+        return 1;
+    }
+    if (pid == 0) {
+        dup2(to_peer[0], STDIN_FILENO);
+        dup2(from_peer[1], STDOUT_FILENO);
+        close(to_peer[0]);
+        close(to_peer[1]);
+        close(from_peer[0]);
+        close(from_peer[1]);
+        execl("/bin/sh", "sh", "-c", command, (char *) NULL);
+        _exit(127);
+    }
+    close(to_peer[0]);
+    close(from_peer[1]);
+    FILE *out = fdopen(to_peer[1], "w");
+    FILE *in = fdopen(from_peer[0], "r");
+    signal(SIGPIPE, SIG_IGN);
+
+    struct sync_set set;
+    sync_load(&set);
+    sync_offer(&set, out, 0, SYNC_KEYS);
+    fprintf(out, ".\n");
+    fflush(out);
+
+    int rounds = 1, result;
+    while (1) {
+        char *reply;
+        size_t reply_len;
+        result = sync_round(&set, in, &reply, &reply_len);
+        if (result > 0) {
+            fwrite(reply, 1, reply_len, out);
+            fprintf(out, ".\n");
+            rounds++;
+        } else if (result == 0) {
+            fprintf(out, "D\n");
+        }
+        fflush(out);
+        free(reply);
+        if (result <= 0) break;
+    }
+
+    const char *error = result < 0 ? "peer hung up" : NULL;
+    int sent_objects = 0, sent_commits = 0;
+    struct bundle_result r;
+    memset(&r, 0, sizeof(r));
+    if (!error && sync_send(&set, out, &sent_objects, &sent_commits) != 0) error = "failed to send";
+    fclose(out);
+    if (!error) {
+        struct stream_sum sum;
+        memset(&sum, 0, sizeof(sum));
+        error = bundle_ingest(in, &sum, &r);
+    }
+    fclose(in);
+    int status;
+    waitpid(pid, &status, 0);
+    signal(SIGPIPE, SIG_DFL);
+    if (!error && !(WIFEXITED(status) && WEXITSTATUS(status) == 0)) error = "peer failed";
+
+    if (error) {
+        printf("Error: Sync with %s failed (%s).\n", url, error);
+        sync_free(&set);
+        return 1;
+    }
+    printf("Synced with %s in %d round trips: %d differences, sent %d objects and %d commits, "
+           "received %d new objects and %d new commits.\n",
+           url, rounds, set.give_count + set.want_count, sent_objects, sent_commits,
+           r.new_objects, r.commits);
+    for (int i = 0; i < set.conflict_count; i++) {
+        printf("Conflict: commit %s has different contents on the two sides, left as it is on both.\n",
+               set.conflicts[i]);
     }
+    int conflicts = set.conflict_count;
+    sync_free(&set);
+    return conflicts ? 1 : 0;
 }
 
-/* 
- * diff
+/*
+ * export: a commit as a tar stream on stdout, straight from its tree and
+ * objects/, without touching the work tree. Headers are ustar; paths or
+ * sizes that don't fit get a pax header first. Compressed formats pipe
+ * through gzip or zstd, which compress in their own process while we
+ * keep reading objects.
  */
-void diff_file(const char *filename, const char *commit1, const char *commit2, int latest_flag) {
-    char path1[512], path2[512];
-    struct stat st1, st2;
-    int result;
+#define TAR_BLOCK 512
 
-    if (latest_flag) {
-        // get latest commit hash
-        FILE *head_file = fopen(HEAD_FILE, "r");
-        if (!head_file) {
-            printf("Error: Could not open HEAD file to get the latest commit.\n");
-            return;
+struct tar_writer {
+    int fd;
+    long mtime;
+    int failed;
+};
+
+void tar_octal(char *field, size_t width, unsigned long long value) {
+    snprintf(field, width, "%0*llo", (int) width - 1, value);
+}
+
+void tar_header(struct tar_writer *w, const char *name, char type, int mode, long long size) {
+    char header[TAR_BLOCK];
+    memset(header, 0, sizeof(header));
+    size_t len = strlen(name);
+    if (len <= 100) {
+        memcpy(header, name, len);
+    } else {
+        // split into prefix and name at a slash, when one fits
+        const char *slash = name + len - 101;
+        while (*slash && *slash != '/') slash++;
+        if (*slash && slash - name <= 155 && slash[1]) {
+            memcpy(header + 345, name, slash - name);
+            memcpy(header, slash + 1, len - (slash - name) - 1);
+        } else {
+            memcpy(header, name, 100);
         }
+    }
+    tar_octal(header + 100, 8, mode);
+    tar_octal(header + 108, 8, 0);
+    tar_octal(header + 116, 8, 0);
+    tar_octal(header + 124, 12, size < 077777777777LL ? size : 0);
+    tar_octal(header + 136, 12, w->mtime);
+    memset(header + 148, ' ', 8);
+    header[156] = type;
+    memcpy(header + 257, "ustar", 6);
+    memcpy(header + 263, "00", 2);
+
+    unsigned int sum = 0;
+    for (int i = 0; i < TAR_BLOCK; i++) sum += (unsigned char) header[i];
+    snprintf(header + 148, 8, "%06o", sum);
+    if (write_full(w->fd, header, sizeof(header)) != 0) w->failed = 1;
+}
 
-        char latest_commit[HASH_SIZE];
-        if (!fgets(latest_commit, sizeof(latest_commit), head_file)) {
-            printf("Error: Could not read the latest commit hash from HEAD file.\n");
-            fclose(head_file);
-            return;
+void tar_pad(struct tar_writer *w, long long size) {
+    static const char zeros[TAR_BLOCK];
+    size_t pad = (TAR_BLOCK - size % TAR_BLOCK) % TAR_BLOCK;
+    if (pad && write_full(w->fd, zeros, pad) != 0) w->failed = 1;
+}
+
+// pax record "<len> <key>=<value>\n", where len counts itself
+void pax_record(char **records, const char *key, const char *value, struct arena *a) {
+    int body = strlen(key) + strlen(value) + 3;
+    int len = body + 1;
+    while ((int) snprintf(NULL, 0, "%d", len) + body != len) len++;
+    *records = arena_printf(a, "%s%d %s=%s\n", *records, len, key, value);
+}
+
+void tar_entry(struct tar_writer *w, const char *name, char type, int mode, long long size) {
+    char *records = "";
+    if (strlen(name) > 100) {
+        pax_record(&records, "path", name, &cmd_arena);
+    }
+    if (size >= 077777777777LL) {
+        pax_record(&records, "size", arena_printf(&cmd_arena, "%lld", size), &cmd_arena);
+    }
+    if (records[0]) {
+        size_t len = strlen(records);
+        tar_header(w, "././@PaxHeader", 'x', 0644, len);
+        if (write_full(w->fd, records, len) != 0) w->failed = 1;
+        tar_pad(w, len);
+    }
+    tar_header(w, name, type, mode, size);
+}
+
+int export_commit(const char *name, const char *format, const char *prefix) {
+    char commit[HASH_SIZE];
+    resolve_commit(name, commit);
+    struct stat st;
+    if (stat(arena_printf(&cmd_arena, "%s/%s", COMMITS_DIR, commit), &st) != 0) {
+        fprintf(stderr, "Error: Memory or commit '%s' not found\n", name);
+        return 1;
+    }
+
+    const char *compressor = NULL;
+    if (strcmp(format, "tar.gz") == 0) {
+        compressor = "gzip -c";
+    } else if (strcmp(format, "tar.zst") == 0) {
+        compressor = "zstd -q -c -T0";
+    } else if (strcmp(format, "tar") != 0) {
+        fprintf(stderr, "Error: Unknown format '%s', use tar, tar.gz or tar.zst\n", format);
+        return 1;
+    }
+    if (isatty(STDOUT_FILENO)) {
+        fprintf(stderr, "Error: Not writing an archive to a terminal, redirect stdout.\n");
+        return 1;
+    }
+
+    // prefix is a directory
+    char *root = "";
+    if (prefix && prefix[0]) {
+        root = prefix[strlen(prefix) - 1] == '/' ? arena_strdup(&cmd_arena, prefix)
+                                                 : arena_printf(&cmd_arena, "%s/", prefix);
+    }
+
+    fflush(stdout);
+    FILE *compress = compressor ? popen(compressor, "w") : NULL;
+    if (compressor && !compress) {
+        perror("Failed to start compressor");
+        return 1;
+    }
+    struct tar_writer w = { compress ? fileno(compress) : STDOUT_FILENO, read_commit_timestamp(commit), 0 };
+
+    struct tree_list tree;
+    load_tree(&tree, commit, "", &cmd_arena);
+    large_file_threshold();
+
+    // directories first time they're seen, the tree is sorted by path
+    struct path_table dirs;
+    path_table_init(&dirs, &cmd_arena);
+    if (root[0]) {
+        path_add(&dirs, root);
+        tar_entry(&w, root, '5', 0755, 0);
+    }
+    int missing = 0;
+    for (int i = 0; i < tree.count && !w.failed; i++) {
+        struct arena_mark mark = arena_save(&cmd_arena);
+        const char *path = tree.entries[i].path;
+        for (const char *slash = strchr(path, '/'); slash; slash = strchr(slash + 1, '/')) {
+            char *dir = arena_printf(&cmd_arena, "%s%.*s/", root, (int) (slash - path), path);
+            if (path_add(&dirs, dir)) tar_entry(&w, dir, '5', 0755, 0);
         }
-        fclose(head_file);
 
-        // trim newline if exists
-        latest_commit[strcspn(latest_commit, "\n")] = 0;
+        char object_path[OBJECT_PATH_SIZE];
+        object_find(object_path, tree.entries[i].hash);
+        int fd = open(object_path, O_RDONLY);
+        if (fd < 0 || fstat(fd, &st) != 0) {
+            fprintf(stderr, "Error: Object %s not found for file '%s'\n", tree.entries[i].hash, path);
+            if (fd >= 0) close(fd);
+            missing++;
+            arena_restore(&cmd_arena, mark);
+            continue;
+        }
+        tar_entry(&w, arena_printf(&cmd_arena, "%s%s", root, path), '0', 0644, st.st_size);
+        // big objects go through stream_fd's read-ahead
+        if (!w.failed && copy_fd(fd, w.fd) != 0) w.failed = 1;
+        close(fd);
+        tar_pad(&w, st.st_size);
+        arena_restore(&cmd_arena, mark);
+    }
 
-        // path to file in the latest commit
-        snprintf(path1, sizeof(path1), "%s/%s/%s", COMMITS_DIR, latest_commit, filename);
-        snprintf(path2, sizeof(path2), "%s", filename); // working directory file
+    // end of archive: two zero blocks
+    static const char zeros[2 * TAR_BLOCK];
+    if (!w.failed && write_full(w.fd, zeros, sizeof(zeros)) != 0) w.failed = 1;
+    if (compress && pclose(compress) != 0) w.failed = 1;
+    path_table_free(&dirs);
+    int count = tree.count;
+    free_tree(&tree);
+
+    if (w.failed) {
+        fprintf(stderr, "Error: Failed to write archive: %s\n", strerror(errno));
+        return 1;
+    }
+    if (missing) {
+        fprintf(stderr, "Error: %d files missing from the archive, run 'mnemos fsck'\n", missing);
+        return 1;
+    }
+    fprintf(stderr, "Exported %d files of moment %s\n", count - missing, commit);
+    return 0;
+}
+
+/*
+ * gc: drop objects no commit points to.
+ *
+ * Mark: every commit tree is walked in parallel, each entry's hash sets
+ * its bit in a bitmap over the sorted object list. Memories point at
+ * commits, so all commits are the roots.
+ * Sweep: unmarked objects older than the grace period are removed. With
+ * --max the sweep handles that many objects per run and remembers where
+ * it stopped in .mnemos/gc-cursor, so busy servers can run it in slices.
+ */
+#define GC_CURSOR_FILE ".mnemos/gc-cursor"
+#define GC_DEFAULT_GRACE_DAYS 14
+
+struct gc_mark {
+    struct object_order *order;  // reachability bitmaps, NULL when not enabled
+    struct object_list *objects;
+    char **commits;
+    uint64_t *bitmap;
+    int missing;
+};
+
+void gc_mark_hash(void *ctx, const char *path, const char *hash) {
+    struct gc_mark *gc = ctx;
+    (void) path;
+    int pos = find_object(gc->objects, hash);
+    if (pos >= 0) {
+        __sync_fetch_and_or(&gc->bitmap[pos / 64], (uint64_t) 1 << (pos % 64));
     } else {
-        // paths to files in specified commits
-        snprintf(path1, sizeof(path1), "%s/%s/%s", COMMITS_DIR, commit1, filename);
-        snprintf(path2, sizeof(path2), "%s/%s/%s", COMMITS_DIR, commit2, filename);
+        __sync_fetch_and_add(&gc->missing, 1);
     }
+}
 
-    // does file exist?
-    if (stat(path1, &st1) != 0) {
-        printf("Error: File '%s' does not exist in the specified commit or latest commit.\n", filename);
-        return;
+void gc_mark_commit(void *ctx, int i) {
+    struct gc_mark *gc = ctx;
+    struct arena a = {0};
+    if (!gc->order || bitmap_mark_commit(gc->order, gc->commits[i], gc_mark_hash, gc) != 0) {
+        for_each_tree_entry(arena_printf(&a, "%s/%s", COMMITS_DIR, gc->commits[i]),
+                            gc_mark_hash, gc, &a);
     }
-    if (stat(path2, &st2) != 0) {
-        printf("Error: File '%s' does not exist in the working directory or specified commit.\n", filename);
+    arena_free(&a);
+}
+
+void gc(int grace_days, int max_objects, int dry_run) {
+    struct stat st;
+    if (stat(OBJECTS_DIR, &st) != 0) {
+        printf("Error: This is not a Mnemos repository. Initialize it first with 'mnemos init'.\n");
+        exit(1);
+    }
+
+    struct object_list objects;
+    list_objects(&objects, &cmd_arena);
+    char **commits;
+    int commit_count = list_commit_ids(&commits, &cmd_arena);
+
+    struct object_order order;
+    int use_bitmaps = load_object_order(&order, &cmd_arena) == 0;
+
+    struct gc_mark mark = { use_bitmaps ? &order : NULL, &objects, commits, NULL, 0 };
+    mark.bitmap = calloc(objects.count / 64 + 1, sizeof(uint64_t));
+    parallel_for(commit_count, gc_mark_commit, &mark);
+
+    int reachable = 0;
+    for (int i = 0; i < objects.count; i++) {
+        if (mark.bitmap[i / 64] & ((uint64_t) 1 << (i % 64))) reachable++;
+    }
+    printf("Marked %d of %d objects reachable from %d commits.\n",
+           reachable, objects.count, commit_count);
+    if (mark.missing > 0) {
+        printf("Warning: %d commit entries point to missing objects.\n", mark.missing);
+    }
+
+    // resume the sweep after the last object handled by the previous slice
+    int start = 0;
+    char cursor[HASH_SIZE] = {0};
+    if (max_objects > 0 && read_hash_file(GC_CURSOR_FILE, cursor) == 0) {
+        while (start < objects.count && strcmp(objects.names[start], cursor) <= 0) start++;
+        if (start == objects.count) start = 0;
+    }
+    int limit = max_objects > 0 && max_objects < objects.count ? max_objects : objects.count;
+
+    time_t cutoff = time(NULL) - (time_t) grace_days * 24 * 60 * 60;
+    int removed = 0, kept = 0;
+    long long removed_bytes = 0;
+    int i = start;
+    for (int n = 0; n < limit; n++, i = (i + 1) % objects.count) {
+        if (mark.bitmap[i / 64] & ((uint64_t) 1 << (i % 64))) continue;
+
+        char object_path[OBJECT_PATH_SIZE];
+        object_find(object_path, objects.names[i]);
+        if (stat(object_path, &st) != 0) continue;
+        if (st.st_mtime > cutoff) {
+            kept++;
+            continue;
+        }
+        if (dry_run) {
+            printf("Would remove: %s\n", objects.names[i]);
+        } else if (unlink(object_path) != 0) {
+            perror("Failed to remove object");
+            continue;
+        } else {
+            unlink(arena_printf(&cmd_arena, "%s/%s", BLOCK_SUMS_DIR, objects.names[i]));
+            if (use_bitmaps) object_order_forget(&order, objects.names[i]);
+        }
+        removed++;
+        removed_bytes += st.st_size;
+    }
+
+    if (max_objects > 0 && objects.count > 0 && !dry_run) {
+        int last = (i + objects.count - 1) % objects.count;
+        FILE *f = fopen(GC_CURSOR_FILE, "w");
+        if (f) {
+            // a full lap starts over from the beginning next time
+            fprintf(f, "%s\n", limit == objects.count ? "" : objects.names[last]);
+            fclose(f);
+        }
+    }
+
+    printf("%s %d unreachable objects (%lld bytes), kept %d younger than %d days.\n",
+           dry_run ? "Would remove" : "Removed", removed, removed_bytes, kept, grace_days);
+
+    if (use_bitmaps) {
+        if (!dry_run) save_object_order(&order);
+        free_object_order(&order);
+    }
+
+    free(mark.bitmap);
+    free(objects.names);
+    free(commits);
+}
+
+// count-objects: object and size stats, from bitmaps when they are enabled
+void count_objects() {
+    char **commits;
+    int commit_count = list_commit_ids(&commits, &cmd_arena);
+    long long total = 0, total_bytes = 0, reachable = 0, reachable_bytes = 0;
+
+    struct object_order order;
+    if (load_object_order(&order, &cmd_arena) == 0) {
+        struct bitmap reach = {0};
+        union_bitmaps(&order, commits, commit_count, &reach);
+        for (int pos = 0; pos < order.count; pos++) {
+            if (bitmap_get(&order.removed, pos)) continue;
+            total++;
+            total_bytes += order.sizes[pos];
+            if (bitmap_get(&reach, pos)) {
+                reachable++;
+                reachable_bytes += order.sizes[pos];
+            }
+        }
+        bitmap_free(&reach);
+        free_object_order(&order);
+    } else {
+        // no bitmaps: walk every commit tree like gc does
+        struct object_list objects;
+        list_objects(&objects, &cmd_arena);
+        struct gc_mark mark = { NULL, &objects, commits, NULL, 0 };
+        mark.bitmap = calloc(objects.count / 64 + 1, sizeof(uint64_t));
+        parallel_for(commit_count, gc_mark_commit, &mark);
+
+        for (int i = 0; i < objects.count; i++) {
+            char object_path[OBJECT_PATH_SIZE];
+            object_find(object_path, objects.names[i]);
+            struct stat st;
+            long long size = stat(object_path, &st) == 0 ? (long long) st.st_size : 0;
+            total++;
+            total_bytes += size;
+            if (mark.bitmap[i / 64] & ((uint64_t) 1 << (i % 64))) {
+                reachable++;
+                reachable_bytes += size;
+            }
+        }
+        free(mark.bitmap);
+        free(objects.names);
+    }
+
+    printf("Commits:     %d\n", commit_count);
+    printf("Objects:     %lld (%lld bytes)\n", total, total_bytes);
+    printf("Reachable:   %lld (%lld bytes)\n", reachable, reachable_bytes);
+    printf("Unreachable: %lld (%lld bytes)\n", total - reachable, total_bytes - reachable_bytes);
+    free(commits);
+}
+
+/*
+ * fanout: `mnemos fanout <depth>` sets object-fanout and moves every object
+ * into that layout. The setting is written first, so objects stored from
+ * then on already go to the new place; the move itself is one rename per
+ * object, spread over the io threads. Readers find an object in whichever
+ * layout it is in at the time and never wait for the move.
+ */
+struct fanout_move {
+    struct object_list *objects;
+    int depth;
+    int moved;
+    int failed;
+};
+
+// worker: rename every copy of object i that is in another layout
+void fanout_move_one(void *ctx, int i) {
+    struct fanout_move *m = ctx;
+    const char *name = m->objects->names[i];
+    for (int depth = 0; depth <= OBJECT_FANOUT_MAX; depth++) {
+        if (depth == m->depth) continue;
+        char from[OBJECT_PATH_SIZE];
+        object_path_at(from, name, depth);
+        if (access(from, F_OK) != 0) continue;
+        // same content under the same name, so landing on a copy is fine
+        if (object_publish(from, name) == 0) {
+            __sync_fetch_and_add(&m->moved, 1);
+        } else if (errno != ENOENT) {
+            __sync_fetch_and_add(&m->failed, 1);
+        }
+    }
+}
+
+// remove fan-out directories the move left empty
+void fanout_prune_dirs(const char *dir_path, int level) {
+    DIR *dir = opendir(dir_path);
+    if (!dir) return;
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+        if (!is_fanout_dir(entry->d_name)) continue;
+        char path[OBJECT_PATH_SIZE];
+        snprintf(path, sizeof(path), "%s/%.2s", dir_path, entry->d_name);
+        if (level + 1 < OBJECT_FANOUT_MAX) fanout_prune_dirs(path, level + 1);
+        rmdir(path);
+    }
+    closedir(dir);
+}
+
+int fanout(const char *depth_arg) {
+    char *end;
+    long depth = strtol(depth_arg, &end, 10);
+    if (end == depth_arg || *end || depth < 0 || depth > OBJECT_FANOUT_MAX) {
+        printf("Error: Fan-out depth must be 0 to %d.\n", OBJECT_FANOUT_MAX);
+        return 1;
+    }
+    struct stat st;
+    if (stat(OBJECTS_DIR, &st) != 0) {
+        printf("Error: This is not a Mnemos repository. Initialize it first with 'mnemos init'.\n");
+        return 1;
+    }
+
+    config_set("object-fanout", depth_arg);
+    object_fanout_depth = (int) depth;
+
+    struct object_list objects;
+    list_objects(&objects, &cmd_arena);
+    struct fanout_move m = { &objects, (int) depth, 0, 0 };
+    io_batch(objects.count, fanout_move_one, &m);
+    fanout_prune_dirs(OBJECTS_DIR, 0);
+    free(objects.names);
+
+    printf("Moved %d of %d objects to fan-out depth %ld.\n", m.moved, objects.count, depth);
+    if (m.failed) {
+        printf("Error: %d objects could not be moved; run fanout again to retry.\n", m.failed);
+        return 1;
+    }
+    return 0;
+}
+
+/*
+ * import: `git fast-export --all | mnemos import` writes objects, commit
+ * trees, history index and commit stats directly, instead of replaying
+ * every commit through track and commit.
+ *
+ * Blobs and commits are read into a batch (import-batch-size bytes of
+ * blob data, default 64m, or about IMPORT_BATCH_ENTRIES tree entries).
+ * A flush hashes and stores the blobs on the I/O pool, applies the
+ * batch's commits to the tree held in memory, then writes them on the
+ * pool too: changed entries as new files, unchanged ones as hard links
+ * to the file that already holds that path's hash. Blobs at or above
+ * large-file-threshold are streamed to their object as they arrive.
+ *
+ * Marks live in an unlinked temp file, IMPORT_MARK_SIZE bytes per mark
+ * number, behind a small direct-mapped cache, so memory doesn't grow
+ * with the history. Commit ids are the committer time, moved up to the
+ * next free second when taken. Branches and tags become memories
+ * (refs/heads/x is x, refs/tags/x is tags/x); merges keep only their
+ * first parent, and submodule entries are skipped.
+ */
+#define IMPORT_MARK_CACHE 65536
+#define IMPORT_BATCH_ENTRIES 262144
+#define IMPORT_BATCH_COMMITS 1024
+
+#define MARK_NONE 0
+#define MARK_BLOB 1
+#define MARK_COMMIT 2
+
+struct import_mark {
+    uint64_t mark;
+    uint32_t kind;      // MARK_*
+    uint32_t hash;      // of a blob
+    uint64_t value;     // blob size or commit id
+};
+
+#define IMPORT_MARK_SIZE sizeof(struct import_mark)
+
+struct import_blob {
+    char *data;
+    size_t size;
+    uint64_t mark;      // 0 for inline data
+    uint32_t hash;
+    int error;
+};
+
+struct import_op {
+    char kind;          // M, D, C (copy), R (rename), X (deleteall)
+    char *path;
+    char *to;           // of C and R
+    uint64_t mark;      // blob of M, or
+    int blob;           // its inline blob in the batch, -1
+};
+
+struct import_commit {
+    uint64_t id;
+    uint64_t parent;    // 0 for a root commit
+    long timestamp;
+    char *message;
+    int first_op;
+    int op_count;
+};
+
+struct import_ref {
+    char *name;
+    uint64_t tip;
+};
+
+// a file of one commit to write: its hash, or a link to src
+struct import_entry {
+    char *dest;
+    char *src;
+    uint32_t hash;
+    int commit;         // in import->pending
+    int error;
+};
+
+// a commit to write: its directories, message and timestamp
+struct import_dirs {
+    char *build;
+    uint32_t *dirs;     // path ids, parents first
+    int dir_count;
+    struct import_commit *commit;
+    int error;
+};
+
+// a commit written but not yet renamed into place
+struct import_written {
+    char id[HASH_SIZE];
+    char parent[HASH_SIZE];
+    long timestamp;
+    uint32_t dir;       // in import->dir_names
+    struct bloom_build bloom;
+    struct commit_stat stat;
+};
+
+// a path's state before the commit being applied touched it
+struct import_touch {
+    uint32_t id;
+    int member;
+    uint32_t hash;
+    uint64_t size;
+};
+
+struct import {
+    int marks_fd;
+    struct import_mark *mark_cache;
+    struct path_table taken;    // commit ids used, as strings
+    struct import_ref *refs;
+    int ref_count;
+
+    // batch read from the stream
+    struct arena batch_arena;
+    struct import_blob *blobs;
+    int blob_count, blob_capacity;
+    size_t blob_bytes, batch_limit;
+    struct import_op *ops;
+    int op_count, op_capacity;
+    struct import_commit *commits;
+    int commit_count, commit_capacity;
+    long batch_entries;
+
+    // the tree of commit `base`; PATH_MEMBER marks the files in it
+    struct arena tree_arena;
+    struct path_table tree;
+    uint32_t *hashes;
+    uint64_t *sizes;
+    uint32_t *sources;  // dir_names index of the commit whose file holds the hash
+    uint32_t *stamps;   // sequence number of the last commit touching or listing the path
+    uint32_t tree_capacity;
+    uint64_t base;
+    long files;
+    long long bytes;
+    uint32_t seq;
+    struct import_touch *touched;
+    int touch_count, touch_capacity;
+
+    // commit directories, build dirs until renamed
+    char **dir_names;
+    uint32_t dir_count, dir_capacity;
+
+    // applied commits waiting to be written
+    struct arena write_arena;
+    struct import_entry *entries;
+    int entry_count, entry_capacity;
+    struct import_dirs *pending;
+    struct import_written *written;
+    int pending_count, pending_capacity;
+
+    long long large_threshold;
+    int blob_total, commit_total, skipped;
+};
+
+void import_marks_set(struct import *im, uint64_t mark, uint32_t kind, uint32_t hash, uint64_t value) {
+    struct import_mark m = { mark, kind, hash, value };
+    im->mark_cache[mark % IMPORT_MARK_CACHE] = m;
+    if (pwrite(im->marks_fd, &m, sizeof(m), mark * IMPORT_MARK_SIZE) != sizeof(m)) {
+        perror("Failed to write mark table");
+        exit(1);
+    }
+}
+
+struct import_mark import_marks_get(struct import *im, uint64_t mark) {
+    struct import_mark *cached = &im->mark_cache[mark % IMPORT_MARK_CACHE];
+    if (cached->mark == mark && cached->kind != MARK_NONE) return *cached;
+    struct import_mark m;
+    memset(&m, 0, sizeof(m));
+    if (pread(im->marks_fd, &m, sizeof(m), mark * IMPORT_MARK_SIZE) != sizeof(m) || m.mark != mark) {
+        m.kind = MARK_NONE;
+    }
+    return m;
+}
+
+struct import_ref *import_ref(struct import *im, const char *name) {
+    for (int i = 0; i < im->ref_count; i++) {
+        if (strcmp(im->refs[i].name, name) == 0) return &im->refs[i];
+    }
+    im->refs = realloc(im->refs, (im->ref_count + 1) * sizeof(struct import_ref));
+    struct import_ref *r = &im->refs[im->ref_count++];
+    r->name = strdup(name);
+    r->tip = 0;
+    return r;
+}
+
+// a "from" or "merge" argument: a commit mark or a ref, 0 if unknown
+uint64_t import_commitish(struct import *im, const char *arg) {
+    if (arg[0] == ':') {
+        struct import_mark m = import_marks_get(im, strtoull(arg + 1, NULL, 10));
+        return m.kind == MARK_COMMIT ? m.value : 0;
+    }
+    char *name = strdup(arg);
+    name[strcspn(name, "^")] = 0;
+    uint64_t tip = import_ref(im, name)->tip;
+    free(name);
+    return tip;
+}
+
+uint64_t import_commit_id(struct import *im, long timestamp) {
+    uint64_t id = timestamp > 0 ? (uint64_t) timestamp : 1;
+    while (1) {
+        char *name = arena_printf(&cmd_arena, "%lx", (unsigned long) id);
+        if (!path_has(&im->taken, name) && access(arena_printf(&cmd_arena, "%s/%s", COMMITS_DIR, name), F_OK) != 0) {
+            path_add(&im->taken, name);
+            return id;
+        }
+        id++;
+    }
+}
+
+// a path from the stream, C-style quoted or as is; *end is left past it
+char *import_path(char *s, char **end, int to_space, struct arena *a) {
+    if (*s != '"') {
+        size_t len = to_space ? strcspn(s, " ") : strlen(s);
+        *end = s + len + (s[len] == ' ');
+        return arena_printf(a, "%.*s", (int) len, s);
+    }
+    char *out = arena_alloc(a, strlen(s) + 1), *o = out;
+    for (s++; *s && *s != '"'; s++) {
+        if (*s != '\\' || !s[1]) {
+            *o++ = *s;
+            continue;
+        }
+        s++;
+        switch (*s) {
+            case 'n': *o++ = '\n'; break;
+            case 't': *o++ = '\t'; break;
+            case 'a': *o++ = '\a'; break;
+            case 'b': *o++ = '\b'; break;
+            case 'f': *o++ = '\f'; break;
+            case 'r': *o++ = '\r'; break;
+            case 'v': *o++ = '\v'; break;
+            default:
+                if (*s >= '0' && *s <= '7') {
+                    int c = 0;
+                    for (int i = 0; i < 3 && *s >= '0' && *s <= '7'; i++, s++) c = c * 8 + (*s - '0');
+                    s--;
+                    *o++ = (char) c;
+                } else {
+                    *o++ = *s;
+                }
+        }
+    }
+    *o = 0;
+    if (*s == '"') s++;
+    if (*s == ' ') s++;
+    *end = s;
+    return out;
+}
+
+// read the "data <n>" payload that follows; -1 on a bad or short stream
+long long import_data_size(FILE *in, char **line, size_t *capacity) {
+    if (getline(line, capacity, in) == -1) return -1;
+    long long size;
+    if (sscanf(*line, "data %lld", &size) != 1 || size < 0) return -1;
+    return size;
+}
+
+// the LF after data is optional
+void import_data_end(FILE *in) {
+    int c = getc(in);
+    if (c != '\n' && c != EOF) ungetc(c, in);
+}
+
+char *import_read_data(FILE *in, long long size) {
+    char *data = malloc(size + 1);
+    if (fread(data, 1, size, in) != (size_t) size) {
+        free(data);
+        return NULL;
+    }
+    data[size] = 0;
+    import_data_end(in);
+    return data;
+}
+
+int import_skip_data(FILE *in, long long size) {
+    char buffer[65536];
+    while (size > 0) {
+        size_t n = fread(buffer, 1, size < (long long) sizeof(buffer) ? (size_t) size : sizeof(buffer), in);
+        if (n == 0) return -1;
+        size -= n;
+    }
+    import_data_end(in);
+    return 0;
+}
+
+// a blob too big to hold: stream it into its object now
+int import_large_blob(struct import *im, FILE *in, long long size, uint64_t mark) {
+    char temp_path[] = OBJECTS_DIR "/.tmp-XXXXXX";
+    int fd = mkstemp(temp_path);
+    if (fd < 0) return -1;
+    char *buffer = malloc(STREAM_BUFFER_SIZE);
+    struct stream_sum sum;
+    memset(&sum, 0, sizeof(sum));
+    int result = 0;
+    for (long long left = size; left > 0 && result == 0;) {
+        size_t n = fread(buffer, 1, left < STREAM_BUFFER_SIZE ? left : STREAM_BUFFER_SIZE, in);
+        if (n == 0 || write_full(fd, buffer, n) != 0) result = -1;
+        sum_update(&sum, buffer, n);
+        left -= n;
+    }
+    free(buffer);
+    import_data_end(in);
+    fchmod(fd, 0644);
+    if (close(fd) != 0) result = -1;
+    char hash[HASH_SIZE];
+    sum_final(&sum, hash);
+    if (result != 0 || (!object_exists(hash) && object_publish(temp_path, hash) != 0)) {
+        unlink(temp_path);
+        return -1;
+    }
+    unlink(temp_path);
+    if (mark) import_marks_set(im, mark, MARK_BLOB, sum.hash, size);
+    im->blob_total++;
+    return 0;
+}
+
+// queue a blob held in memory, its index in the batch
+int import_queue_blob(struct import *im, char *data, size_t size, uint64_t mark) {
+    if (im->blob_count == im->blob_capacity) {
+        im->blob_capacity = im->blob_capacity ? im->blob_capacity * 2 : 1024;
+        im->blobs = realloc(im->blobs, im->blob_capacity * sizeof(struct import_blob));
+    }
+    struct import_blob *b = &im->blobs[im->blob_count];
+    memset(b, 0, sizeof(*b));
+    b->data = data;
+    b->size = size;
+    b->mark = mark;
+    im->blob_bytes += size;
+    return im->blob_count++;
+}
+
+// worker: hash a blob and store it unless its object exists
+void import_store_blob(void *ctx, int i) {
+    struct import_blob *b = &((struct import *) ctx)->blobs[i];
+    struct stream_sum sum;
+    memset(&sum, 0, sizeof(sum));
+    sum_update(&sum, b->data, b->size);
+    char hash[HASH_SIZE];
+    sum_final(&sum, hash);
+    b->hash = sum.hash;
+
+    if (object_exists(hash)) return;
+    char temp_path[] = OBJECTS_DIR "/.tmp-XXXXXX";
+    int fd = mkstemp(temp_path);
+    if (fd < 0) {
+        b->error = errno;
         return;
     }
+    int result = write_full(fd, b->data, b->size);
+    fchmod(fd, 0644);
+    if (close(fd) != 0) result = -1;
+    if (result != 0 || object_publish(temp_path, hash) != 0) {
+        b->error = errno ? errno : EIO;
+        unlink(temp_path);
+    }
+}
 
-    // execute diff command with color
-    char command[1024];
-    snprintf(command, sizeof(command), "diff --color=always %s %s", path1, path2);
-    result = system(command);
+int compare_u32(const void *a, const void *b) {
+    uint32_t x = *(const uint32_t *) a, y = *(const uint32_t *) b;
+    return x < y ? -1 : x > y;
+}
 
-    if (result == 0) {
-        printf("Files are identical.\n");
-    } else if (result == 256) { // exit code 1 translates to 256 in system
-        printf("Files differ.\n");
+void import_tree_grow(struct import *im) {
+    if (im->tree.count <= im->tree_capacity) return;
+    uint32_t old = im->tree_capacity;
+    im->tree_capacity = im->tree.capacity;
+    im->hashes = realloc(im->hashes, im->tree_capacity * sizeof(uint32_t));
+    im->sizes = realloc(im->sizes, im->tree_capacity * sizeof(uint64_t));
+    im->sources = realloc(im->sources, im->tree_capacity * sizeof(uint32_t));
+    im->stamps = realloc(im->stamps, im->tree_capacity * sizeof(uint32_t));
+    memset(im->stamps + old, 0, (im->tree_capacity - old) * sizeof(uint32_t));
+}
+
+int import_member(struct import *im, uint32_t id) {
+    return id != PATH_NONE && (im->tree.nodes[id].flags & PATH_MEMBER);
+}
+
+// change one path of the commit being applied, remembering how it was
+void import_set(struct import *im, uint32_t id, int member, uint32_t hash, uint64_t size) {
+    if (im->stamps[id] != im->seq) {
+        im->stamps[id] = im->seq;
+        if (im->touch_count == im->touch_capacity) {
+            im->touch_capacity = im->touch_capacity ? im->touch_capacity * 2 : 256;
+            im->touched = realloc(im->touched, im->touch_capacity * sizeof(struct import_touch));
+        }
+        struct import_touch *t = &im->touched[im->touch_count++];
+        t->id = id;
+        t->member = import_member(im, id);
+        t->hash = im->hashes[id];
+        t->size = im->sizes[id];
+    }
+    if (import_member(im, id)) {
+        im->files--;
+        im->bytes -= im->sizes[id];
+    }
+    if (member) {
+        im->tree.nodes[id].flags |= PATH_MEMBER;
+        im->hashes[id] = hash;
+        im->sizes[id] = size;
+        im->files++;
+        im->bytes += size;
     } else {
-        printf("Error running diff command.\n");
+        im->tree.nodes[id].flags &= ~PATH_MEMBER;
+    }
+}
+
+int import_under(struct import *im, uint32_t id, uint32_t dir) {
+    for (uint32_t n = id; n != PATH_ROOT; n = im->tree.nodes[n].parent) {
+        if (n == dir) return 1;
+    }
+    return 0;
+}
+
+// files at path or below it
+int import_subtree(struct import *im, const char *path, uint32_t **ids_out) {
+    uint32_t dir = path_lookup(&im->tree, path);
+    int count = 0;
+    *ids_out = NULL;
+    if (dir == PATH_NONE) return 0;
+    for (uint32_t id = 1; id < im->tree.count; id++) {
+        if (!import_member(im, id) || !import_under(im, id, dir)) continue;
+        *ids_out = realloc(*ids_out, (count + 1) * sizeof(uint32_t));
+        (*ids_out)[count++] = id;
+    }
+    return count;
+}
+
+// C and R: a file or a whole directory
+void import_copy(struct import *im, const char *from, const char *to, int remove) {
+    uint32_t *ids;
+    int count = import_subtree(im, from, &ids);
+    if (count == 0) return;
+    uint32_t from_id = path_lookup(&im->tree, from);
+    size_t from_len = strlen(path_string(&im->tree, from_id, &cmd_arena));
+    for (int i = 0; i < count; i++) {
+        char *path = path_string(&im->tree, ids[i], &cmd_arena);
+        uint32_t hash = im->hashes[ids[i]];
+        uint64_t size = im->sizes[ids[i]];
+        if (remove) import_set(im, ids[i], 0, 0, 0);
+        uint32_t id = path_intern(&im->tree, arena_printf(&cmd_arena, "%s%s", to, path + from_len));
+        import_tree_grow(im);
+        import_set(im, id, 1, hash, size);
+    }
+    free(ids);
+}
+
+void import_tree_add(void *ctx, const char *path, const char *hash) {
+    struct import *im = ctx;
+    uint32_t id = path_intern(&im->tree, path);
+    import_tree_grow(im);
+    im->tree.nodes[id].flags |= PATH_MEMBER;
+    im->hashes[id] = strtoul(hash, NULL, 16);
+    im->sizes[id] = object_size(hash);
+    im->sources[id] = im->dir_count - 1;
+    im->files++;
+    im->bytes += im->sizes[id];
+}
+
+uint32_t import_add_dir(struct import *im, char *name) {
+    if (im->dir_count == im->dir_capacity) {
+        im->dir_capacity = im->dir_capacity ? im->dir_capacity * 2 : 1024;
+        im->dir_names = realloc(im->dir_names, im->dir_capacity * sizeof(char *));
+    }
+    im->dir_names[im->dir_count] = name;
+    return im->dir_count++;
+}
+
+// start from another commit's tree, read from its directory
+void import_load_base(struct import *im, uint64_t commit) {
+    for (uint32_t id = 1; id < im->tree.count; id++) im->tree.nodes[id].flags &= ~PATH_MEMBER;
+    im->files = 0;
+    im->bytes = 0;
+    im->base = commit;
+    if (!commit) return;
+    char *name = arena_printf(&cmd_arena, "%lx", (unsigned long) commit);
+    import_add_dir(im, strdup(arena_printf(&cmd_arena, "%s/%s", COMMITS_DIR, name)));
+    for_each_tree_entry(im->dir_names[im->dir_count - 1], import_tree_add, im, &cmd_arena);
+}
+
+// worker: a commit's directories, message and timestamp
+void import_write_dirs(void *ctx, int i) {
+    struct import *im = ctx;
+    struct import_dirs *d = &im->pending[i];
+    struct arena a = {0};
+    for (int j = 0; j < d->dir_count && !d->error; j++) {
+        char *path = arena_printf(&a, "%s/%s", d->build, path_string(&im->tree, d->dirs[j], &a));
+        if (mkdir(path, 0755) != 0 && errno != EEXIST) d->error = errno;
     }
+    FILE *f = fopen(arena_printf(&a, "%s/message", d->build), "w");
+    if (f) {
+        fprintf(f, "message: %s\n", d->commit->message);
+        if (fclose(f) != 0) d->error = errno;
+    } else {
+        d->error = errno;
+    }
+    f = fopen(arena_printf(&a, "%s/timestamp", d->build), "w");
+    if (f) {
+        fprintf(f, "%ld\n", d->commit->timestamp);
+        if (fclose(f) != 0) d->error = errno;
+    } else {
+        d->error = errno;
+    }
+    arena_free(&a);
+}
+
+// worker: one entry, written or linked to the file holding the same hash
+void import_write_entry(void *ctx, int i) {
+    struct import_entry *e = &((struct import *) ctx)->entries[i];
+    if (e->src && link(e->src, e->dest) == 0) return;
+    // too many links to one file ends up here too
+    char content[HASH_SIZE + 1];
+    int len = snprintf(content, sizeof(content), "%08x\n", e->hash);
+    int fd = open(e->dest, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0 || write_full(fd, content, len) != 0) e->error = errno ? errno : EIO;
+    if (fd >= 0 && close(fd) != 0) e->error = errno;
+}
+
+int import_is_link_phase(void *ctx, int i) {
+    return ((struct import *) ctx)->entries[i].src != NULL;
 }
 
-// copy file
-void copy_file(const char *src, const char *dest) {
-    FILE *source = fopen(src, "r");
-    if (!source) {
-        perror("Failed to open source file");
-        exit(1);
-    }
+void import_write_new(void *ctx, int i) {
+    if (!import_is_link_phase(ctx, i)) import_write_entry(ctx, i);
+}
 
-    FILE *destination = fopen(dest, "w");
-    if (!destination) {
-        perror("Failed to open destination file");
-        fclose(source);
-        exit(1);
+void import_write_links(void *ctx, int i) {
+    if (import_is_link_phase(ctx, i)) import_write_entry(ctx, i);
+}
+
+// write every applied commit and rename it into place, oldest first
+void import_write(struct import *im) {
+    if (im->pending_count == 0) return;
+    io_batch(im->pending_count, import_write_dirs, im);
+    // links point at files written in the first pass, or in earlier batches
+    io_batch(im->entry_count, import_write_new, im);
+    io_batch(im->entry_count, import_write_links, im);
+
+    for (int j = 0; j < im->entry_count; j++) {
+        struct import_dirs *d = &im->pending[im->entries[j].commit];
+        if (im->entries[j].error && !d->error) d->error = im->entries[j].error;
     }
 
-    char buffer[1024];
-    size_t bytes;
-    while ((bytes = fread(buffer, 1, sizeof(buffer), source)) > 0) {
-        fwrite(buffer, 1, bytes, destination);
+    FILE *history = fopen(HISTORY_INDEX_FILE, "a");
+    FILE *stats = fopen(COMMIT_STATS_FILE, "a");
+    for (int i = 0; i < im->pending_count; i++) {
+        struct import_dirs *d = &im->pending[i];
+        struct import_written *w = &im->written[i];
+        char *commit_dir = arena_printf(&cmd_arena, "%s/%s", COMMITS_DIR, w->id);
+        if (d->error || rename(d->build, commit_dir) != 0) {
+            if (!d->error) d->error = errno;
+            fprintf(stderr, "Error: Failed to write commit %s: %s\n", w->id, strerror(d->error));
+            for (int j = i; j < im->pending_count; j++) remove_recursive(im->pending[j].build);
+            exit(1);
+        }
+        free(im->dir_names[w->dir]);
+        im->dir_names[w->dir] = strdup(commit_dir);
+        if (history) history_write_bloom(history, w->id, w->parent, w->timestamp, &w->bloom);
+        if (stats) commit_stat_append(stats, &w->stat);
+        free(w->bloom.bloom);
+        im->commit_total++;
     }
+    if (history) fclose(history);
+    if (stats) fclose(stats);
 
-    fclose(source);
-    fclose(destination);
+    im->entry_count = 0;
+    im->pending_count = 0;
+    arena_free(&im->write_arena);
 }
 
-// remote repository
-void set_remote(const char *remote_path) {
-    FILE *remote = fopen(REMOTE_FILE, "w");
-    if (!remote) {
-        perror("Failed to set remote");
-        exit(1);
+void import_add_entry(struct import *im, char *dest, char *src, uint32_t hash) {
+    if (im->entry_count == im->entry_capacity) {
+        im->entry_capacity = im->entry_capacity ? im->entry_capacity * 2 : 4096;
+        im->entries = realloc(im->entries, im->entry_capacity * sizeof(struct import_entry));
     }
-    fprintf(remote, "%s\n", remote_path);
-    fclose(remote);
-
-    printf("Remote set to: %s\n", remote_path);
+    struct import_entry *e = &im->entries[im->entry_count++];
+    e->dest = dest;
+    e->src = src;
+    e->hash = hash;
+    e->commit = im->pending_count - 1;
+    e->error = 0;
 }
 
-/* SEND - remote
-*/
-void send() {
-    FILE *remote = fopen(REMOTE_FILE, "r");
-    if (!remote) {
-        printf("No remote configured. Use 'mnemos remote <path>' to set one.\n");
-        exit(1);
+// apply one commit's changes to the tree and queue its files
+void import_apply(struct import *im, struct import_commit *c) {
+    if (c->parent != im->base) {
+        // its parent must be on disk to be read back
+        import_write(im);
+        import_load_base(im, c->parent);
+    }
+    im->seq++;
+    im->touch_count = 0;
+    for (int i = c->first_op; i < c->first_op + c->op_count; i++) {
+        struct import_op *op = &im->ops[i];
+        if (op->kind == 'X') {
+            for (uint32_t id = 1; id < im->tree.count; id++) {
+                if (import_member(im, id)) import_set(im, id, 0, 0, 0);
+            }
+        } else if (op->kind == 'D') {
+            uint32_t *ids;
+            int count = import_subtree(im, op->path, &ids);
+            for (int j = 0; j < count; j++) import_set(im, ids[j], 0, 0, 0);
+            free(ids);
+        } else if (op->kind == 'C' || op->kind == 'R') {
+            import_copy(im, op->path, op->to, op->kind == 'R');
+        } else if (op->kind == 'M') {
+            uint32_t hash;
+            uint64_t size;
+            if (op->blob >= 0) {
+                hash = im->blobs[op->blob].hash;
+                size = im->blobs[op->blob].size;
+            } else {
+                struct import_mark m = import_marks_get(im, op->mark);
+                if (m.kind != MARK_BLOB) {
+                    fprintf(stderr, "Error: Mark :%llu is not a blob, needed by '%s'\n",
+                            (unsigned long long) op->mark, op->path);
+                    exit(1);
+                }
+                hash = m.hash;
+                size = m.value;
+            }
+            // a file replacing a directory, or the other way around
+            uint32_t *ids;
+            int count = import_subtree(im, op->path, &ids);
+            for (int j = 0; j < count; j++) import_set(im, ids[j], 0, 0, 0);
+            free(ids);
+            for (char *slash = strchr(op->path, '/'); slash; slash = strchr(slash + 1, '/')) {
+                *slash = 0;
+                uint32_t above = path_lookup(&im->tree, op->path);
+                if (import_member(im, above)) import_set(im, above, 0, 0, 0);
+                *slash = '/';
+            }
+            uint32_t id = path_intern(&im->tree, op->path);
+            import_tree_grow(im);
+            import_set(im, id, 1, hash, size);
+        }
     }
 
-    char remote_path[256];
-    fgets(remote_path, sizeof(remote_path), remote);
-    fclose(remote);
-
-    // trim newline
-    remote_path[strcspn(remote_path, "\n")] = 0;
+    if (im->pending_count == im->pending_capacity) {
+        im->pending_capacity = im->pending_capacity ? im->pending_capacity * 2 : 64;
+        im->pending = realloc(im->pending, im->pending_capacity * sizeof(struct import_dirs));
+        im->written = realloc(im->written, im->pending_capacity * sizeof(struct import_written));
+    }
+    struct import_dirs *d = &im->pending[im->pending_count];
+    struct import_written *w = &im->written[im->pending_count++];
+    memset(d, 0, sizeof(*d));
+    memset(w, 0, sizeof(*w));
+    snprintf(w->id, sizeof(w->id), "%lx", (unsigned long) c->id);
+    if (c->parent) snprintf(w->parent, sizeof(w->parent), "%lx", (unsigned long) c->parent);
+    w->timestamp = c->timestamp;
+    d->commit = c;
+    d->build = arena_printf(&im->write_arena, "%s/.tmp-%s-XXXXXX", COMMITS_DIR, w->id);
+    if (!mkdtemp(d->build)) {
+        perror("Failed to create commit directory");
+        exit(1);
+    }
+    chmod(d->build, 0755);
+    w->dir = import_add_dir(im, strdup(d->build));
+
+    // what changed, for stats and the history index
+    struct commit_stat *stat = &w->stat;
+    snprintf(stat->commit, sizeof(stat->commit), "%s", w->id);
+    snprintf(stat->parent, sizeof(stat->parent), "%s", w->parent);
+    int keys = 0;
+    for (int i = 0; i < im->touch_count; i++) {
+        struct import_touch *t = &im->touched[i];
+        int member = import_member(im, t->id);
+        if (member && t->member && t->hash == im->hashes[t->id]) {
+            continue;
+        } else if (member && t->member) {
+            stat->modified++;
+        } else if (member) {
+            stat->added++;
+        } else if (t->member) {
+            stat->removed++;
+        } else {
+            continue;
+        }
+        if (member) stat->bytes_in += im->sizes[t->id];
+        if (t->member) stat->bytes_out += t->size;
+        keys += count_path_keys(path_string(&im->tree, t->id, &cmd_arena));
+        if (member) im->sources[t->id] = w->dir;
+    }
+    stat->files = im->files;
+    stat->bytes = im->bytes;
+    bloom_build_init(&w->bloom, keys);
+    for (int i = 0; i < im->touch_count; i++) {
+        struct import_touch *t = &im->touched[i];
+        int member = import_member(im, t->id);
+        if ((member || t->member) && !(member && t->member && t->hash == im->hashes[t->id])) {
+            bloom_add_changed(&w->bloom, path_string(&im->tree, t->id, &cmd_arena), NULL, NULL);
+        }
+    }
 
-    // user@host and path
-    char remote_host[128] = {0};
-    char remote_dir[128] = {0};
-    char *colon = strchr(remote_path, ':');
-    if (colon) {
-        size_t host_len = colon - remote_path;
-        strncpy(remote_host, remote_path, host_len);
-        remote_host[host_len] = '\0';
-        strcpy(remote_dir, colon + 1);
-    } else {
-        printf("Invalid remote path format. Use user@host:/path/to/repo\n");
-        return;
+    // every file of the tree, and the directories holding them (parents have lower ids)
+    uint32_t dir_stamp = im->seq;
+    int dir_capacity = 0;
+    for (uint32_t id = 1; id < im->tree.count; id++) {
+        if (!import_member(im, id)) continue;
+        char *path = path_string(&im->tree, id, &im->write_arena);
+        char *dest = arena_printf(&im->write_arena, "%s/%s", d->build, path);
+        char *src = NULL;
+        if (im->sources[id] != w->dir) {
+            src = arena_printf(&im->write_arena, "%s/%s", im->dir_names[im->sources[id]], path);
+        }
+        import_add_entry(im, dest, src, im->hashes[id]);
+        for (uint32_t up = im->tree.nodes[id].parent; up != PATH_ROOT; up = im->tree.nodes[up].parent) {
+            if (im->stamps[up] == dir_stamp + 1) break;
+            im->stamps[up] = dir_stamp + 1;
+            if (d->dir_count == dir_capacity) {
+                dir_capacity = dir_capacity ? dir_capacity * 2 : 64;
+                uint32_t *dirs = arena_alloc(&im->write_arena, dir_capacity * sizeof(uint32_t));
+                if (d->dir_count) memcpy(dirs, d->dirs, d->dir_count * sizeof(uint32_t));
+                d->dirs = dirs;
+            }
+            d->dirs[d->dir_count++] = up;
+        }
     }
+    // the directory stamps are one ahead, skip past them
+    im->seq++;
+    qsort(d->dirs, d->dir_count, sizeof(uint32_t), compare_u32);
+    im->base = c->id;
 
-    // remote directories must be created
-    char command[512];
-    snprintf(command, sizeof(command),
-             "ssh %s 'mkdir -p \"%s/commits\" \"%s/objects\"'",
-             remote_host, remote_dir, remote_dir);
-    int result_mkdir = system(command);
-    if (result_mkdir != 0) {
-        printf("Failed to create remote directories at %s:%s\n", remote_host, remote_dir);
-        return;
+    if (im->entry_count >= IMPORT_BATCH_ENTRIES) import_write(im);
+}
+
+// store the batch's blobs, then apply and write its commits
+void import_flush(struct import *im) {
+    io_batch(im->blob_count, import_store_blob, im);
+    for (int i = 0; i < im->blob_count; i++) {
+        struct import_blob *b = &im->blobs[i];
+        if (b->error) {
+            fprintf(stderr, "Error: Failed to store object: %s\n", strerror(b->error));
+            exit(1);
+        }
+        if (b->mark) import_marks_set(im, b->mark, MARK_BLOB, b->hash, b->size);
+        free(b->data);
+        b->data = NULL;
     }
+    im->blob_total += im->blob_count;
 
-    // rsync commits
-    snprintf(command, sizeof(command), "rsync -av %s/ %s:%s/commits/", COMMITS_DIR, remote_host, remote_dir);
-    int result_commits = system(command);
+    for (int i = 0; i < im->commit_count; i++) import_apply(im, &im->commits[i]);
+    import_write(im);
 
-    // rsync objects
-    snprintf(command, sizeof(command), "rsync -av %s/ %s:%s/objects/", OBJECTS_DIR, remote_host, remote_dir);
-    int result_objects = system(command);
+    im->blob_count = 0;
+    im->blob_bytes = 0;
+    im->op_count = 0;
+    im->commit_count = 0;
+    im->batch_entries = 0;
+    arena_free(&im->batch_arena);
+}
 
-    if (result_commits == 0 && result_objects == 0) {
-        printf("Commits and objects sent to remote: %s:%s\n", remote_host, remote_dir);
-    } else {
-        if (result_commits != 0) {
-            printf("Failed to send commits to remote.\n");
-        }
-        if (result_objects != 0) {
-            printf("Failed to send objects to remote.\n");
-        }
+struct import_op *import_add_op(struct import *im, char kind) {
+    if (im->op_count == im->op_capacity) {
+        im->op_capacity = im->op_capacity ? im->op_capacity * 2 : 1024;
+        im->ops = realloc(im->ops, im->op_capacity * sizeof(struct import_op));
     }
+    struct import_op *op = &im->ops[im->op_count++];
+    memset(op, 0, sizeof(*op));
+    op->kind = kind;
+    op->blob = -1;
+    return op;
 }
 
-// fetch commits from remote
-void fetch() {
-    FILE *remote = fopen(REMOTE_FILE, "r");
-    if (!remote) {
-        printf("No remote configured. Use 'mnemos remote <path>' to set one.\n");
-        exit(1);
+// "commit <ref>" and everything up to its blank line; NULL or an error
+const char *import_read_commit(struct import *im, FILE *in, const char *ref, char **line, size_t *capacity,
+                               int *pushed) {
+    uint64_t mark = 0, parent = 0;
+    int has_from = 0;
+    long timestamp = 0;
+    char *message = NULL;
+    int first_op = im->op_count;
+    ssize_t len;
+
+    while ((len = getline(line, capacity, in)) != -1) {
+        char *l = *line;
+        l[strcspn(l, "\n")] = 0;
+        if (strncmp(l, "mark :", 6) == 0) {
+            mark = strtoull(l + 6, NULL, 10);
+        } else if (strncmp(l, "committer ", 10) == 0) {
+            char *email_end = strrchr(l, '>');
+            if (email_end) timestamp = strtol(email_end + 1, NULL, 10);
+        } else if (strncmp(l, "author ", 7) == 0 || strncmp(l, "encoding ", 9) == 0 ||
+                   strncmp(l, "original-oid ", 13) == 0) {
+            // nowhere to keep these
+        } else if (strncmp(l, "gpgsig ", 7) == 0) {
+            long long size = import_data_size(in, line, capacity);
+            if (size < 0 || import_skip_data(in, size) != 0) return "bad signature";
+        } else if (strncmp(l, "data ", 5) == 0 && !message) {
+            long long size;
+            if (sscanf(l, "data %lld", &size) != 1 || size < 0) return "bad data";
+            char *data = import_read_data(in, size);
+            if (!data) return "truncated message";
+            size_t n = strlen(data);
+            while (n > 0 && data[n - 1] == '\n') data[--n] = 0;
+            message = arena_strdup(&im->batch_arena, data);
+            free(data);
+        } else if (strncmp(l, "from ", 5) == 0) {
+            parent = import_commitish(im, l + 5);
+            has_from = 1;
+        } else if (strncmp(l, "merge ", 6) == 0) {
+            // only the first parent is kept
+        } else if (strncmp(l, "M ", 2) == 0) {
+            char *mode = l + 2, *ref_start = strchr(mode, ' ');
+            char *path_start = ref_start ? strchr(ref_start + 1, ' ') : NULL;
+            if (!path_start) return "bad M line";
+            char *end;
+            if (strncmp(mode, "160000", 6) == 0) {
+                im->skipped++;
+                continue;
+            }
+            struct import_op *op = import_add_op(im, 'M');
+            op->path = import_path(path_start + 1, &end, 0, &im->batch_arena);
+            if (ref_start[1] == ':') {
+                op->mark = strtoull(ref_start + 2, NULL, 10);
+            } else if (strncmp(ref_start + 1, "inline ", 7) == 0) {
+                long long size = import_data_size(in, line, capacity);
+                char *data = size >= 0 ? import_read_data(in, size) : NULL;
+                if (!data) return "truncated inline data";
+                op->blob = import_queue_blob(im, data, size, 0);
+            } else {
+                return "only marks and inline data are supported, export without --no-data";
+            }
+        } else if (strncmp(l, "D ", 2) == 0) {
+            char *end;
+            import_add_op(im, 'D')->path = import_path(l + 2, &end, 0, &im->batch_arena);
+        } else if (strncmp(l, "C ", 2) == 0 || strncmp(l, "R ", 2) == 0) {
+            char *end;
+            struct import_op *op = import_add_op(im, l[0]);
+            op->path = import_path(l + 2, &end, 1, &im->batch_arena);
+            op->to = import_path(end, &end, 0, &im->batch_arena);
+        } else if (strcmp(l, "deleteall") == 0) {
+            import_add_op(im, 'X');
+        } else if (strncmp(l, "N ", 2) == 0) {
+            // notes are not kept
+        } else if (l[0] == '\0') {
+            break;
+        } else {
+            *pushed = 1;
+            break;
+        }
     }
+    if (!message) return "commit without message";
 
-    char remote_path[256];
-    fgets(remote_path, sizeof(remote_path), remote);
-    fclose(remote);
+    struct import_ref *r = import_ref(im, ref);
+    if (!has_from) parent = r->tip;
+    if (im->commit_count == im->commit_capacity) {
+        im->commit_capacity = im->commit_capacity ? im->commit_capacity * 2 : 256;
+        im->commits = realloc(im->commits, im->commit_capacity * sizeof(struct import_commit));
+    }
+    struct import_commit *c = &im->commits[im->commit_count++];
+    c->id = import_commit_id(im, timestamp);
+    c->parent = parent;
+    c->timestamp = timestamp;
+    c->message = message;
+    c->first_op = first_op;
+    c->op_count = im->op_count - first_op;
+    r->tip = c->id;
+    if (mark) import_marks_set(im, mark, MARK_COMMIT, 0, c->id);
+    im->batch_entries += im->files + c->op_count;
+    return NULL;
+}
 
-    // trim newline
-    remote_path[strcspn(remote_path, "\n")] = 0;
+// refs/heads/x is x, refs/tags/x is tags/x
+const char *import_memory_name(const char *ref) {
+    if (strncmp(ref, "refs/heads/", 11) == 0) return ref + 11;
+    if (strncmp(ref, "refs/", 5) == 0) return ref + 5;
+    return ref;
+}
 
-    // .mnemos must exist
+// mnemos import: a git fast-export stream on stdin
+int import_stream(FILE *in) {
     struct stat st;
-    if (stat(MNEMOS_DIR, &st) != 0) {
+    if (stat(COMMITS_DIR, &st) != 0 || stat(OBJECTS_DIR, &st) != 0) {
         printf("Error: This is not a Mnemos repository. Initialize it first with 'mnemos init'.\n");
-        exit(1);
+        return 1;
     }
+    struct import im;
+    memset(&im, 0, sizeof(im));
+    char marks_path[] = MNEMOS_DIR "/.tmp-marks-XXXXXX";
+    im.marks_fd = mkstemp(marks_path);
+    if (im.marks_fd < 0) {
+        perror("Failed to create mark table");
+        return 1;
+    }
+    unlink(marks_path);
+    im.mark_cache = calloc(IMPORT_MARK_CACHE, sizeof(struct import_mark));
+    path_table_init(&im.taken, &im.tree_arena);
+    path_table_init(&im.tree, &im.tree_arena);
+    import_tree_grow(&im);
+    im.batch_limit = config_get_size("import-batch-size", 64LL << 20);
+    im.large_threshold = large_file_threshold();
+
+    char *line = NULL;
+    size_t capacity = 0;
+    int pushed = 0;
+    const char *error = NULL;
+    while (!error && (pushed || getline(&line, &capacity, in) != -1)) {
+        pushed = 0;
+        line[strcspn(line, "\n")] = 0;
+        struct arena_mark mark = arena_save(&cmd_arena);
+        if (strcmp(line, "blob") == 0) {
+            uint64_t blob_mark = 0;
+            long long size = -1;
+            while (getline(&line, &capacity, in) != -1) {
+                if (strncmp(line, "mark :", 6) == 0) {
+                    blob_mark = strtoull(line + 6, NULL, 10);
+                } else if (strncmp(line, "original-oid ", 13) != 0) {
+                    if (sscanf(line, "data %lld", &size) != 1) size = -1;
+                    break;
+                }
+            }
+            if (size < 0) {
+                error = "bad blob";
+            } else if (size >= im.large_threshold) {
+                if (import_large_blob(&im, in, size, blob_mark) != 0) error = "failed to store a large blob";
+            } else {
+                char *data = import_read_data(in, size);
+                if (!data) error = "truncated blob";
+                else import_queue_blob(&im, data, size, blob_mark);
+            }
+        } else if (strncmp(line, "commit ", 7) == 0) {
+            char *ref = strdup(line + 7);
+            error = import_read_commit(&im, in, ref, &line, &capacity, &pushed);
+            free(ref);
+        } else if (strncmp(line, "reset ", 6) == 0) {
+            struct import_ref *r = import_ref(&im, line + 6);
+            r->tip = 0;
+            if (getline(&line, &capacity, in) != -1) {
+                line[strcspn(line, "\n")] = 0;
+                if (strncmp(line, "from ", 5) == 0) r->tip = import_commitish(&im, line + 5);
+                else pushed = 1;
+            }
+        } else if (strncmp(line, "tag ", 4) == 0) {
+            char *name = arena_printf(&cmd_arena, "refs/tags/%s", line + 4);
+            uint64_t tip = 0;
+            while (getline(&line, &capacity, in) != -1) {
+                line[strcspn(line, "\n")] = 0;
+                if (strncmp(line, "from ", 5) == 0) {
+                    tip = import_commitish(&im, line + 5);
+                } else if (strncmp(line, "data ", 5) == 0) {
+                    long long size;
+                    if (sscanf(line, "data %lld", &size) != 1 || import_skip_data(in, size) != 0) error = "bad tag";
+                    break;
+                }
+            }
+            if (tip) import_ref(&im, name)->tip = tip;
+        } else if (strcmp(line, "done") == 0) {
+            arena_restore(&cmd_arena, mark);
+            break;
+        } else if (line[0] && strncmp(line, "feature ", 8) != 0 && strncmp(line, "option ", 7) != 0 &&
+                   strncmp(line, "progress ", 9) != 0 && strcmp(line, "checkpoint") != 0) {
+            error = arena_printf(&cmd_arena, "unsupported command '%.40s'", line);
+            break;
+        }
+        arena_restore(&cmd_arena, mark);
 
-    // rsync commits
-    char command[512];
-    snprintf(command, sizeof(command), "rsync -av %s/commits/ %s/", remote_path, COMMITS_DIR);
-    int result_commits = system(command);
-
-    // rsync objects
-    snprintf(command, sizeof(command), "rsync -av %s/objects/ %s/", remote_path, OBJECTS_DIR);
-    int result_objects = system(command);
-
-    if (result_commits == 0 && result_objects == 0) {
-        printf("Commits and objects fetched from remote: %s\n", remote_path);
-    } else {
-        if (result_commits != 0) {
-            printf("Failed to fetch commits from remote.\n");
+        if (im.blob_bytes >= im.batch_limit || im.batch_entries >= IMPORT_BATCH_ENTRIES ||
+            im.commit_count >= IMPORT_BATCH_COMMITS) {
+            import_flush(&im);
+            if (isatty(STDERR_FILENO)) fprintf(stderr, "Imported %d commits, %d blobs\r", im.commit_total, im.blob_total);
         }
-        if (result_objects != 0) {
-            printf("Failed to fetch objects from remote.\n");
+    }
+    free(line);
+    if (error) {
+        fprintf(stderr, "Error: Import stopped: %s\n", error);
+        return 1;
+    }
+    import_flush(&im);
+
+    // refs become memories
+    int memories = 0;
+    for (int i = 0; i < im.ref_count; i++) {
+        if (!im.refs[i].tip) continue;
+        const char *name = import_memory_name(im.refs[i].name);
+        char *path = memory_path(name);
+        if (!path) {
+            fprintf(stderr, "Warning: Can't name a memory '%s', skipped\n", name);
+            continue;
+        }
+        mkdir(MEMORIES_DIR, 0755);
+        create_directories(path);
+        if (write_file_atomic(path, arena_printf(&cmd_arena, "%lx", (unsigned long) im.refs[i].tip)) == 0) {
+            memories++;
         }
     }
-}
+    printf("Imported %d commits, %d blobs and %d memories.\n", im.commit_total, im.blob_total, memories);
+    if (im.skipped) printf("Skipped %d submodule entries.\n", im.skipped);
+    if (memories > 0) printf("Check one out with: mnemos recall <memory>\n");
 
-// create remote repository from local mnemos
-void create_remote(const char *remote_path) {
-    char command[512];
-
-    // single quotes around the mkdir command to so shell interprets ~ correctly
-    snprintf(command, sizeof(command),
-             "ssh %s 'mkdir -p \"%s/commits\" && mkdir -p \"%s/objects\" && touch \"%s/HEAD\"'",
-             remote_path, remote_path, remote_path, remote_path);
-    int result = system(command);
-
-    if (result == 0) {
-        printf("Created remote repository at: %s\n", remote_path);
-        set_remote(remote_path); // automatically set new remote
-    } else {
-        printf("Failed to create remote repository.\n");
-    }
+    close(im.marks_fd);
+    free(im.mark_cache);
+    return 0;
 }
 
-// just init repo on remote from local
-void remote_init() {
-    FILE *remote = fopen(REMOTE_FILE, "r");
-    if (!remote) {
-        printf("No remote configured. Use 'mnemos remote <path>' to set one.\n");
+/*
+ * export-history: every commit, oldest first, as a fast-import stream
+ * on stdout, so `mnemos export-history | git fast-import` rebuilds it.
+ * Each commit carries only the files it changed against its parent (from
+ * the history index), contents inline, so nothing is held in memory but
+ * the commit list. Memories become branches, HEAD is master.
+ */
+void export_quoted_path(FILE *out, const char *path) {
+    if (!strpbrk(path, "\"\\\n") && path[0] != '"') {
+        fputs(path, out);
         return;
     }
-
-    char remote_path[256];
-    if (!fgets(remote_path, sizeof(remote_path), remote)) {
-        fclose(remote);
-        printf("Failed to read remote configuration.\n");
-        return;
+    fputc('"', out);
+    for (const char *p = path; *p; p++) {
+        if (*p == '\n') fputs("\\n", out);
+        else if (*p == '"' || *p == '\\') fprintf(out, "\\%c", *p);
+        else fputc(*p, out);
     }
-    fclose(remote);
-
-    // trim newline
-    remote_path[strcspn(remote_path, "\n")] = 0;
+    fputc('"', out);
+}
 
-    // make sure remote_path is not empty
-    if (strlen(remote_path) == 0) {
-        printf("Remote path is empty. Please set a valid remote path.\n");
+struct export_changes {
+    FILE *out;
+    int failed;
+};
+
+void export_change(void *ctx, const char *path, const char *old_hash, const char *new_hash) {
+    struct export_changes *x = ctx;
+    (void) old_hash;
+    if (!new_hash) {
+        fputs("D ", x->out);
+        export_quoted_path(x->out, path);
+        fputc('\n', x->out);
         return;
     }
-
-    // extract user@host and remote directory
-    char user_host[128] = {0};
-    char remote_dir[128] = {0};
-    char *colon = strchr(remote_path, ':');
-    if (colon) {
-        size_t host_len = colon - remote_path;
-        strncpy(user_host, remote_path, host_len);
-        user_host[host_len] = '\0';
-        strcpy(remote_dir, colon + 1);
-    } else {
-        printf("Invalid remote path format. Use user@host:/path/to/repo\n");
+    char object_path[OBJECT_PATH_SIZE];
+    object_find(object_path, new_hash);
+    int fd = open(object_path, O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0) {
+        fprintf(stderr, "Error: Object %s not found for file '%s'\n", new_hash, path);
+        if (fd >= 0) close(fd);
+        x->failed = 1;
         return;
     }
+    fputs("M 100644 inline ", x->out);
+    export_quoted_path(x->out, path);
+    fprintf(x->out, "\ndata %lld\n", (long long) st.st_size);
+    fflush(x->out);
+    if (copy_fd(fd, fileno(x->out)) != 0) x->failed = 1;
+    close(fd);
+    fputc('\n', x->out);
+}
 
-    // for SSH command
-    char command[512];
-    snprintf(command, sizeof(command),
-             "ssh %s 'mkdir -p \"%s/commits\" && mkdir -p \"%s/objects\" && touch \"%s/HEAD\" && touch \"%s/index\"'",
-             user_host, remote_dir, remote_dir, remote_dir, remote_dir);
+struct export_mark {
+    char *commit;
+    int mark;
+};
 
-    // debug
-    // printf("Executing command: %s\n", command);
+int compare_export_marks(const void *a, const void *b) {
+    return strcmp(((const struct export_mark *) a)->commit, ((const struct export_mark *) b)->commit);
+}
 
-    // execute 
-    int result = system(command);
+int export_mark_of(struct export_mark *marks, int count, const char *commit) {
+    struct export_mark key = { (char *) commit, 0 };
+    struct export_mark *found = commit[0] ? bsearch(&key, marks, count, sizeof(key), compare_export_marks) : NULL;
+    return found ? found->mark : 0;
+}
 
-    if (result == 0) {
-        printf("Initialized remote repository at: %s\n", remote_path);
-    } else {
-        printf("Failed to initialize remote repository at: %s\n", remote_path);
+// the whole message file, without its "message: " prefix
+char *read_full_message(const char *commit, struct arena *a) {
+    char *path = arena_printf(a, "%s/%s/message", COMMITS_DIR, commit);
+    int fd = open(path, O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0) {
+        if (fd >= 0) close(fd);
+        return arena_strdup(a, "");
     }
+    char *text = arena_alloc(a, st.st_size + 1);
+    ssize_t n = read_full(fd, text, st.st_size);
+    close(fd);
+    text[n > 0 ? n : 0] = 0;
+    while (n > 0 && text[n - 1] == '\n') text[--n] = 0;
+    return strncmp(text, "message: ", 9) == 0 ? text + 9 : text;
 }
 
-void list_commits() {
-    DIR *dir = opendir(COMMITS_DIR);
-    if (!dir) {
-        perror("Failed to open commits directory");
-        exit(1);
+struct export_memory {
+    FILE *out;
+    struct export_mark *marks;
+    int count;
+};
+
+void export_memory_ref(void *ctx, const char *name, const char *commit) {
+    struct export_memory *x = ctx;
+    int mark = export_mark_of(x->marks, x->count, commit);
+    if (mark) fprintf(x->out, "reset refs/heads/%s\nfrom :%d\n\n", name, mark);
+}
+
+int export_history() {
+    if (isatty(STDOUT_FILENO)) {
+        fprintf(stderr, "Error: Not writing a stream to a terminal, redirect stdout.\n");
+        return 1;
+    }
+    struct history h;
+    history_load(&h);
+    struct commit_time *order = malloc((h.count + 1) * sizeof(struct commit_time));
+    struct export_mark *marks = malloc((h.count + 1) * sizeof(struct export_mark));
+    for (int i = 0; i < h.count; i++) {
+        order[i].commit = h.entries[i].commit;
+        order[i].timestamp = h.entries[i].timestamp;
+    }
+    qsort(order, h.count, sizeof(struct commit_time), compare_commit_times);
+    for (int i = 0; i < h.count; i++) {
+        marks[i].commit = order[i].commit;
+        marks[i].mark = i + 1;
+    }
+    qsort(marks, h.count, sizeof(struct export_mark), compare_export_marks);
+
+    FILE *out = stdout;
+    struct export_changes x = { out, 0 };
+    for (int i = 0; i < h.count && !x.failed; i++) {
+        struct arena_mark mark = arena_save(&cmd_arena);
+        struct history_entry *e = history_find(&h, order[i].commit);
+        char *message = read_full_message(e->commit, &cmd_arena);
+        int parent = export_mark_of(marks, h.count, e->parent);
+        // a root commit starts the branch over
+        if (!parent) fprintf(out, "reset refs/heads/master\n");
+        fprintf(out, "commit refs/heads/master\nmark :%d\n", i + 1);
+        fprintf(out, "committer mnemos <mnemos> %ld +0000\n", e->timestamp);
+        fprintf(out, "data %zu\n%s\n", strlen(message) + 1, message);
+        if (parent) fprintf(out, "from :%d\n", parent);
+        diff_trees(parent ? e->parent : "", e->commit, "", export_change, &x, &cmd_arena);
+        fputc('\n', out);
+        arena_restore(&cmd_arena, mark);
     }
 
-    struct dirent *entry;
-    struct {
-        char hash[HASH_SIZE];
-        time_t timestamp;
-    } commits[1024];
-    int count = 0;
+    // memories are branches, HEAD is master
+    struct export_memory memories = { out, marks, h.count };
+    for_each_memory(NULL, export_memory_ref, &memories);
+    char head[HASH_SIZE];
+    if (read_hash_file(HEAD_FILE, head) == 0 && export_mark_of(marks, h.count, head)) {
+        fprintf(out, "reset refs/heads/master\nfrom :%d\n\n", export_mark_of(marks, h.count, head));
+    }
+    fprintf(out, "done\n");
+    if (fflush(out) != 0) x.failed = 1;
+
+    if (!x.failed) fprintf(stderr, "Exported %d commits.\n", h.count);
+    free(order);
+    free(marks);
+    history_free(&h);
+    return x.failed;
+}
 
-    while ((entry = readdir(dir)) != NULL) {
-        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) {
-            continue;
-        }
+/*
+ * fsck: rehash every object on all cores, then check that every commit
+ * entry, memory and HEAD points at something that exists. Problems come
+ * one per line as "<kind> <name> [<detail>...]" so scripts can grep them:
+ *
+ *   corrupt <object> <actual hash>      content doesn't match its name
+ *   unreadable <object>
+ *   missing <object> <commit> <path>    commit entry without its object
+ *   bad-commit <commit>                 no timestamp
+ *   bad-memory <memory> <commit>        memory points to no commit
+ *   bad-head <commit>
+ *   dangling <object>                   unreachable, gc will take it
+ *
+ * Exits 1 when anything but dangling objects turns up.
+ */
+#define FSCK_OK 0
+#define FSCK_CORRUPT 1
+#define FSCK_UNREADABLE 2
+
+// what one commit walk found, filled by a worker
+struct fsck_commit {
+    struct arena arena;
+    char **missing;     // "object path" pairs, flattened
+    int count;
+    int capacity;
+    int no_timestamp;
+};
+
+struct fsck {
+    struct object_list *objects;
+    char (*actual)[HASH_SIZE];
+    char *state;        // FSCK_* per object
+    char **commits;
+    struct fsck_commit *results;
+    uint64_t *reachable;
+};
+
+struct fsck_walk {
+    struct fsck *fsck;
+    struct fsck_commit *result;
+};
+
+void fsck_hash_one(void *ctx, int i) {
+    struct fsck *fsck = ctx;
+    char object_path[OBJECT_PATH_SIZE];
+    object_find(object_path, fsck->objects->names[i]);
+    if (try_hash_file(object_path, fsck->actual[i]) != 0) {
+        fsck->state[i] = FSCK_UNREADABLE;
+    } else if (strcmp(fsck->actual[i], fsck->objects->names[i]) != 0) {
+        fsck->state[i] = FSCK_CORRUPT;
+    }
+}
 
-        // stamp of Time for each commit, so we can see how old we get
-        char timestamp_path[256];
-        snprintf(timestamp_path, sizeof(timestamp_path), "%s/%s/timestamp", COMMITS_DIR, entry->d_name);
+void fsck_check_entry(void *ctx, const char *path, const char *hash) {
+    struct fsck_walk *walk = ctx;
+    int pos = find_object(walk->fsck->objects, hash);
+    if (pos >= 0) {
+        __sync_fetch_and_or(&walk->fsck->reachable[pos / 64], (uint64_t) 1 << (pos % 64));
+        return;
+    }
+    struct fsck_commit *r = walk->result;
+    if (r->count + 2 > r->capacity) {
+        r->capacity = r->capacity ? r->capacity * 2 : 16;
+        r->missing = realloc(r->missing, r->capacity * sizeof(char *));
+    }
+    r->missing[r->count++] = arena_strdup(&r->arena, hash);
+    r->missing[r->count++] = arena_strdup(&r->arena, path);
+}
 
-        FILE *timestamp_file = fopen(timestamp_path, "r");
-        if (timestamp_file) {
-            commits[count].timestamp = 0;
-            fscanf(timestamp_file, "%ld", &commits[count].timestamp);
-            fclose(timestamp_file);
-        } else {
-            commits[count].timestamp = 0; // missing timestamp
-        }
+void fsck_commit_one(void *ctx, int i) {
+    struct fsck *fsck = ctx;
+    struct fsck_walk walk = { fsck, &fsck->results[i] };
+    struct arena a = {0};
+    char *commit_dir = arena_printf(&a, "%s/%s", COMMITS_DIR, fsck->commits[i]);
+    if (access(arena_printf(&a, "%s/timestamp", commit_dir), F_OK) != 0) {
+        fsck->results[i].no_timestamp = 1;
+    }
+    for_each_tree_entry(commit_dir, fsck_check_entry, &walk, &a);
+    arena_free(&a);
+}
 
-        strcpy(commits[count].hash, entry->d_name);
-        count++;
+int commit_exists(const char *commit) {
+    struct stat st;
+    char *commit_dir = arena_printf(&cmd_arena, "%s/%s", COMMITS_DIR, commit);
+    return commit[0] && stat(commit_dir, &st) == 0 && S_ISDIR(st.st_mode);
+}
+
+int fsck() {
+    struct stat st;
+    if (stat(OBJECTS_DIR, &st) != 0) {
+        printf("Error: This is not a Mnemos repository. Initialize it first with 'mnemos init'.\n");
+        exit(1);
     }
-    closedir(dir);
 
-    // sort commits by timestamp
-    for (int i = 0; i < count - 1; ++i) {
-        for (int j = i + 1; j < count; ++j) {
-            if (commits[i].timestamp > commits[j].timestamp) {
-                // swap
-                time_t temp_time = commits[i].timestamp;
-                commits[i].timestamp = commits[j].timestamp;
-                commits[j].timestamp = temp_time;
+    struct object_list objects;
+    list_objects(&objects, &cmd_arena);
+    char **commits;
+    int commit_count = list_commit_ids(&commits, &cmd_arena);
+    qsort(commits, commit_count, sizeof(char *), compare_commit_id_ptrs);
+
+    struct fsck fsck = { &objects, NULL, NULL, commits, NULL, NULL };
+    fsck.actual = calloc(objects.count + 1, HASH_SIZE);
+    fsck.state = calloc(objects.count + 1, 1);
+    fsck.results = calloc(commit_count + 1, sizeof(struct fsck_commit));
+    fsck.reachable = calloc(objects.count / 64 + 1, sizeof(uint64_t));
+
+    // settings are read up front, workers never touch config
+    large_file_threshold();
+    parallel_for(objects.count, fsck_hash_one, &fsck);
+    parallel_for(commit_count, fsck_commit_one, &fsck);
+
+    int corrupt = 0, missing = 0, dangling = 0, bad = 0;
+    for (int i = 0; i < objects.count; i++) {
+        if (fsck.state[i] == FSCK_CORRUPT) {
+            printf("corrupt %s %s\n", objects.names[i], fsck.actual[i]);
+            corrupt++;
+        } else if (fsck.state[i] == FSCK_UNREADABLE) {
+            printf("unreadable %s\n", objects.names[i]);
+            corrupt++;
+        }
+    }
+    for (int i = 0; i < commit_count; i++) {
+        struct fsck_commit *r = &fsck.results[i];
+        if (r->no_timestamp) {
+            printf("bad-commit %s\n", commits[i]);
+            bad++;
+        }
+        for (int j = 0; j < r->count; j += 2) {
+            printf("missing %s %s %s\n", r->missing[j], commits[i], r->missing[j + 1]);
+            missing++;
+        }
+        free(r->missing);
+        arena_free(&r->arena);
+    }
 
-                char temp_hash[HASH_SIZE];
-                strcpy(temp_hash, commits[i].hash);
-                strcpy(commits[i].hash, commits[j].hash);
-                strcpy(commits[j].hash, temp_hash);
-            }
+    struct memory_list memories = { NULL, 0, 0 };
+    int memory_count = for_each_memory(NULL, add_memory_entry, &memories);
+    for (int i = 0; i < memories.count; i++) {
+        const char *commit = memories.entries[i].commit;
+        if (!commit_exists(commit)) {
+            printf("bad-memory %s %s\n", memories.entries[i].name, commit[0] ? commit : "-");
+            bad++;
         }
     }
+    free(memories.entries);
 
-    // print commits
-    printf("Commits (newest to oldest):\n");
-    for (int i = count - 1; i >= 0; --i) {
-        printf("Commit: %s, Timestamp: %ld\n", commits[i].hash, commits[i].timestamp);
+    // a fresh repository has an empty HEAD
+    char head[HASH_SIZE];
+    if (read_hash_file(HEAD_FILE, head) == 0 && head[0] && !commit_exists(head)) {
+        printf("bad-head %s\n", head);
+        bad++;
     }
+
+    for (int i = 0; i < objects.count; i++) {
+        if (fsck.reachable[i / 64] & ((uint64_t) 1 << (i % 64))) continue;
+        printf("dangling %s\n", objects.names[i]);
+        dangling++;
+    }
+
+    printf("Checked %d objects, %d commits, %d memories: %d corrupt, %d missing, %d bad references, %d dangling.\n",
+           objects.count, commit_count, memory_count, corrupt, missing, bad, dangling);
+
+    free(fsck.actual);
+    free(fsck.state);
+    free(fsck.results);
+    free(fsck.reachable);
+    free(objects.names);
+    free(commits);
+    return corrupt || missing || bad ? 1 : 0;
 }
 
-// status function
-void status() {
-    FILE *index = fopen(INDEX_FILE, "r");
-    if (!index) {
-        printf("No tracked files found. Use 'mnemos track <file>' to start tracking files.\n");
-        return;
+/*
+ * serve: keep one process warm and answer many commands.
+ *
+ * Index, HEAD and the hashes recorded in the HEAD commit are loaded once.
+ * Work tree hashes are remembered against each file's stat stamp, so an
+ * untouched file is never read twice. index and HEAD stamps act as the
+ * generation counters: when either moves, the cache is reloaded.
+ * Only status answers from the cache, so only status refreshes it; diff,
+ * log, list-commits and moments read commits from disk as they always did.
+ *
+ * Every command runs in a forked child that inherits the warm cache, so a
+ * failing command (most of them exit on error) never takes the server down.
+ */
+void stamp_file(const char *path, struct file_stamp *stamp) {
+    struct stat st;
+    memset(stamp, 0, sizeof(*stamp));
+    if (stat(path, &st) != 0) return;
+    stamp->exists = 1;
+    stamp->mtime = st.st_mtime;
+    stamp->mtime_nsec = ST_MTIME_NSEC(st);
+    stamp->size = st.st_size;
+    stamp->ino = st.st_ino;
+}
+
+int stamp_equal(const struct file_stamp *a, const struct file_stamp *b) {
+    return a->exists == b->exists && a->mtime == b->mtime &&
+           a->mtime_nsec == b->mtime_nsec && a->size == b->size && a->ino == b->ino;
+}
+
+void cache_clear(struct repo_cache *cache) {
+    if (cache->loaded) {
+        path_table_free(&cache->tracked);
     }
+    arena_free(&cache->arena);
+    free(cache->entries);
+    cache->entries = NULL;
+    cache->count = 0;
+    cache->loaded = 0;
+}
 
-    // current HEAD commit for comparing
-    char head_commit[HASH_SIZE] = {0};
+// (re)read index, HEAD and the HEAD commit tree
+void cache_load(struct repo_cache *cache) {
+    cache_clear(cache);
+    stamp_file(INDEX_FILE, &cache->index_stamp);
+    stamp_file(HEAD_FILE, &cache->head_stamp);
+
+    cache->head_commit[0] = '\0';
     FILE *head = fopen(HEAD_FILE, "r");
     if (head) {
-        if (fgets(head_commit, sizeof(head_commit), head)) {
-            head_commit[strcspn(head_commit, "\n")] = 0; // remove newline
+        if (fgets(cache->head_commit, sizeof(cache->head_commit), head)) {
+            cache->head_commit[strcspn(cache->head_commit, "\n")] = 0;
         }
         fclose(head);
     }
 
-    printf("Status of tracked files:\n");
-    printf("------------------------\n");
+    path_table_init(&cache->tracked, &cache->arena);
+    cache->loaded = 1;
 
-    char line[256];
-    while (fgets(line, sizeof(line), index)) {
-        line[strcspn(line, "\n")] = 0; // remove newline
-        
-        struct stat st;
-        if (stat(line, &st) != 0) {
-            printf("\033[31m[MISSING]\033[0m %s\n", line);
-            continue;
+    FILE *index = fopen(INDEX_FILE, "r");
+    if (!index) return;
+
+    int capacity = 0;
+    char *line = NULL;
+    size_t line_capacity = 0;
+    while (getline(&line, &line_capacity, index) != -1) {
+        line[strcspn(line, "\n")] = 0;
+        if (cache->count == capacity) {
+            capacity = capacity ? capacity * 2 : 64;
+            cache->entries = realloc(cache->entries, capacity * sizeof(struct cache_entry));
         }
-
-        // is file modified compared to last commit?
-        char current_hash[HASH_SIZE];
-        hash_file(line, current_hash);
-
-        if (head_commit[0] != '\0') {
-            char commit_file_path[512];
-            snprintf(commit_file_path, sizeof(commit_file_path), 
-                    "%s/%s/%s", COMMITS_DIR, head_commit, line);
-            
+        struct cache_entry *e = &cache->entries[cache->count++];
+        memset(e, 0, sizeof(*e));
+        e->path = arena_strdup(&cache->arena, line);
+        path_add(&cache->tracked, line);
+
+        if (cache->head_commit[0] != '\0') {
+            struct arena_mark mark = arena_save(&cmd_arena);
+            char *commit_file_path = arena_printf(&cmd_arena,
+                     "%s/%s/%s", COMMITS_DIR, cache->head_commit, line);
             FILE *commit_file = fopen(commit_file_path, "r");
             if (commit_file) {
-                char committed_hash[HASH_SIZE];
-                if (fgets(committed_hash, sizeof(committed_hash), commit_file)) {
-                    committed_hash[strcspn(committed_hash, "\n")] = 0;
-                    
-                    if (strcmp(current_hash, committed_hash) == 0) {
-                        printf("\033[32m[UNCHANGED]\033[0m %s\n", line);
-                    } else {
-                        printf("\033[33m[MODIFIED]\033[0m %s\n", line);
-                    }
+                if (fgets(e->head_hash, sizeof(e->head_hash), commit_file)) {
+                    e->head_hash[strcspn(e->head_hash, "\n")] = 0;
                 }
                 fclose(commit_file);
-            } else {
-                printf("\033[36m[NEW]\033[0m %s\n", line);
             }
-        } else {
-            printf("\033[36m[NEW]\033[0m %s\n", line);
+            arena_restore(&cmd_arena, mark);
         }
     }
+    free(line);
     fclose(index);
+}
 
-    // show untracked files in current directory
-    printf("\nUntracked files:\n");
-    printf("----------------\n");
-    DIR *dir = opendir(".");
-    if (dir) {
-        struct dirent *entry;
-        while ((entry = readdir(dir)) != NULL) {
-            if (strcmp(entry->d_name, ".") == 0 || 
-                strcmp(entry->d_name, "..") == 0 || 
-                strncmp(entry->d_name, ".mnemos", 7) == 0) {
-                continue;
-            }
+// bring the cache up to date: reload on a new generation, rehash touched files
+void cache_refresh(struct repo_cache *cache) {
+    struct file_stamp index_stamp, head_stamp;
+    stamp_file(INDEX_FILE, &index_stamp);
+    stamp_file(HEAD_FILE, &head_stamp);
+    if (!cache->loaded || !stamp_equal(&index_stamp, &cache->index_stamp) ||
+        !stamp_equal(&head_stamp, &cache->head_stamp)) {
+        cache_load(cache);
+    }
 
-            // is file already tracked?
-            int is_tracked = 0;
-            rewind(index);
-            index = fopen(INDEX_FILE, "r");
-            if (index) {
-                while (fgets(line, sizeof(line), index)) {
-                    line[strcspn(line, "\n")] = 0;
-                    if (strcmp(line, entry->d_name) == 0) {
-                        is_tracked = 1;
-                        break;
-                    }
-                }
-                fclose(index);
+    for (int i = 0; i < cache->count; i++) {
+        struct cache_entry *e = &cache->entries[i];
+        struct file_stamp stamp;
+        stamp_file(e->path, &stamp);
+        if (!stamp.exists) {
+            e->missing = 1;
+            continue;
+        }
+        if (e->missing || e->work_hash[0] == '\0' || !stamp_equal(&stamp, &e->stamp)) {
+            if (try_hash_file(e->path, e->work_hash) != 0) {
+                e->missing = 1;
+                continue;
             }
+            e->stamp = stamp;
+        }
+        e->missing = 0;
+    }
+}
 
-            if (!is_tracked) {
-                struct stat st;
-                if (stat(entry->d_name, &st) == 0 && S_ISREG(st.st_mode)) {
-                    printf("\033[90m%s\n\033[0m", entry->d_name);
-                }
+// split a request line into words, "double quotes" group words with spaces
+int split_args(char *line, char **args, int max_args) {
+    int count = 0;
+    char *p = line;
+    while (*p && count < max_args) {
+        while (*p == ' ' || *p == '\t') p++;
+        if (!*p) break;
+
+        char *out = p;
+        args[count++] = out;
+        int quoted = 0;
+        while (*p && (quoted || (*p != ' ' && *p != '\t'))) {
+            if (*p == '"') {
+                quoted = !quoted;
+                p++;
+            } else if (*p == '\\' && p[1]) {
+                *out++ = p[1];
+                p += 2;
+            } else {
+                *out++ = *p++;
             }
         }
-        closedir(dir);
+        if (*p) p++;
+        *out = '\0';
     }
+    return count;
 }
 
-// in place of branches, we have "memories" - different remembered states
-// memory is just a named pointer to commit but conceptually simpler
-void create_memory(const char *memory_name) {
-    char memory_file[256];
-    snprintf(memory_file, sizeof(memory_file), "%s/memories/%s", MNEMOS_DIR, memory_name);
-    
-    // Get current HEAD
-    FILE *head = fopen(HEAD_FILE, "r");
-    if (!head) {
-        printf("Error: No moments captured yet\n");
-        return;
+int run_command(int argc, char *argv[]);
+
+// run one request in a child sharing the warm cache, output goes to out_fd
+int serve_one(int argc, char *argv[], int out_fd) {
+    // only status reads the cache, the rest would pay for a walk they don't use
+    if (strcmp(argv[1], "status") == 0) cache_refresh(repo_cache);
+    fflush(stdout);
+    fflush(stderr);
+
+    pid_t pid = fork();
+    if (pid < 0) {
+        perror("Failed to fork for request");
+        return 1;
     }
-    
-    char current_commit[HASH_SIZE];
-    if (fgets(current_commit, sizeof(current_commit), head)) {
-        current_commit[strcspn(current_commit, "\n")] = 0;  // remove newline
+    if (pid == 0) {
+        int null_fd = open("/dev/null", O_RDONLY);
+        if (null_fd >= 0) {
+            // prompts (blend) must never eat the command stream
+            dup2(null_fd, STDIN_FILENO);
+            close(null_fd);
+        }
+        if (out_fd >= 0) {
+            dup2(out_fd, STDOUT_FILENO);
+            dup2(out_fd, STDERR_FILENO);
+        }
+        int code = run_command(argc, argv);
+        fflush(stdout);
+        _exit(code);
     }
-    fclose(head);
-    
-    // create memory pointing to current moment
-    mkdir(MNEMOS_DIR "/memories", 0755);  // directory should exist
-    FILE *memory = fopen(memory_file, "w");
-    if (!memory) {
-        printf("Error: Could not capture memory\n");
-        return;
+
+    int wstatus;
+    while (waitpid(pid, &wstatus, 0) < 0) {
+        if (errno != EINTR) return 1;
     }
-    fprintf(memory, "%s", current_commit);
-    fclose(memory);
-    
-    printf("Captured memory: %s\n", memory_name);
+    return WIFEXITED(wstatus) ? WEXITSTATUS(wstatus) : 1;
 }
 
-// show what memories are saved
-void list_memories() {
-    DIR *dir = opendir(MNEMOS_DIR "/memories");
-    if (!dir) {
-        printf("No memories captured yet.\n");
-        return;
+// each answer ends with a NUL byte and the exit code, easy to split on
+void serve_batch() {
+    char *line = NULL;
+    size_t capacity = 0;
+    while (getline(&line, &capacity, stdin) != -1) {
+        line[strcspn(line, "\n")] = 0;
+
+        char *args[64];
+        args[0] = "mnemos";
+        int count = split_args(line, args + 1, 63) + 1;
+        if (count == 1) continue;
+        if (strcmp(args[1], "quit") == 0) break;
+
+        int code = serve_one(count, args, -1);
+        printf("%cexit %d\n", '\0', code);
+        fflush(stdout);
     }
+    free(line);
+}
 
-    printf("Captured memories:\n");
-    struct dirent *entry;
-    while ((entry = readdir(dir)) != NULL) {
-        if (entry->d_name[0] != '.') {  // skip . and ..
-            char memory_file[256];
-            snprintf(memory_file, sizeof(memory_file), 
-                    "%s/memories/%s", MNEMOS_DIR, entry->d_name);
-            
-            FILE *f = fopen(memory_file, "r");
-            if (f) {
-                char commit_hash[HASH_SIZE];
-                if (fgets(commit_hash, sizeof(commit_hash), f)) {
-                    commit_hash[strcspn(commit_hash, "\n")] = 0;  // remove newline
-                    printf("  %s -> moment %s\n", entry->d_name, commit_hash);
-                }
-                fclose(f);
+void serve_socket(const char *socket_path) {
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(socket_path) >= sizeof(addr.sun_path)) {
+        printf("Error: Socket path too long: %s\n", socket_path);
+        exit(1);
+    }
+    strcpy(addr.sun_path, socket_path);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) {
+        perror("Failed to create socket");
+        exit(1);
+    }
+    unlink(socket_path);
+    if (bind(fd, (struct sockaddr *) &addr, sizeof(addr)) != 0 || listen(fd, 64) != 0) {
+        perror("Failed to listen on socket");
+        exit(1);
+    }
+    printf("Serving %s on %s\n", MNEMOS_DIR, socket_path);
+    fflush(stdout);
+
+    for (;;) {
+        int conn = accept(fd, NULL, NULL);
+        if (conn < 0) {
+            if (errno == EINTR) continue;
+            perror("Failed to accept connection");
+            break;
+        }
+
+        // one request per connection, a single line
+        char request[4096];
+        size_t len = 0;
+        ssize_t n;
+        while (len < sizeof(request) - 1 && (n = read(conn, request + len, 1)) == 1) {
+            if (request[len] == '\n') break;
+            len++;
+        }
+        request[len] = '\0';
+
+        char *args[64];
+        args[0] = "mnemos";
+        int count = split_args(request, args + 1, 63) + 1;
+        if (count > 1) {
+            int code = serve_one(count, args, conn);
+            char trailer[32];
+            int trailer_len = snprintf(trailer, sizeof(trailer), "%cexit %d\n", '\0', code);
+            if (write(conn, trailer, trailer_len) < 0) {
+                // client went away, nothing to tell it
             }
         }
+        close(conn);
     }
-    closedir(dir);
+    close(fd);
+    unlink(socket_path);
 }
 
-// go back to a saved memory (recall)
-void recall_memory(const char *memory_name) {
-    char memory_file[256];
-    snprintf(memory_file, sizeof(memory_file), 
-            "%s/memories/%s", MNEMOS_DIR, memory_name);
-    
-    FILE *memory = fopen(memory_file, "r");
-    if (!memory) {
-        printf("Error: Memory '%s' not found\n", memory_name);
-        return;
+void serve(const char *socket_path) {
+    struct stat st;
+    if (stat(MNEMOS_DIR, &st) != 0) {
+        printf("Error: This is not a Mnemos repository. Initialize it first with 'mnemos init'.\n");
+        exit(1);
     }
-    
-    char commit_hash[HASH_SIZE];
-    if (fgets(commit_hash, sizeof(commit_hash), memory)) {
-        commit_hash[strcspn(commit_hash, "\n")] = 0;  // Remove newline
+
+    static struct repo_cache cache;
+    repo_cache = &cache;
+    signal(SIGPIPE, SIG_IGN);
+    cache_load(repo_cache);
+
+    if (socket_path) {
+        serve_socket(socket_path);
+    } else {
+        serve_batch();
     }
-    fclose(memory);
-    
-    printf("Recalling memory: %s\n", memory_name);
-    revert_clean(commit_hash);  // Use existing revert functionality
 }
 
-// blend another memory into current state
-void blend_memory(const char *source_memory) {
-    char memory_file[256];
-    snprintf(memory_file, sizeof(memory_file), 
-            "%s/memories/%s", MNEMOS_DIR, source_memory);
-    
-    FILE *memory = fopen(memory_file, "r");
-    if (!memory) {
-        printf("Error: Memory '%s' not found\n", source_memory);
-        return;
-    }
-    
-    // Get source commit
-    char source_commit[HASH_SIZE];
-    if (fgets(source_commit, sizeof(source_commit), memory)) {
-        source_commit[strcspn(source_commit, "\n")] = 0;
+// client side of `mnemos serve <socket>`: send one command, relay the answer
+int ask(const char *socket_path, int argc, char *argv[]) {
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(socket_path) >= sizeof(addr.sun_path)) {
+        printf("Error: Socket path too long: %s\n", socket_path);
+        return 1;
     }
-    fclose(memory);
+    strcpy(addr.sun_path, socket_path);
 
-    // Get list of files from source commit
-    char source_dir[256];
-    snprintf(source_dir, sizeof(source_dir), "%s/%s", COMMITS_DIR, source_commit);
-    
-    DIR *dir = opendir(source_dir);
-    if (!dir) {
-        printf("Error: Cannot read source memory state\n");
-        return;
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0 || connect(fd, (struct sockaddr *) &addr, sizeof(addr)) != 0) {
+        perror("Failed to connect to mnemos server");
+        return 1;
     }
 
-    printf("Blending memory '%s' into current state...\n", source_memory);
-    
-    // for each file in source memory
-    struct dirent *entry;
-    while ((entry = readdir(dir)) != NULL) {
-        if (strcmp(entry->d_name, ".") == 0 || 
-            strcmp(entry->d_name, "..") == 0 ||
-            strcmp(entry->d_name, "message") == 0 ||
-            strcmp(entry->d_name, "timestamp") == 0) {
-            continue;
+    // quote every word so spaces in messages survive the trip
+    char request[4096];
+    size_t len = 0;
+    for (int i = 0; i < argc && len < sizeof(request) - 4; i++) {
+        request[len++] = '"';
+        for (const char *p = argv[i]; *p && len < sizeof(request) - 4; p++) {
+            if (*p == '"' || *p == '\\') request[len++] = '\\';
+            request[len++] = *p;
         }
+        request[len++] = '"';
+        request[len++] = ' ';
+    }
+    request[len++] = '\n';
+    if (write(fd, request, len) != (ssize_t) len) {
+        perror("Failed to send request");
+        close(fd);
+        return 1;
+    }
 
-        char source_file[512], current_file[512];
-        snprintf(source_file, sizeof(source_file), "%s/%s", source_dir, entry->d_name);
-        snprintf(current_file, sizeof(current_file), "%s", entry->d_name);
-
-        // does file exist in current state
-        if (access(current_file, F_OK) != -1) {
-            char current_hash[HASH_SIZE], source_hash[HASH_SIZE];
-            hash_file(current_file, current_hash);
-            
-            FILE *source_hash_file = fopen(source_file, "r");
-            if (source_hash_file) {
-                fgets(source_hash, sizeof(source_hash), source_hash_file);
-                source_hash[strcspn(source_hash, "\n")] = 0;
-                fclose(source_hash_file);
-
-                if (strcmp(current_hash, source_hash) != 0) {
-                    printf("File differs: %s\n", entry->d_name);
-                    printf("  Keep current version? [Y/n]: ");
-                    char response[10];
-                    fgets(response, sizeof(response), stdin);
-                    if (response[0] == 'n' || response[0] == 'N') {
-                        // restore file from source memory
-                        char object_path[512];
-                        snprintf(object_path, sizeof(object_path), "%s/%s", OBJECTS_DIR, source_hash);
-                        copy_file(object_path, current_file);
-                        printf("  Updated with version from '%s'\n", source_memory);
-                    }
-                }
-            }
-        } else {
-            // if file doesnt exist in current state offer to add it
-            printf("New file from '%s': %s\n", source_memory, entry->d_name);
-            printf("  Add this file? [Y/n]: ");
-            char response[10];
-            fgets(response, sizeof(response), stdin);
-            if (response[0] != 'n' && response[0] != 'N') {
-                // file hash from source memory
-                FILE *source_hash_file = fopen(source_file, "r");
-                if (source_hash_file) {
-                    char file_hash[HASH_SIZE];
-                    fgets(file_hash, sizeof(file_hash), source_hash_file);
-                    file_hash[strcspn(file_hash, "\n")] = 0;
-                    fclose(source_hash_file);
-
-                    // restore file from objects
-                    char object_path[512];
-                    snprintf(object_path, sizeof(object_path), "%s/%s", OBJECTS_DIR, file_hash);
-                    create_directories(current_file);
-                    copy_file(object_path, current_file);
-                    printf("  Added file from '%s'\n", source_memory);
-                }
+    // relay everything up to the NUL, the rest is the exit code
+    char buffer[8192];
+    char trailer[32] = {0};
+    size_t trailer_len = 0;
+    int in_trailer = 0;
+    ssize_t n;
+    while ((n = read(fd, buffer, sizeof(buffer))) > 0) {
+        for (ssize_t i = 0; i < n; i++) {
+            if (in_trailer) {
+                if (trailer_len < sizeof(trailer) - 1) trailer[trailer_len++] = buffer[i];
+            } else if (buffer[i] == '\0') {
+                in_trailer = 1;
+            } else {
+                putchar(buffer[i]);
             }
         }
     }
-    closedir(dir);
+    close(fd);
 
-    printf("Memory blend complete. Don't forget to commit the changes!\n");
+    int code = 1;
+    sscanf(trailer, "exit %d", &code);
+    return code;
 }
 
-// master function
-int main(int argc, char *argv[]) {
-    if (argc < 2) {
-        printf("Usage: mnemos <command> [args]\n");
-        return 1;
+// commands that change the repository, these run one at a time
+int command_writes(int argc, char *argv[]) {
+    static const char *writers[] = {
+        "track", "commit", "revert", "recall", "remember", "send", "fetch", "gc", "bitmaps", "sync",
+        "pack-memories", "backfill-stats", "import", "fanout", "blend", "receive", "create-remote", NULL
+    };
+    for (int i = 0; writers[i]; i++) {
+        if (strcmp(argv[1], writers[i]) == 0) return 1;
     }
+    // setting, not reading
+    return (strcmp(argv[1], "config") == 0 && argc == 4) ||
+           (strcmp(argv[1], "remote") == 0 && argc >= 3 && strcmp(argv[2], "list") != 0) ||
+           (strcmp(argv[1], "sparse") == 0 && argc > 2) ||
+           (strcmp(argv[1], "bundle") == 0 && argc > 2 && strcmp(argv[2], "apply") == 0) ||
+           (strcmp(argv[1], "worktree") == 0 && argc > 2 && strcmp(argv[2], "add") == 0);
+}
+
+int dispatch_command(int argc, char *argv[]);
+
+// run one command line under the lock if it writes, shared by main and `mnemos serve`
+int run_command(int argc, char *argv[]) {
+    int writes = command_writes(argc, argv);
+    if (writes) repo_lock();
+    int code = dispatch_command(argc, argv);
+    if (writes) repo_unlock();
+    return code;
+}
 
+int dispatch_command(int argc, char *argv[]) {
     if (strcmp(argv[1], "init") == 0) {
         init();
     } else if (strcmp(argv[1], "track") == 0 && argc == 3) {
@@ -1296,22 +9638,86 @@ int main(int argc, char *argv[]) {
         }
     } else if (strcmp(argv[1], "commit") == 0 && argc == 3) {
         commit(argv[2]);
-    } else if (strcmp(argv[1], "revert") == 0 && argc == 3) {
-        revert(argv[2]);
+    } else if (strcmp(argv[1], "revert") == 0 && argc >= 3) {
+        struct path_table scope;
+        struct path_table *cone = cone_from_paths(&scope, argc - 3, argv + 3);
+        revert(argv[2], cone);
+        if (cone) path_table_free(cone);
+    } else if (strcmp(argv[1], "remote") == 0 && argc == 3 && strcmp(argv[2], "list") == 0) {
+        remote_list();
+    } else if (strcmp(argv[1], "remote") == 0 && argc == 5 && strcmp(argv[2], "add") == 0) {
+        remote_add(argv[3], argv[4]);
+    } else if (strcmp(argv[1], "remote") == 0 && argc == 4 && strcmp(argv[2], "remove") == 0) {
+        remote_remove(argv[3]);
+    } else if (strcmp(argv[1], "remote") == 0 && argc >= 4 && strcmp(argv[2], "group") == 0) {
+        remote_group(argv[3], argc - 4, argv + 4);
+    } else if (strcmp(argv[1], "remote") == 0 && argc >= 3 &&
+               (strcmp(argv[2], "add") == 0 || strcmp(argv[2], "remove") == 0 ||
+                strcmp(argv[2], "group") == 0 || strcmp(argv[2], "list") == 0)) {
+        // a subcommand with the wrong arguments, not a remote called "add"
+        printf("Usage: mnemos remote add <name> <url>\n"
+               "       mnemos remote remove <name>\n"
+               "       mnemos remote group <group> [<remote>...]\n"
+               "       mnemos remote list\n");
+        return 1;
     } else if (strcmp(argv[1], "remote") == 0 && argc == 3) {
         set_remote(argv[2]);
+    } else if (strcmp(argv[1], "send") == 0 && argc > 2) {
+        return send_many(argc - 2, argv + 2);
     } else if (strcmp(argv[1], "send") == 0) {
-        send();
+        send_remote();
     } else if (strcmp(argv[1], "fetch") == 0) {
         fetch();
+    } else if (strcmp(argv[1], "receive") == 0 && argc == 4) {
+        return receive(argv[2], argv[3]);
+    } else if (strcmp(argv[1], "bundle") == 0 && (argc == 4 || argc == 5) && strcmp(argv[2], "create") == 0) {
+        return bundle_create(argv[3], argc == 5 ? argv[4] : NULL);
+    } else if (strcmp(argv[1], "bundle") == 0 && argc == 4 && strcmp(argv[2], "apply") == 0) {
+        return bundle_apply(argv[3]);
+    } else if (strcmp(argv[1], "export") == 0 && argc >= 3) {
+        const char *format = "tar", *prefix = NULL;
+        for (int i = 3; i < argc; i++) {
+            if (strcmp(argv[i], "--format") == 0 && i + 1 < argc) {
+                format = argv[++i];
+            } else if (strcmp(argv[i], "--prefix") == 0 && i + 1 < argc) {
+                prefix = argv[++i];
+            } else {
+                printf("Usage: mnemos export <commit|memory> [--format tar|tar.gz|tar.zst] [--prefix <dir/>]\n");
+                return 1;
+            }
+        }
+        return export_commit(argv[2], format, prefix);
+    } else if (strcmp(argv[1], "import") == 0 && argc == 2) {
+        return import_stream(stdin);
+    } else if (strcmp(argv[1], "export-history") == 0 && argc == 2) {
+        return export_history();
+    } else if (strcmp(argv[1], "sync") == 0 && argc == 3) {
+        return sync_repo(argv[2]);
+    } else if (strcmp(argv[1], "sync-serve") == 0 && argc == 3) {
+        return sync_serve(argv[2]);
     } else if (strcmp(argv[1], "create-remote") == 0 && argc == 3) {
         create_remote(argv[2]);
     } else if (strcmp(argv[1], "remote-init") == 0) {
         remote_init();
+    } else if (strcmp(argv[1], "changes") == 0 && argc == 4) {
+        show_changes(argv[2], argv[3]);
+    } else if (strcmp(argv[1], "log") == 0 && argc == 3) {
+        log_path(argv[2], 0);
+    } else if (strcmp(argv[1], "log") == 0 && argc == 4 && strcmp(argv[2], "--follow") == 0) {
+        log_path(argv[3], 1);
     } else if (strcmp(argv[1], "list-commits") == 0) {
         list_commits();
+    } else if (strcmp(argv[1], "moments") == 0 && argc >= 4 && strcmp(argv[2], "--grep") == 0) {
+        // the rest of the line is the query
+        char *query = argv[3];
+        for (int i = 4; i < argc; i++) query = arena_printf(&cmd_arena, "%s %s", query, argv[i]);
+        grep_moments(query);
+    } else if (strcmp(argv[1], "moments") == 0 && argc >= 3 && strcmp(argv[2], "--stat") == 0 && argc <= 4) {
+        moments(argc == 4 ? argv[3] : "-n", 1);
     } else if (strcmp(argv[1], "moments") == 0 && argc == 3) {
-        moments(argv[2]); // -n or -o
+        moments(argv[2], 0); // -n or -o
+    } else if (strcmp(argv[1], "backfill-stats") == 0) {
+        backfill_stats();
     } else if (strcmp(argv[1], "diff") == 0) {
         if (argc == 5) {
             // diff between 2 commits
@@ -1336,15 +9742,69 @@ int main(int argc, char *argv[]) {
         status();
     } else if (strcmp(argv[1], "remember") == 0 && argc == 3) {
         create_memory(argv[2]);
-    } else if (strcmp(argv[1], "memories") == 0) {
-        list_memories();
-    } else if (strcmp(argv[1], "recall") == 0 && argc == 3) {
-        recall_memory(argv[2]);
+    } else if (strcmp(argv[1], "memories") == 0 && argc <= 3) {
+        list_memories(argc == 3 ? argv[2] : NULL);
+    } else if (strcmp(argv[1], "pack-memories") == 0) {
+        pack_memories();
+    } else if (strcmp(argv[1], "recall") == 0 && argc >= 3) {
+        struct path_table scope;
+        struct path_table *cone = cone_from_paths(&scope, argc - 3, argv + 3);
+        recall_memory(argv[2], cone);
+        if (cone) path_table_free(cone);
     } else if (strcmp(argv[1], "blend") == 0 && argc == 3) {
         blend_memory(argv[2]);
+    } else if (strcmp(argv[1], "gc") == 0) {
+        int grace_days = GC_DEFAULT_GRACE_DAYS, max_objects = 0, dry_run = 0;
+        for (int i = 2; i < argc; i++) {
+            if (strcmp(argv[i], "--grace") == 0 && i + 1 < argc) {
+                grace_days = atoi(argv[++i]);
+            } else if (strcmp(argv[i], "--max") == 0 && i + 1 < argc) {
+                max_objects = atoi(argv[++i]);
+            } else if (strcmp(argv[i], "--dry-run") == 0) {
+                dry_run = 1;
+            } else {
+                printf("Usage: mnemos gc [--grace <days>] [--max <objects>] [--dry-run]\n");
+                return 1;
+            }
+        }
+        gc(grace_days, max_objects, dry_run);
+    } else if (strcmp(argv[1], "config") == 0 && (argc == 3 || argc == 4)) {
+        config(argv[2], argc == 4 ? argv[3] : NULL);
+    } else if (strcmp(argv[1], "clone") == 0 && argc == 4) {
+        clone_repo(argv[2], argv[3]);
+    } else if (strcmp(argv[1], "worktree") == 0 && argc == 5 && strcmp(argv[2], "add") == 0) {
+        worktree_add(argv[3], argv[4]);
+    } else if (strcmp(argv[1], "worktree") == 0 && argc == 3 && strcmp(argv[2], "list") == 0) {
+        worktree_list();
+    } else if (strcmp(argv[1], "sparse") == 0) {
+        sparse(argc - 2, argv + 2);
+    } else if (strcmp(argv[1], "bitmaps") == 0) {
+        build_bitmaps();
+    } else if (strcmp(argv[1], "count-objects") == 0) {
+        count_objects();
+    } else if (strcmp(argv[1], "fanout") == 0 && argc == 3) {
+        return fanout(argv[2]);
+    } else if (strcmp(argv[1], "fsck") == 0) {
+        return fsck();
+    } else if (strcmp(argv[1], "serve") == 0 && argc == 3) {
+        serve(strcmp(argv[2], "--batch") == 0 ? NULL : argv[2]);
+    } else if (strcmp(argv[1], "ask") == 0 && argc >= 4) {
+        return ask(argv[2], argc - 3, argv + 3);
     } else {
         printf("Unknown command or incorrect arguments\n");
     }
 
-    return 0; 
+    return 0;
+}
+
+// master function
+int main(int argc, char *argv[]) {
+    if (argc < 2) {
+        printf("Usage: mnemos <command> [args]\n");
+        return 1;
+    }
+
+    int code = run_command(argc, argv);
+    arena_free(&cmd_arena);
+    return code; 
 }
\ No newline at end of file